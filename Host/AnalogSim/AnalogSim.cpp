@@ -0,0 +1,367 @@
+/*! @file
+ *
+ *  @brief Model of SPI2 and the TWR-ADCDAC-LTC board, to run SPI.c and analog.c on a Linux host.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-08
+ */
+
+#include "AnalogSim.h"
+#include "MK70F12.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace analogsim
+{
+
+StatusRegister SPI2SR;
+PushRegister SPI2PUSHR;
+PopRegister SPI2POPR;
+PortSetClearRegister GPIOEPSOR = {true}, GPIOEPCOR = {false};
+uint32_t SPI2MCR, SPI2CTAR[2];
+uint32_t Ignored;
+
+namespace
+{
+
+constexpr uint32_t DECODER_A0_MASK = 1u << 27;
+constexpr uint32_t DECODER_A1_MASK = 1u << 5;
+constexpr uint8_t ADC_DEVICE = 7;
+constexpr uint8_t DAC_DEVICE = 4;
+
+const uint32_t BAUD_PRESCALERS[4] = {2, 3, 5, 7};
+const uint32_t BAUD_SCALERS[16] = {2, 4, 6, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768};
+const uint32_t DELAY_PRESCALERS[4] = {1, 3, 5, 7};
+
+struct ADC
+{
+  bool converting;
+  uint8_t command;
+  double startedAt;
+  uint16_t result;
+};
+
+struct DAC
+{
+  uint32_t word;
+  uint8_t nbFrames;
+  uint16_t code[NB_DAC_CHANNELS];
+  uint16_t output[NB_DAC_CHANNELS];
+};
+
+double ClockNs;                               // Module clock period
+double Time;                                  // Modelled time, ns
+uint32_t PortE;
+uint32_t Status;
+uint16_t Received;
+
+bool InFlight, PCSAsserted;
+uint32_t Frame;                               // PUSHR of the frame in flight
+double FrameStart, FrameEnd;
+double PCSFreeAt;                             // PCS0 may assert again, after the delay after transfer
+
+ADC Converter;
+DAC Outputs;
+std::function<double(double)> Inputs[NB_ADC_CHANNELS];
+double Sampled[NB_ADC_CHANNELS];
+Stats Statistics;
+
+std::function<void()> Interrupt;
+bool InterruptsEnabled, InInterrupt, InterruptPending;
+
+double DelayNs(uint32_t prescaler, uint32_t scaler)
+{
+  return DELAY_PRESCALERS[prescaler] * double(2u << scaler) * ClockNs;
+}
+
+uint8_t Device()
+{
+  return 4 + ((PortE & DECODER_A0_MASK) ? 1 : 0) + ((PortE & DECODER_A1_MASK) ? 2 : 0);
+}
+
+double Input(uint8_t channel, double at)
+{
+  return Inputs[channel] ? Inputs[channel](at) : 0.0;
+}
+
+/*! @brief Starts the LTC1859 converting a command when PCS0 negates. */
+void StartConversion(uint8_t command, double at)
+{
+  bool single = command & 0x80;
+  uint8_t channel = ((command >> 4) & 0x3) * 2 + ((command & 0x40) ? 1 : 0);
+  double range = (command & 0x04) ? 10.0 : 5.0;
+  double volts;
+
+  if (single)
+    volts = Input(channel, at);
+  else
+    volts = Input(channel & ~1, at) - Input(channel | 1, at);
+
+  if (command & 0x08)                         // Unipolar: 0 to range
+    volts = volts - range / 2.0, range /= 2.0;
+
+  double code = std::lround(volts / range * 32768.0);
+  code = std::min(32767.0, std::max(-32768.0, code));
+
+  Converter.converting = true;
+  Converter.command = command;
+  Converter.startedAt = at;
+  Converter.result = uint16_t(int16_t(code));
+  Statistics.conversions++;
+}
+
+void DACWord(uint32_t word)
+{
+  uint8_t command = (word >> 20) & 0xF, address = (word >> 16) & 0xF;
+  uint16_t data = word & 0xFFFF;
+
+  Statistics.dacWords++;
+  for (uint8_t dac = 0; dac < NB_DAC_CHANNELS; dac++)
+  {
+    if (address != 0xF && address != dac * 2)
+      continue;
+
+    switch (command)
+    {
+      case 0x2:                               // Write span
+        break;
+      case 0x3:
+        Outputs.code[dac] = data;
+        break;
+      case 0x4:
+        Outputs.output[dac] = Outputs.code[dac];
+        break;
+      case 0x7:
+        Outputs.code[dac] = Outputs.output[dac] = data;
+        break;
+      default:
+        Statistics.errors++;
+        return;
+    }
+  }
+}
+
+void RunInterrupt()
+{
+  InInterrupt = true;
+  Statistics.interrupts++;
+  Interrupt();
+  InInterrupt = false;
+}
+
+/*! @brief Runs the frame in flight to its end. */
+void FinishFrame()
+{
+  bool cont = Frame & SPI_PUSHR_CONT_MASK;
+  uint16_t sent = Frame & 0xFFFF;
+  uint8_t device = Device();
+
+  Time = std::max(Time, FrameEnd);
+  InFlight = false;
+  Statistics.frames++;
+
+  if (device == ADC_DEVICE)
+  {
+    if (Converter.converting && FrameStart < Converter.startedAt + ADC_CONVERSION_NS)
+    {
+      Statistics.violations++;
+      Received = 0xA5A5;
+    }
+    else if (Converter.converting)
+    {
+      Received = Converter.result;
+      if (Converter.command & 0x80)
+        Sampled[((Converter.command >> 4) & 0x3) * 2 + ((Converter.command & 0x40) ? 1 : 0)] = Converter.startedAt;
+    }
+    else
+      Received = 0;
+
+    if (cont)
+      Statistics.errors++;
+    else
+      StartConversion(sent >> 8, FrameEnd);
+  }
+  else
+  {
+    Received = 0;
+    if (device == DAC_DEVICE)
+    {
+      Outputs.word = (Outputs.word << 16) | sent;
+      Outputs.nbFrames++;
+      if (!cont)
+      {
+        if (Outputs.nbFrames == 2)
+          DACWord(Outputs.word);
+        else
+          Statistics.errors++;
+        Outputs.word = 0;
+        Outputs.nbFrames = 0;
+      }
+    }
+  }
+
+  Status |= SPI_SR_RFDF_MASK | SPI_SR_TCF_MASK;
+}
+
+}
+
+StatusRegister::operator uint32_t() const
+{
+  if (InFlight)
+    FinishFrame();
+  return Status;
+}
+
+StatusRegister& StatusRegister::operator=(uint32_t value)
+{
+  Status &= ~value;
+  if (!InFlight)
+    Status |= SPI_SR_TFFF_MASK;               // The FIFO is disabled, so the buffer is free once the frame has started
+  return *this;
+}
+
+PushRegister& PushRegister::operator=(uint32_t value)
+{
+  if (Interrupt && !InInterrupt)
+  {
+    if (InterruptsEnabled)
+      RunInterrupt();                         // Between the driver's previous frame and this one
+    else
+      InterruptPending = true;
+  }
+
+  if (InFlight || (SPI2MCR & SPI_MCR_HALT_MASK))
+  {
+    Statistics.errors++;
+    return *this;
+  }
+
+  uint32_t ctar = SPI2CTAR[(value >> 28) & 0x1];
+  uint32_t bits = ((ctar >> 27) & 0xF) + 1;
+  double sck = BAUD_PRESCALERS[(ctar >> 16) & 0x3] * BAUD_SCALERS[ctar & 0xF] * ClockNs;
+
+  Frame = value;
+  InFlight = true;
+  Status &= ~SPI_SR_TFFF_MASK;
+
+  if (PCSAsserted)
+    FrameStart = Time;
+  else
+    FrameStart = std::max(Time, PCSFreeAt);
+
+  FrameEnd = FrameStart + bits * sck;
+  if (!PCSAsserted)
+    FrameEnd += DelayNs((ctar >> 22) & 0x3, (ctar >> 12) & 0xF);      // PCS to SCK, 2^(CSSCK+1) clocks
+  PCSAsserted = value & SPI_PUSHR_CONT_MASK;
+  if (!PCSAsserted)
+  {
+    FrameEnd += DelayNs((ctar >> 20) & 0x3, (ctar >> 8) & 0xF);        // SCK to PCS, 2^(ASC+1) clocks
+    PCSFreeAt = FrameEnd + DelayNs((ctar >> 18) & 0x3, (ctar >> 4) & 0xF);
+  }
+
+  return *this;
+}
+
+PopRegister::operator uint32_t() const
+{
+  return Received;
+}
+
+PortSetClearRegister& PortSetClearRegister::operator=(uint32_t value)
+{
+  uint8_t device = Device();
+
+  if (set)
+    PortE |= value;
+  else
+    PortE &= ~value;
+
+  if (PCSAsserted && Device() != device)
+  {
+    Statistics.errors++;                      // PCS0 negates on the device in the middle of its word
+    Outputs.word = 0;
+    Outputs.nbFrames = 0;
+  }
+  return *this;
+}
+
+void Reset(uint32_t moduleClock)
+{
+  ClockNs = 1e9 / moduleClock;
+  Time = PCSFreeAt = 0;
+  PortE = 0;
+  Status = SPI_SR_TFFF_MASK;
+  Received = 0;
+  InFlight = PCSAsserted = false;
+  SPI2MCR = SPI_MCR_HALT_MASK;
+  Converter = ADC();
+  Outputs = DAC();
+  for (uint8_t channel = 0; channel < NB_ADC_CHANNELS; channel++)
+  {
+    Inputs[channel] = nullptr;
+    Sampled[channel] = 0;
+  }
+  Statistics = Stats();
+  Interrupt = nullptr;
+  InterruptsEnabled = true;
+  InInterrupt = InterruptPending = false;
+}
+
+void SetInterrupt(std::function<void()> handler)
+{
+  Interrupt = handler;
+}
+
+void DisableInterrupts()
+{
+  InterruptsEnabled = false;
+}
+
+void EnableInterrupts()
+{
+  InterruptsEnabled = true;
+  if (InterruptPending && !InInterrupt)
+  {
+    InterruptPending = false;
+    RunInterrupt();
+  }
+}
+
+void SetInput(uint8_t channel, std::function<double(double)> voltage)
+{
+  Inputs[channel] = voltage;
+}
+
+void Idle(double ns)
+{
+  Time += ns;
+}
+
+double Now()
+{
+  return Time;
+}
+
+double SampledAt(uint8_t channel)
+{
+  return Sampled[channel];
+}
+
+int16_t DACOutput(uint8_t channel)
+{
+  return int16_t(Outputs.output[channel] ^ 0x8000);
+}
+
+int16_t ADCCode(double volts)
+{
+  double code = std::lround(volts / 10.0 * 32768.0);
+  return int16_t(std::min(32767.0, std::max(-32768.0, code)));
+}
+
+const Stats& GetStats()
+{
+  return Statistics;
+}
+
+}
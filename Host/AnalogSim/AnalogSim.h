@@ -0,0 +1,95 @@
+/*! @file
+ *
+ *  @brief Model of SPI2 and the TWR-ADCDAC-LTC board, to run SPI.c and analog.c on a Linux host.
+ *
+ *  SPI2 clocks each pushed frame with the timing its CTAR gives: PCS to SCK delay, the bits at the
+ *  SCK rate, SCK to PCS delay, then the delay after transfer before PCS may assert again. Modelled
+ *  time only runs while the driver polls SPI2_SR, so it is the time the driver waits on the bus.
+ *  PCS0 reaches the device the decoder address lines select. The LTC1859 starts converting the
+ *  command of a frame when PCS0 negates, samples its input there, and returns the result in the
+ *  next frame; a frame that asserts PCS0 before the conversion time has passed is counted as a
+ *  violation and returns garbage. The LTC2704 takes 32-bit words with PCS0 held between frames;
+ *  moving the decoder to another device while PCS0 is held cuts the word, and is counted as an error.
+ *  An interrupt handler can be set to run before any frame the driver pushes, as the PIT0 interrupt
+ *  could; OS_DisableInterrupts holds it pending until OS_EnableInterrupts.
+ *
+ *  Build (Linux, not part of the firmware build):
+ *    g++ -std=c++17 -O2 -Wall -Wextra -I. -I../../Sources -o analog_sim main.cpp AnalogSim.cpp \
+ *        -x c++ ../../Sources/SPI.c ../../Sources/analog.c
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-08
+ */
+
+#ifndef ANALOGSIM_H
+#define ANALOGSIM_H
+
+#include <cstdint>
+#include <functional>
+
+namespace analogsim
+{
+
+constexpr uint8_t NB_ADC_CHANNELS = 8;
+constexpr uint8_t NB_DAC_CHANNELS = 4;
+constexpr double ADC_CONVERSION_NS = 5000.0;  // Conversion time the ADC is given after PCS0 negates
+
+/*! @brief What the model has done since Reset. */
+struct Stats
+{
+  uint32_t frames = 0;                        // Frames clocked on SPI2
+  uint32_t conversions = 0;                   // LTC1859 conversions started
+  uint32_t violations = 0;                    // LTC1859 frames started before the conversion time had passed
+  uint32_t dacWords = 0;                      // LTC2704 words received
+  uint32_t errors = 0;                        // Pushes while a frame was in flight, and malformed or cut words
+  uint32_t interrupts = 0;                    // Runs of the interrupt handler
+};
+
+/*! @brief Puts SPI2 and the board back to their reset state, with every input at 0V.
+ *
+ *  @param moduleClock The module clock rate in Hz SPI2 is clocked from.
+ */
+void Reset(uint32_t moduleClock);
+
+/*! @brief Sets the voltage on an ADC input.
+ *
+ *  @param channel The LTC1859 channel, 0 to NB_ADC_CHANNELS - 1.
+ *  @param voltage The voltage as a function of modelled time in ns.
+ */
+void SetInput(uint8_t channel, std::function<double(double)> voltage);
+
+/*! @brief Lets modelled time pass, as the CPU would doing other work.
+ *
+ *  @param ns The time.
+ */
+void Idle(double ns);
+
+/*! @brief Sets the handler run as an interrupt before every frame the driver pushes outside it.
+ *
+ *  @param handler The handler, nullptr for none.
+ */
+void SetInterrupt(std::function<void()> handler);
+
+/*! @brief OS_DisableInterrupts: an interrupt due meanwhile is held pending. */
+void DisableInterrupts();
+
+/*! @brief OS_EnableInterrupts: runs the pending interrupt, if any. */
+void EnableInterrupts();
+
+/*! @brief Modelled time since Reset, in ns. */
+double Now();
+
+/*! @brief The modelled time the last result returned for an ADC input was sampled at, in ns. */
+double SampledAt(uint8_t channel);
+
+/*! @brief The code an LTC2704 output was last updated to, as two's complement. */
+int16_t DACOutput(uint8_t channel);
+
+/*! @brief The code the LTC1859 gives for a voltage, in its single ended +/- 10V range. */
+int16_t ADCCode(double volts);
+
+const Stats& GetStats();
+
+}
+
+#endif
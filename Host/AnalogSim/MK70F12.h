@@ -0,0 +1,113 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the MK70F12 register definitions used by SPI.c.
+ *
+ *  SPI2_SR, SPI2_PUSHR, SPI2_POPR and the GPIOE set and clear registers are objects of the SPI
+ *  model, so a push starts a frame and polling the status register lets modelled time run until
+ *  the frame is clocked in. The other registers are plain words. Only what SPI.c uses is defined.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-08
+ */
+
+#ifndef MK70F12_H
+#define MK70F12_H
+
+#include <stdint.h>
+
+namespace analogsim
+{
+
+/*! @brief SPI2_SR: reading it runs the model, writing 1s clears flags. */
+struct StatusRegister
+{
+  operator uint32_t() const;
+  StatusRegister& operator=(uint32_t value);
+};
+
+/*! @brief SPI2_PUSHR: writing it queues a frame. */
+struct PushRegister
+{
+  PushRegister& operator=(uint32_t value);
+};
+
+/*! @brief SPI2_POPR: reading it gives the last frame clocked in. */
+struct PopRegister
+{
+  operator uint32_t() const;
+};
+
+/*! @brief GPIOE_PSOR or GPIOE_PCOR: writing it sets or clears port E pins. */
+struct PortSetClearRegister
+{
+  bool set;
+  PortSetClearRegister& operator=(uint32_t value);
+};
+
+extern StatusRegister SPI2SR;
+extern PushRegister SPI2PUSHR;
+extern PopRegister SPI2POPR;
+extern PortSetClearRegister GPIOEPSOR, GPIOEPCOR;
+extern uint32_t SPI2MCR, SPI2CTAR[2];
+extern uint32_t Ignored;            /*!< Sink for the clock gating, pin control and data direction registers */
+
+}
+
+#define SPI2_SR     analogsim::SPI2SR
+#define SPI2_PUSHR  analogsim::SPI2PUSHR
+#define SPI2_POPR   analogsim::SPI2POPR
+#define SPI2_MCR    analogsim::SPI2MCR
+#define SPI2_CTAR0  analogsim::SPI2CTAR[0]
+#define SPI2_CTAR1  analogsim::SPI2CTAR[1]
+#define GPIOE_PSOR  analogsim::GPIOEPSOR
+#define GPIOE_PCOR  analogsim::GPIOEPCOR
+#define GPIOE_PDDR  analogsim::Ignored
+#define SIM_SCGC3   analogsim::Ignored
+#define SIM_SCGC5   analogsim::Ignored
+#define PORTD_PCR11 analogsim::Ignored
+#define PORTD_PCR12 analogsim::Ignored
+#define PORTD_PCR13 analogsim::Ignored
+#define PORTD_PCR14 analogsim::Ignored
+#define PORTD_PCR15 analogsim::Ignored
+#define PORTE_PCR5  analogsim::Ignored
+#define PORTE_PCR27 analogsim::Ignored
+
+#define SIM_SCGC3_DSPI2_MASK     0x1000u
+#define SIM_SCGC5_PORTD_MASK     0x1000u
+#define SIM_SCGC5_PORTE_MASK     0x2000u
+#define PORT_PCR_DSE_MASK        0x40u
+#define PORT_PCR_MUX(x)          (((uint32_t)(x) << 8) & 0x700u)
+
+#define SPI_MCR_HALT_MASK        0x1u
+#define SPI_MCR_CLR_RXF_MASK     0x400u
+#define SPI_MCR_CLR_TXF_MASK     0x800u
+#define SPI_MCR_DIS_RXF_MASK     0x1000u
+#define SPI_MCR_DIS_TXF_MASK     0x2000u
+#define SPI_MCR_PCSIS(x)         (((uint32_t)(x) << 16) & 0x3F0000u)
+#define SPI_MCR_FRZ_MASK         0x8000000u
+#define SPI_MCR_CONT_SCKE_MASK   0x40000000u
+#define SPI_MCR_MSTR_MASK        0x80000000u
+
+#define SPI_CTAR_BR(x)           (((uint32_t)(x) << 0) & 0xFu)
+#define SPI_CTAR_DT(x)           (((uint32_t)(x) << 4) & 0xF0u)
+#define SPI_CTAR_ASC(x)          (((uint32_t)(x) << 8) & 0xF00u)
+#define SPI_CTAR_CSSCK(x)        (((uint32_t)(x) << 12) & 0xF000u)
+#define SPI_CTAR_PBR(x)          (((uint32_t)(x) << 16) & 0x30000u)
+#define SPI_CTAR_PDT(x)          (((uint32_t)(x) << 18) & 0xC0000u)
+#define SPI_CTAR_PASC(x)         (((uint32_t)(x) << 20) & 0x300000u)
+#define SPI_CTAR_PCSSCK(x)       (((uint32_t)(x) << 22) & 0xC00000u)
+#define SPI_CTAR_LSBFE_MASK      0x1000000u
+#define SPI_CTAR_CPHA_MASK       0x2000000u
+#define SPI_CTAR_CPOL_MASK       0x4000000u
+#define SPI_CTAR_FMSZ(x)         (((uint32_t)(x) << 27) & 0x78000000u)
+
+#define SPI_SR_RFDF_MASK         0x20000u
+#define SPI_SR_TFFF_MASK         0x2000000u
+#define SPI_SR_TCF_MASK          0x80000000u
+
+#define SPI_PUSHR_TXDATA(x)      (((uint32_t)(x) << 0) & 0xFFFFu)
+#define SPI_PUSHR_PCS(x)         (((uint32_t)(x) << 16) & 0x3F0000u)
+#define SPI_PUSHR_CTAS(x)        (((uint32_t)(x) << 28) & 0x70000000u)
+#define SPI_PUSHR_CONT_MASK      0x80000000u
+
+#endif
@@ -0,0 +1,25 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the OS interrupt masking used by analog.c.
+ *
+ *  OS_DisableInterrupts and OS_EnableInterrupts hold and release the interrupt handler of the SPI model.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-08
+ */
+
+#ifndef OS_H
+#define OS_H
+
+namespace analogsim
+{
+
+void DisableInterrupts();
+void EnableInterrupts();
+
+}
+
+#define OS_DisableInterrupts() analogsim::DisableInterrupts()
+#define OS_EnableInterrupts()  analogsim::EnableInterrupts()
+
+#endif
@@ -0,0 +1,445 @@
+/*! @file
+ *
+ *  @brief Checks and benchmarks of the analog driver (Sources/analog.c, Sources/SPI.c) on the SPI model.
+ *
+ *  analog_sim check
+ *    Sets up the driver, then checks the values Analog_Get and Analog_GetMany return against the
+ *    inputs at the instants the ADC sampled them, for fixed and moving inputs and several channel
+ *    orders, and the codes Analog_Put leaves on the DAC outputs, also with a PIT0 interrupt taking
+ *    a burst of samples before any frame. Fails on any conversion started too early or malformed
+ *    frame or word.
+ *  analog_sim bench <samples>
+ *    Takes <samples> samples of the three channels the tower samples, first as the previous library
+ *    did, two frames per channel, then with Analog_GetMany, and reports the bus time per sample
+ *    and the spread of the sampling instants across the channels.
+ *  analog_sim jitter <samples>
+ *    Models <samples> PIT0 periods at 16 and 128 samples a cycle, taking each sample in the PIT0
+ *    interrupt and, as before, in PIT0Thread, and histograms the change in the instant channel 0 is
+ *    sampled at from one sample to the next, in the bins of SampleJitterHistogram. The bursts run
+ *    on the SPI model; the rest of the firmware is the load below, its costs assumed, not measured:
+ *    a command every 5 to 15ms, its 5 bytes in and a 10 byte reply out at 115200 baud, 2us in the
+ *    UART interrupt, then 6us in RxThread or 4us in TxThread a byte; interrupts masked for 0.4 to
+ *    2us every 500us on average; 5us from the PIT0 interrupt into PIT0Thread; and once a window is
+ *    full, 20us + 1.2us a sample in each of the three channel threads, above PIT0Thread.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-08
+ */
+
+#include "AnalogSim.h"
+
+#include "analog.h"
+#include "SPI.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace analogsim;
+
+static const uint32_t MODULE_CLOCK = 25000000;
+static const uint8_t NB_SAMPLED = 3;                  // Channels the tower samples
+static const double SAMPLE_PERIOD_NS = 1250000.0;     // 16 samples a cycle at 50Hz
+
+static int Failures;
+
+static void Expect(bool condition, const char* what)
+{
+  if (!condition)
+  {
+    if (Failures++ < 10)
+      std::printf("FAIL: %s\n", what);
+  }
+}
+
+static double Sine(uint8_t channel, double ns)
+{
+  return 8.0 * std::sin(2 * M_PI * 50.0 * ns * 1e-9 + channel * 2 * M_PI / 3);
+}
+
+/*! @brief Checks values read from the ADC against the inputs at the instants they were sampled. */
+static void ExpectSampled(const uint8_t channels[], const int16_t values[], uint8_t nbChannels, const char* what)
+{
+  for (uint8_t i = 0; i < nbChannels; i++)
+  {
+    int16_t expected = ADCCode(Sine(channels[i], SampledAt(channels[i])));
+    Expect(std::abs(values[i] - expected) <= 1, what);
+  }
+}
+
+static int Check()
+{
+  static const double LEVELS[4] = {3.3, -7.25, 9.9, -0.5};
+
+  Reset(MODULE_CLOCK);
+  Expect(Analog_Init(MODULE_CLOCK), "Analog_Init");
+  Expect(GetStats().dacWords == 3, "DAC set up in three words");
+  for (uint8_t dac = 0; dac < ANALOG_NB_OUTPUTS; dac++)
+    Expect(DACOutput(dac) == 0, "DAC outputs start at 0V");
+
+  for (uint8_t channel = 0; channel < ANALOG_NB_INPUTS; channel++)
+  {
+    double level = LEVELS[channel];
+    SetInput(channel, [level](double) { return level; });
+  }
+  SetInput(4, [](double) { return 5.0; });
+
+  // One channel at a time, in every order
+  for (uint8_t round = 0; round < 3; round++)
+    for (uint8_t i = 0; i < ANALOG_NB_INPUTS; i++)
+    {
+      uint8_t channel = (round == 1) ? ANALOG_NB_INPUTS - 1 - i : (i * 3) % ANALOG_NB_INPUTS;
+      int16_t value;
+      Expect(Analog_Get(channel, &value), "Analog_Get");
+      Expect(std::abs(value - ADCCode(LEVELS[channel])) <= 1, "Analog_Get value");
+    }
+
+  // Bursts of several channels
+  static const uint8_t ORDERS[][ANALOG_NB_INPUTS] = {{0, 1, 2, 3}, {3, 1, 2, 0}, {2, 2, 0, 1}};
+  for (const auto& order : ORDERS)
+    for (uint8_t nb = 1; nb <= ANALOG_NB_INPUTS; nb++)
+    {
+      int16_t values[ANALOG_NB_INPUTS];
+      Expect(Analog_GetMany(order, values, nb), "Analog_GetMany");
+      for (uint8_t i = 0; i < nb; i++)
+        Expect(std::abs(values[i] - ADCCode(LEVELS[order[i]])) <= 1, "Analog_GetMany value");
+    }
+
+  // Moving inputs, read at the instants they were sampled
+  for (uint8_t channel = 0; channel < ANALOG_NB_INPUTS; channel++)
+    SetInput(channel, [channel](double ns) { return Sine(channel, ns); });
+  for (uint32_t sample = 0; sample < 200; sample++)
+  {
+    static const uint8_t channels[NB_SAMPLED] = {0, 1, 2};
+    int16_t values[NB_SAMPLED];
+
+    Idle(SAMPLE_PERIOD_NS / 7);
+    Expect(Analog_GetMany(channels, values, NB_SAMPLED), "Analog_GetMany");
+    ExpectSampled(channels, values, NB_SAMPLED, "Analog_GetMany value of a moving input");
+
+    uint8_t channel = sample % ANALOG_NB_INPUTS;
+    Expect(Analog_Get(channel, values), "Analog_Get");
+    ExpectSampled(&channel, values, 1, "Analog_Get value of a moving input");
+  }
+
+  // DAC outputs
+  static const int16_t CODES[4] = {-32768, -1, 1234, 32767};
+  for (uint8_t dac = 0; dac < ANALOG_NB_OUTPUTS; dac++)
+    Expect(Analog_Put(dac, CODES[dac]), "Analog_Put");
+  for (uint8_t dac = 0; dac < ANALOG_NB_OUTPUTS; dac++)
+    Expect(DACOutput(dac) == CODES[dac], "Analog_Put code");
+
+  // DAC words with the PIT0 interrupt sampling before any frame, as it may land between the two frames of a word
+  uint32_t interrupts = GetStats().interrupts;
+  SetInterrupt([]()
+  {
+    static const uint8_t channels[NB_SAMPLED] = {0, 1, 2};
+    int16_t values[NB_SAMPLED];
+
+    Expect(Analog_GetMany(channels, values, NB_SAMPLED), "Analog_GetMany in the interrupt");
+    ExpectSampled(channels, values, NB_SAMPLED, "Analog_GetMany value in the interrupt");
+  });
+  for (uint32_t word = 0; word < 100; word++)
+  {
+    uint8_t dac = word % ANALOG_NB_OUTPUTS;
+    int16_t code = int16_t(word * 977 - 32768);
+
+    Idle(SAMPLE_PERIOD_NS / 5);
+    Expect(Analog_Put(dac, code), "Analog_Put with the interrupt");
+    Expect(DACOutput(dac) == code, "Analog_Put code with the interrupt");
+  }
+  SetInterrupt(nullptr);
+  Expect(GetStats().interrupts - interrupts >= 100, "the interrupt ran during the DAC words");
+
+  // Bad arguments
+  static const uint8_t BAD[2] = {0, ANALOG_NB_INPUTS};
+  int16_t values[ANALOG_NB_INPUTS];
+  Expect(!Analog_Get(ANALOG_NB_INPUTS, values), "Analog_Get rejects a bad channel");
+  Expect(!Analog_GetMany(BAD, values, 2), "Analog_GetMany rejects a bad channel");
+  Expect(!Analog_GetMany(BAD, values, 0), "Analog_GetMany rejects no channels");
+  Expect(!Analog_GetMany(BAD, values, ANALOG_NB_INPUTS + 1), "Analog_GetMany rejects too many channels");
+  Expect(!Analog_Put(ANALOG_NB_OUTPUTS, 0), "Analog_Put rejects a bad channel");
+
+  const Stats& stats = GetStats();
+  Expect(stats.violations == 0, "no conversion cut short");
+  Expect(stats.errors == 0, "no malformed frames");
+  std::printf("%u frames, %u conversions, %u DAC words, %u interrupts, %u violations, %u errors\n",
+              stats.frames, stats.conversions, stats.dacWords, stats.interrupts, stats.violations, stats.errors);
+  std::printf("%s\n", Failures ? "FAILED" : "PASSED");
+
+  return Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*! @brief Gets a value the way the previous library did: a frame with the command, then a frame of 0 to read it. */
+static void LegacyGet(uint8_t channel, int16_t* value)
+{
+  uint16_t command = 0x8400 | ((channel >> 1) << 12) | ((channel & 0x1) ? 0x4000 : 0);
+
+  SPI_SelectSlaveDevice(7);
+  SPI_Exchange(command, nullptr, 0, false);
+  SPI_Exchange(0, (uint16_t*) value, 0, false);
+}
+
+struct Result
+{
+  double busyNs;                                      // Bus time, summed over the samples
+  double worstBusyNs;
+  double worstSpreadNs;                               // Between the first and last channel sampled
+  uint32_t frames;
+  uint32_t violations;
+  int mismatches;
+};
+
+static Result Bench(uint32_t nbSamples, bool burst)
+{
+  static const uint8_t channels[NB_SAMPLED] = {0, 1, 2};
+  Result result = {};
+
+  Reset(MODULE_CLOCK);
+  Analog_Init(MODULE_CLOCK);
+  for (uint8_t channel = 0; channel < NB_SAMPLED; channel++)
+    SetInput(channel, [channel](double ns) { return Sine(channel, ns); });
+
+  uint32_t frames = GetStats().frames;
+  for (uint32_t sample = 0; sample < nbSamples; sample++)
+  {
+    int16_t values[NB_SAMPLED];
+
+    Idle(SAMPLE_PERIOD_NS - std::fmod(Now(), SAMPLE_PERIOD_NS));
+    double start = Now();
+
+    if (burst)
+      Analog_GetMany(channels, values, NB_SAMPLED);
+    else
+      for (uint8_t i = 0; i < NB_SAMPLED; i++)
+        LegacyGet(channels[i], &values[i]);
+
+    double busy = Now() - start;
+    result.busyNs += busy;
+    result.worstBusyNs = std::max(result.worstBusyNs, busy);
+    result.worstSpreadNs = std::max(result.worstSpreadNs, SampledAt(channels[NB_SAMPLED - 1]) - SampledAt(channels[0]));
+    for (uint8_t i = 0; i < NB_SAMPLED; i++)
+      if (std::abs(values[i] - ADCCode(Sine(channels[i], SampledAt(channels[i])))) > 1)
+        result.mismatches++;
+  }
+  result.frames = GetStats().frames - frames;
+  result.violations = GetStats().violations;
+
+  return result;
+}
+
+static void Report(const char* name, const Result& result, uint32_t nbSamples)
+{
+  std::printf("%-14s %6.2f frames/sample  %7.2f us/sample (worst %7.2f)  spread %6.2f us  violations %u  mismatches %d\n",
+              name, double(result.frames) / nbSamples, result.busyNs / nbSamples / 1000.0, result.worstBusyNs / 1000.0,
+              result.worstSpreadNs / 1000.0, result.violations, result.mismatches);
+}
+
+static const double CORE_CYCLE_NS = 20.0;            // 50MHz core
+static const double BYTE_NS = 1e9 * 10 / 115200;      // A UART byte, start and stop bits included
+static const double COMMAND_PERIOD_NS = 10e6;       // On average, not locked to PIT0
+static const uint8_t COMMAND_NB_BYTES = 5;
+static const uint8_t REPLY_NB_BYTES = 10;
+static const double REPLY_DELAY_NS = 200e3;           // From the last byte in to the first byte out
+
+// Assumed costs, in core cycles
+static const double UART_ISR_CYCLES = 100;            // A byte in or out, interrupts masked
+static const double RX_BYTE_CYCLES = 300;             // RxThread, a byte in
+static const double TX_BYTE_CYCLES = 200;             // TxThread, a byte out
+static const double CRITICAL_PERIOD_CYCLES = 25000;   // Mean interval between other masked sections
+static const double CRITICAL_MIN_CYCLES = 20;
+static const double CRITICAL_MAX_CYCLES = 100;
+static const double ISR_ENTRY_CYCLES = 60;            // Into the PIT0 interrupt and its handler
+static const double SWITCH_CYCLES = 250;              // Signalling PIT0_Semaphore and switching to PIT0Thread
+static const double PROLOGUE_CYCLES = 200;            // TakeSample up to the burst, the jitter bin included
+static const double SLIDE_CYCLES = 80;                // Slide, a channel
+static const double WINDOW_CYCLES = 1000;             // A channel thread, a window, on top of
+static const double WINDOW_SAMPLE_CYCLES = 60;        // FrequencyTracking, a sample
+
+static const double JITTER_LIMITS_NS[] = {1000, 2000, 5000, 10000, 20000, 50000, 100000};
+static const uint8_t JITTER_NB_BINS = sizeof(JITTER_LIMITS_NS) / sizeof(JITTER_LIMITS_NS[0]) + 1;
+
+typedef std::vector<std::pair<double, double>> Spans;
+
+/*! @brief What the rest of the firmware does around the samples, the same for both paths. */
+struct Load
+{
+  Spans masked;                                       // Interrupts masked, from and to, in ns, not overlapping
+  Spans released;                                     // Work released to RxThread or TxThread, when and how long, in ns
+};
+
+static Load MakeLoad(double horizonNs)
+{
+  std::mt19937 random(1);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  Load load;
+  Spans masked;
+
+  for (double command = COMMAND_PERIOD_NS * uniform(random); command < horizonNs; command += COMMAND_PERIOD_NS * (0.5 + uniform(random)))
+  {
+    double reply = command + (COMMAND_NB_BYTES - 1) * BYTE_NS + REPLY_DELAY_NS;
+
+    for (uint8_t i = 0; i < COMMAND_NB_BYTES + REPLY_NB_BYTES; i++)
+    {
+      bool in = (i < COMMAND_NB_BYTES);
+      double byte = in ? command + i * BYTE_NS : reply + (i - COMMAND_NB_BYTES) * BYTE_NS;
+
+      masked.push_back({byte, byte + UART_ISR_CYCLES * CORE_CYCLE_NS});
+      load.released.push_back({byte + UART_ISR_CYCLES * CORE_CYCLE_NS, (in ? RX_BYTE_CYCLES : TX_BYTE_CYCLES) * CORE_CYCLE_NS});
+    }
+  }
+  std::exponential_distribution<double> interval(1.0 / (CRITICAL_PERIOD_CYCLES * CORE_CYCLE_NS));
+  for (double section = interval(random); section < horizonNs; section += interval(random))
+    masked.push_back({section, section + (CRITICAL_MIN_CYCLES + (CRITICAL_MAX_CYCLES - CRITICAL_MIN_CYCLES) * uniform(random)) * CORE_CYCLE_NS});
+
+  std::sort(masked.begin(), masked.end());
+  std::sort(load.released.begin(), load.released.end());
+  for (const auto& span : masked)
+    if (!load.masked.empty() && span.first <= load.masked.back().second)
+      load.masked.back().second = std::max(load.masked.back().second, span.second);
+    else
+      load.masked.push_back(span);
+
+  return load;
+}
+
+/*! @brief The first instant from ns on that interrupts are not masked. */
+static double Unmasked(const Spans& masked, double ns)
+{
+  auto after = std::upper_bound(masked.begin(), masked.end(), std::make_pair(ns, HUGE_VAL));
+
+  if (after != masked.begin() && std::prev(after)->second > ns)
+    return std::prev(after)->second;
+  return ns;
+}
+
+struct Jitter
+{
+  uint32_t bins[JITTER_NB_BINS];
+  double peakNs;
+};
+
+/*! @brief Takes nbSamples samples at nbPerCycle samples a cycle, in the PIT0 interrupt or in PIT0Thread. */
+static Jitter ModelJitter(const Load& load, uint32_t nbSamples, uint16_t nbPerCycle, bool inISR)
+{
+  static const uint8_t channels[NB_SAMPLED] = {0, 1, 2};
+  double period = 20e6 / nbPerCycle;
+  Jitter jitter = {};
+  double lastOffset = 0, end = 0, threadsFree = 0;
+  size_t released = 0;
+  std::deque<std::pair<double, double>> windows;      // Work released to the channel threads
+
+  Reset(MODULE_CLOCK);
+  Analog_Init(MODULE_CLOCK);
+  for (uint8_t channel = 0; channel < NB_SAMPLED; channel++)
+    SetInput(channel, [channel](double ns) { return Sine(channel, ns); });
+  double first = std::ceil(Now() / period) * period;
+
+  // The threads above PIT0Thread run every piece of work released up to when they are done
+  auto Run = [&](double until)
+  {
+    for (;;)
+    {
+      bool fromLoad = released < load.released.size() && (windows.empty() || load.released[released].first <= windows.front().first);
+      const std::pair<double, double>* work = fromLoad ? &load.released[released] : (windows.empty() ? nullptr : &windows.front());
+
+      if (!work || work->first > std::max(until, threadsFree))
+        return;
+      threadsFree = std::max(threadsFree, work->first) + work->second;
+      if (fromLoad)
+        released++;
+      else
+        windows.pop_front();
+    }
+  };
+
+  for (uint32_t sample = 0; sample < nbSamples; sample++)
+  {
+    int16_t values[NB_SAMPLED];
+    double expiry = first + sample * period;
+    double start = Unmasked(load.masked, expiry) + ISR_ENTRY_CYCLES * CORE_CYCLE_NS;
+
+    if (inISR)
+      start = std::max(start, end);
+    else
+    {
+      start = std::max(start + SWITCH_CYCLES * CORE_CYCLE_NS, end);
+      Run(start);
+      start = std::max(start, threadsFree);
+    }
+    start += PROLOGUE_CYCLES * CORE_CYCLE_NS;
+
+    Idle(start - Now());
+    Analog_GetMany(channels, values, NB_SAMPLED);
+    end = Now() + NB_SAMPLED * SLIDE_CYCLES * CORE_CYCLE_NS;
+    if ((sample + 1) % nbPerCycle == 0)
+      windows.push_back({end, NB_SAMPLED * (WINDOW_CYCLES + WINDOW_SAMPLE_CYCLES * nbPerCycle) * CORE_CYCLE_NS});
+
+    // As TakeSample does, the change in the offset from the PIT0 grid
+    double offset = SampledAt(0) - expiry;
+    if (sample)
+    {
+      double change = std::fabs(offset - lastOffset);
+      uint8_t bin = 0;
+
+      while (bin < JITTER_NB_BINS - 1 && change >= JITTER_LIMITS_NS[bin])
+        bin++;
+      jitter.bins[bin]++;
+      jitter.peakNs = std::max(jitter.peakNs, change);
+    }
+    lastOffset = offset;
+  }
+
+  return jitter;
+}
+
+static void ReportJitter(const char* name, const Jitter& jitter)
+{
+  std::printf("%-12s", name);
+  for (uint8_t bin = 0; bin < JITTER_NB_BINS; bin++)
+    std::printf(" %7u", jitter.bins[bin]);
+  std::printf(" %9.2f\n", jitter.peakNs / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc >= 2 && !std::strcmp(argv[1], "check"))
+    return Check();
+
+  if (argc >= 3 && !std::strcmp(argv[1], "bench"))
+  {
+    uint32_t nbSamples = std::strtoul(argv[2], nullptr, 0);
+    Result legacy = Bench(nbSamples, false), burst = Bench(nbSamples, true);
+
+    Report("Analog_Get x3", legacy, nbSamples);
+    Report("Analog_GetMany", burst, nbSamples);
+    return (legacy.mismatches || burst.mismatches || legacy.violations || burst.violations) ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  if (argc >= 3 && !std::strcmp(argv[1], "jitter"))
+  {
+    static const uint16_t RATES[] = {16, 128};
+    uint32_t nbSamples = std::strtoul(argv[2], nullptr, 0);
+
+    for (uint16_t nbPerCycle : RATES)
+    {
+      Load load = MakeLoad(nbSamples * 20e6 / nbPerCycle + 1e6);
+
+      std::printf("%u samples a cycle, %u samples, change in the sampling instant:\n", nbPerCycle, nbSamples);
+      std::printf("%-12s %7s %7s %7s %7s %7s %7s %7s %7s %9s\n", "", "<1us", "<2us", "<5us", "<10us", "<20us", "<50us", "<100us",
+                  ">=100us", "peak (us)");
+      ReportJitter("PIT0Thread", ModelJitter(load, nbSamples, nbPerCycle, false));
+      ReportJitter("PIT0 ISR", ModelJitter(load, nbSamples, nbPerCycle, true));
+    }
+    return (GetStats().violations || GetStats().errors) ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  std::fprintf(stderr, "usage: %s check | bench <samples> | jitter <samples>\n", argv[0]);
+  return EXIT_FAILURE;
+}
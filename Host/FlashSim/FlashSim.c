@@ -0,0 +1,252 @@
+/*! @file
+ *
+ *  @brief File backed emulator of the FTFE flash controller, to run Flash.c on a Linux host.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-01
+ */
+
+#define _GNU_SOURCE
+
+#include "FlashSim.h"
+#include "MK70F12.h"
+#include "OS.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FLASH_CMD_READ_1S_SECTION 0x01
+#define FLASH_CMD_ERASE_SECTOR   0x09
+#define FLASH_CMD_PROGRAM_PHRASE 0x07
+#define PHRASE_SIZE 8
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE MAP_FIXED
+#endif
+
+TFlashSimRegisters FlashSim_FTFE = {FTFE_FSTAT_CCIF_MASK, 0, {0}};
+volatile uint32_t FlashSim_Ignored;
+
+static uint8_t *Flash;                      //Writable mapping of the image, the controller's view
+static TFlashSimStats Stats;
+static uint32_t FailCountdown;              //Commands left before the power fails, 0 if disabled
+static bool PowerLost;
+static uint32_t TimeUs;                     //Modelled time, for OS_TimeGet
+
+void FTFE_ISR(void);
+
+//Private functions
+
+/*! @brief Programs a phrase, or part of it if the power fails.
+ *
+ *  @param offset The offset of the phrase in the block.
+ *  @param data The phrase, by address.
+ *  @param nbBytes The number of bytes that get programmed.
+ */
+static void Program(const uint32_t offset, const uint8_t data[], const uint8_t nbBytes)
+{
+  bool overprogram = false;
+
+  for (uint8_t i = 0; i < nbBytes; i++)
+  {
+    overprogram |= (data[i] & ~Flash[offset + i]) != 0;
+    Flash[offset + i] &= data[i];           //Programming only clears bits
+  }
+
+  if (overprogram)
+    Stats.overprograms++;
+}
+
+/*! @brief Runs the command loaded in FCCOB, as the controller would once CCIF is cleared.
+ *
+ *  @return uint8_t - The error flags of FSTAT.
+ */
+static uint8_t RunCommand()
+{
+  uint32_t address = ((uint32_t) FlashSim_FTFE.FCCOB[1] << 16) | ((uint32_t) FlashSim_FTFE.FCCOB[2] << 8) | FlashSim_FTFE.FCCOB[3];
+
+  if (PowerLost)
+    return FTFE_FSTAT_MGSTAT0_MASK;
+
+  if (address < FLASHSIM_START || address >= FLASHSIM_START + FLASHSIM_SIZE)
+    return FTFE_FSTAT_ACCERR_MASK;
+
+  uint32_t offset = address - FLASHSIM_START;
+  bool fail = (FailCountdown != 0 && --FailCountdown == 0);
+  uint8_t status = 0;
+
+  switch (FlashSim_FTFE.FCCOB[0])
+  {
+    case FLASH_CMD_READ_1S_SECTION:
+    {
+      uint32_t nbBytes = (((uint32_t) FlashSim_FTFE.FCCOB[4] << 8) | FlashSim_FTFE.FCCOB[5]) * PHRASE_SIZE;
+
+      if (offset % PHRASE_SIZE != 0 || nbBytes == 0 || offset + nbBytes > FLASHSIM_SIZE)
+        return FTFE_FSTAT_ACCERR_MASK;
+
+      Stats.verifies++;
+      Stats.busyUs += FLASHSIM_VERIFY_US;
+      TimeUs += FLASHSIM_VERIFY_US;
+
+      for (uint32_t i = 0; i < nbBytes && !status; i++)
+        if (Flash[offset + i] != 0xFF)
+          status = FTFE_FSTAT_MGSTAT0_MASK;  //Some bit reads as 0
+      break;
+    }
+
+    case FLASH_CMD_ERASE_SECTOR:
+    {
+      offset &= ~(FLASHSIM_SECTOR_SIZE - 1);
+      Stats.erases++;
+      Stats.sectorErases[offset / FLASHSIM_SECTOR_SIZE]++;
+      Stats.busyUs += FLASHSIM_ERASE_US;
+      TimeUs += FLASHSIM_ERASE_US;
+
+      //A cut erase leaves the sector part erased, the rest untouched
+      memset(&Flash[offset], 0xFF, fail ? (rand() % FLASHSIM_SECTOR_SIZE) & ~(PHRASE_SIZE - 1) : FLASHSIM_SECTOR_SIZE);
+      break;
+    }
+
+    case FLASH_CMD_PROGRAM_PHRASE:
+    {
+      if (offset % PHRASE_SIZE != 0)
+        return FTFE_FSTAT_ACCERR_MASK;
+
+      //FCCOB4-7 hold the first longword, FCCOB8-B the second, most significant byte first
+      const uint8_t data[PHRASE_SIZE] =
+      {
+        FlashSim_FTFE.FCCOB[7], FlashSim_FTFE.FCCOB[6], FlashSim_FTFE.FCCOB[5], FlashSim_FTFE.FCCOB[4],
+        FlashSim_FTFE.FCCOB[11], FlashSim_FTFE.FCCOB[10], FlashSim_FTFE.FCCOB[9], FlashSim_FTFE.FCCOB[8]
+      };
+
+      Stats.programs++;
+      Stats.busyUs += FLASHSIM_PROGRAM_US;
+      TimeUs += FLASHSIM_PROGRAM_US;
+
+      //A cut program leaves only some of the bytes programmed
+      Program(offset, data, fail ? rand() % PHRASE_SIZE : PHRASE_SIZE);
+      break;
+    }
+
+    default:
+      return FTFE_FSTAT_ACCERR_MASK;
+  }
+
+  if (fail)
+  {
+    PowerLost = true;
+    return FTFE_FSTAT_MGSTAT0_MASK;
+  }
+
+  return status;
+}
+
+//Public functions
+
+bool FlashSim_Open(const char* path)
+{
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  struct stat status;
+
+  if (fd < 0 || fstat(fd, &status) < 0)
+    return false;
+
+  if (status.st_size != (off_t) FLASHSIM_SIZE)
+  {
+    static uint8_t erased[FLASHSIM_SECTOR_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+
+    if (ftruncate(fd, 0) < 0)
+      return false;
+    for (uint32_t i = 0; i < FLASHSIM_NB_SECTORS; i++)
+      if (write(fd, erased, sizeof(erased)) != (ssize_t) sizeof(erased))
+        return false;
+  }
+
+  void *block = mmap((void *) FLASHSIM_START, FLASHSIM_SIZE, PROT_READ, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+  if (block != (void *) FLASHSIM_START)
+  {
+    fprintf(stderr, "cannot map the flash image at 0x%08lX\n", FLASHSIM_START);
+    return false;
+  }
+
+  Flash = mmap(NULL, FLASHSIM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  return Flash != MAP_FAILED;
+}
+
+void FlashSim_FailAfter(const uint32_t nbCommands)
+{
+  FailCountdown = nbCommands;
+}
+
+bool FlashSim_PowerLost(void)
+{
+  return PowerLost;
+}
+
+const TFlashSimStats* FlashSim_Stats(void)
+{
+  return &Stats;
+}
+
+//RTOS stand-in
+
+OS_ECB* OS_SemaphoreCreate(const uint32_t value)
+{
+  OS_ECB *semaphore = malloc(sizeof(OS_ECB));
+
+  semaphore->count = value;
+  return semaphore;
+}
+
+OS_ERROR OS_SemaphoreSignal(OS_ECB* const pEvent)
+{
+  pEvent->count++;
+  return OS_NO_ERROR;
+}
+
+OS_ERROR OS_SemaphoreWait(OS_ECB* const pEvent, const uint32_t timeout)
+{
+  (void) timeout;
+
+  if (pEvent->count == 0)
+  {
+    //Nothing else can signal it: this is Flash.c waiting for the command it just launched
+    FlashSim_FTFE.FSTAT = FTFE_FSTAT_CCIF_MASK | RunCommand();
+    if (FlashSim_FTFE.FSTAT & FTFE_FSTAT_ACCERR_MASK)
+      Stats.errors++;
+    if (FlashSim_FTFE.FCNFG & FTFE_FCNFG_CCIE_MASK)
+    {
+      Stats.interrupts++;
+      FTFE_ISR();
+      if (FlashSim_FTFE.FCNFG & FTFE_FCNFG_CCIE_MASK)
+        Stats.storms++;                     //CCIF stays set while idle, so the ISR would run again at once
+    }
+  }
+
+  if (pEvent->count == 0)
+  {
+    fprintf(stderr, "deadlock: waiting on a semaphore nothing can signal\n");
+    abort();
+  }
+
+  pEvent->count--;
+  return OS_NO_ERROR;
+}
+
+void OS_TimeDelay(const uint32_t ticks)
+{
+  TimeUs += ticks * 1000;
+}
+
+uint32_t OS_TimeGet(void)
+{
+  return TimeUs / 1000;
+}
@@ -0,0 +1,79 @@
+/*! @file
+ *
+ *  @brief File backed emulator of the FTFE flash controller, to run Flash.c on a Linux host.
+ *
+ *  The upper 512 KB flash block (0x00080000 to 0x000FFFFF) is a file mapped read only at its
+ *  real address, so Flash.c and EventLog.c read it exactly as on the tower, and any stray store
+ *  to it faults. Read 1s Section, Erase Flash Sector and Program Phrase are run from the FCCOB registers with the
+ *  FTFE rules: a sector erases to 0xFF, programming can only clear bits, commands are phrase or
+ *  sector aligned. A command only completes through FTFE_ISR, and only if Flash.c enabled the
+ *  command complete interrupt, as on the tower. Every command is counted and charged its typical
+ *  duration, and a power failure can be injected part way through any command.
+ *
+ *  Build (Linux, not part of the firmware build):
+ *    gcc -std=c99 -O2 -Wall -Wextra -Wno-attributes -Dinterrupt=used -I. -I../../Sources -o flash_sim \
+ *        main.c FlashSim.c ../../Sources/Flash.c ../../Sources/CRC.c
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-01
+ */
+
+#ifndef FLASHSIM_H
+#define FLASHSIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FLASHSIM_START       0x00080000LU   //Start of the emulated flash block
+#define FLASHSIM_SIZE        0x00080000LU   //Size of the emulated flash block
+#define FLASHSIM_SECTOR_SIZE 0x1000LU
+#define FLASHSIM_NB_SECTORS  (FLASHSIM_SIZE / FLASHSIM_SECTOR_SIZE)
+
+#define FLASHSIM_ERASE_US    14000          //Typical Erase Flash Sector time
+#define FLASHSIM_PROGRAM_US  90             //Typical Program Phrase time
+#define FLASHSIM_VERIFY_US   60             //Typical Read 1s Section time for a sector
+
+/*!
+ * @struct TFlashSimStats
+ * @brief What the emulated controller has done since FlashSim_Open.
+ */
+typedef struct
+{
+  uint32_t erases;                          /*!< Erase Flash Sector commands */
+  uint32_t programs;                        /*!< Program Phrase commands */
+  uint32_t verifies;                        /*!< Read 1s Section commands */
+  uint32_t overprograms;                    /*!< Program Phrase commands that tried to set a programmed bit back to 1 */
+  uint32_t errors;                          /*!< Commands that ended with ACCERR */
+  uint32_t interrupts;                      /*!< Commands completed by FTFE_ISR */
+  uint32_t storms;                          /*!< Returns from FTFE_ISR with CCIE still set, which would interrupt again at once */
+  uint64_t busyUs;                          /*!< Modelled time the controller was busy */
+  uint32_t sectorErases[FLASHSIM_NB_SECTORS]; /*!< Erases of every sector */
+} TFlashSimStats;
+
+/*! @brief Maps the image file at the address of the flash block, creating it erased if needed.
+ *
+ *  @param path The image file.
+ *  @return bool - TRUE if the image is mapped.
+ */
+bool FlashSim_Open(const char* path);
+
+/*! @brief Injects a power failure.
+ *
+ *  @param nbCommands The command that is cut part way through, 1 being the next one. 0 disables the injection.
+ *  @note After the failure every command fails without touching the flash, until the process exits.
+ */
+void FlashSim_FailAfter(const uint32_t nbCommands);
+
+/*! @brief Tells whether the injected power failure has happened.
+ *
+ *  @return bool - TRUE if the power is off.
+ */
+bool FlashSim_PowerLost(void);
+
+/*! @brief Returns the counters of the emulated controller.
+ *
+ *  @return const TFlashSimStats * - The counters.
+ */
+const TFlashSimStats* FlashSim_Stats(void);
+
+#endif
@@ -0,0 +1,57 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the MK70F12 register definitions used by Flash.c.
+ *
+ *  The FTFE registers are plain bytes of the flash emulator, which runs the command loaded in
+ *  FCCOB when Flash.c blocks on its command complete semaphore. Only what Flash.c uses is defined.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-01
+ */
+
+#ifndef MK70F12_H
+#define MK70F12_H
+
+#include <stdint.h>
+
+/*!
+ * @struct TFlashSimRegisters
+ * @brief The FTFE registers of the emulator.
+ */
+typedef struct
+{
+  volatile uint8_t FSTAT;
+  volatile uint8_t FCNFG;
+  volatile uint8_t FCCOB[12];       /*!< FCCOB0 to FCCOBB */
+} TFlashSimRegisters;
+
+extern TFlashSimRegisters FlashSim_FTFE;
+extern volatile uint32_t FlashSim_Ignored;  /*!< Sink for the clock gating and NVIC registers */
+
+#define FTFE_FSTAT   FlashSim_FTFE.FSTAT
+#define FTFE_FCNFG   FlashSim_FTFE.FCNFG
+#define FTFE_FCCOB0  FlashSim_FTFE.FCCOB[0x0]
+#define FTFE_FCCOB1  FlashSim_FTFE.FCCOB[0x1]
+#define FTFE_FCCOB2  FlashSim_FTFE.FCCOB[0x2]
+#define FTFE_FCCOB3  FlashSim_FTFE.FCCOB[0x3]
+#define FTFE_FCCOB4  FlashSim_FTFE.FCCOB[0x4]
+#define FTFE_FCCOB5  FlashSim_FTFE.FCCOB[0x5]
+#define FTFE_FCCOB6  FlashSim_FTFE.FCCOB[0x6]
+#define FTFE_FCCOB7  FlashSim_FTFE.FCCOB[0x7]
+#define FTFE_FCCOB8  FlashSim_FTFE.FCCOB[0x8]
+#define FTFE_FCCOB9  FlashSim_FTFE.FCCOB[0x9]
+#define FTFE_FCCOBA  FlashSim_FTFE.FCCOB[0xA]
+#define FTFE_FCCOBB  FlashSim_FTFE.FCCOB[0xB]
+
+#define FTFE_FSTAT_MGSTAT0_MASK  0x1u
+#define FTFE_FSTAT_FPVIOL_MASK   0x10u
+#define FTFE_FSTAT_ACCERR_MASK   0x20u
+#define FTFE_FSTAT_CCIF_MASK     0x80u
+#define FTFE_FCNFG_CCIE_MASK     0x80u
+
+#define SIM_SCGC3                FlashSim_Ignored
+#define SIM_SCGC3_NFC_MASK       0x100u
+#define NVICICPR0                FlashSim_Ignored
+#define NVICISER0                FlashSim_Ignored
+
+#endif
@@ -0,0 +1,40 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the RTOS calls made by Flash.c.
+ *
+ *  Single threaded: waiting on a semaphore with a count of 0 can only mean waiting for the flash
+ *  controller, so it runs the pending flash command, whose completion interrupt signals it.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-01
+ */
+
+#ifndef OS_H
+#define OS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum
+{
+  OS_NO_ERROR,
+  OS_TIMEOUT
+} OS_ERROR;
+
+typedef struct ecb
+{
+  uint32_t count;
+} OS_ECB;
+
+OS_ECB* OS_SemaphoreCreate(const uint32_t value);
+OS_ERROR OS_SemaphoreSignal(OS_ECB* const pEvent);
+OS_ERROR OS_SemaphoreWait(OS_ECB* const pEvent, const uint32_t timeout);
+void OS_TimeDelay(const uint32_t ticks);
+uint32_t OS_TimeGet(void);
+
+#define OS_ISREnter()
+#define OS_ISRExit()
+#define OS_DisableInterrupts()
+#define OS_EnableInterrupts()
+
+#endif
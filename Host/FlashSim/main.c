@@ -0,0 +1,393 @@
+/*! @file
+ *
+ *  @brief Checks, benchmarks and power-fail tests of the non-volatile store (Sources/Flash.c) on the flash emulator.
+ *
+ *  flash_sim image check
+ *    Boots the store on a blank image and increments a counter until the log has been compacted a
+ *    few times, flushing each write as the commit thread would. Every flash command must complete
+ *    through FTFE_ISR, leave the interrupt masked, and obey the FTFE rules. The counter is then read
+ *    back by a second boot, in a new process.
+ *  flash_sim image bench <writes>
+ *    Boots the store, then increments a counter <writes> times, flushing each write as the commit
+ *    thread would, and reports the flash commands, their modelled time and the wear of every sector.
+ *  flash_sim image powerfail <boots>
+ *    Boots the store <boots> times, each time in a new process that increments a counter until the
+ *    power is cut part way through a random flash command. The counter and a copy of it are written
+ *    in one transaction. Every boot checks that the counter holds the last value whose commit
+ *    completed, or the one being committed when the power was cut, and that the copy matches it.
+ *  flash_sim image provision <variables>
+ *    Boots the store from a blank image and gives <variables> byte variables their defaults, as the
+ *    tower does before its first packet, and reports the flash time from boot to the first packet.
+ *    Done twice, each time in a new process: flushing every default on its own, then committing all
+ *    of them in one transaction.
+ *  flash_sim image migrate <value>
+ *    Creates an image holding the single phrase of variables older firmware stored at the start of the
+ *    block, with 3 byte variables from <value> at offsets 1, 3 and 5, then boots the store twice and checks
+ *    that the variables come back packed at offsets 0, 1 and 2, migrated then restored from the log.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-01
+ */
+
+#include "FlashSim.h"
+#include "Flash.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define COUNTER_ID 0x01   //Record of the counter in the store
+#define PAIR_ID    0x02   //Record of the counter and its copy, written in transactions
+#define NB_WRITES  5000   //Enough writes to compact the log over every NV sector
+
+/*! @brief Boots the store and finds the counter.
+ *
+ *  @return volatile uint32_t * - The counter, or NULL if the store could not be booted.
+ */
+static volatile uint32_t* Boot(const char* image)
+{
+  volatile uint32_t *counter;
+
+  if (!FlashSim_Open(image) || !Flash_Init())
+    return NULL;
+  if (!Flash_AllocateRecord(COUNTER_ID, sizeof(*counter), (volatile void**) &counter))
+    return NULL;
+  if (*counter == 0xFFFFFFFF && !Flash_Write32(counter, 0))
+    return NULL;
+
+  return counter;
+}
+
+/*! @brief First boot of the check, in a child process.
+ *
+ *  @return int - The exit status, 0 if every command completed as on the tower.
+ */
+static int CheckWrites(const char* image)
+{
+  volatile uint32_t *counter = Boot(image);
+  if (!counter)
+  {
+    fprintf(stderr, "boot failed\n");
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < NB_WRITES; i++)
+    if (!Flash_Write32(counter, *counter + 1) || !Flash_Flush())
+    {
+      fprintf(stderr, "write %u failed\n", i);
+      return 1;
+    }
+
+  const TFlashSimStats *stats = FlashSim_Stats();
+  uint32_t commands = stats->erases + stats->verifies + stats->programs;
+
+  printf("writes %u  counter %u\n", NB_WRITES, *counter);
+  printf("erases %u  verifies %u  programs %u  interrupts %u\n", stats->erases, stats->verifies, stats->programs, stats->interrupts);
+  printf("overprograms %u  errors %u  storms %u\n", stats->overprograms, stats->errors, stats->storms);
+
+  if (*counter != NB_WRITES || stats->erases == 0 || stats->interrupts != commands
+      || stats->overprograms || stats->errors || stats->storms)
+    return 1;
+
+  return 0;
+}
+
+static int Check(const char* image)
+{
+  unlink(image);
+
+  pid_t child = fork();
+  if (child == 0)
+    exit(CheckWrites(image));
+
+  int status;
+  if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+    printf("failed\n");
+    return 1;
+  }
+
+  volatile uint32_t *counter = Boot(image);
+  if (!counter || *counter != NB_WRITES)
+  {
+    printf("reboot read %u, expected %u\nfailed\n", counter ? *counter : 0, NB_WRITES);
+    return 1;
+  }
+
+  printf("reboot counter %u\npassed\n", *counter);
+  return 0;
+}
+
+static int Bench(const char* image, const uint32_t nbWrites)
+{
+  volatile uint32_t *counter = Boot(image);
+  if (!counter)
+    return 1;
+
+  static const char* const boots[] = {"blank", "restored", "migrated"};
+  printf("boot %s\n", boots[Flash_BootState()]);
+
+  TFlashSimStats before = *FlashSim_Stats();
+
+  for (uint32_t i = 0; i < nbWrites; i++)
+    if (!Flash_Write32(counter, *counter + 1) || !Flash_Flush())
+    {
+      fprintf(stderr, "write %u failed\n", i);
+      return 1;
+    }
+
+  const TFlashSimStats *stats = FlashSim_Stats();
+  uint32_t erases = stats->erases - before.erases;
+  uint32_t programs = stats->programs - before.programs;
+  uint64_t busyUs = stats->busyUs - before.busyUs;
+
+  printf("writes %u  counter %u\n", nbWrites, *counter);
+  printf("erases %u  programs %u  overprograms %u  errors %u\n", erases, programs, stats->overprograms, stats->errors);
+  printf("modelled busy %.1f ms, %.1f us per write\n", busyUs / 1000.0, nbWrites ? (double) busyUs / nbWrites : 0.0);
+  printf("erases per NV sector:");
+  for (uint32_t sector = 0; sector < FLASH_NB_SECTORS; sector++)
+    printf(" %u", stats->sectorErases[sector]);
+  printf("\n");
+
+  return 0;
+}
+
+/*! @brief One provisioning of the defaults, in a child process.
+ *
+ *  @param transaction TRUE to commit the defaults in one transaction, FALSE to flush each one on its own.
+ *  @return int - The exit status, 0 if every variable was allocated and written.
+ */
+static int ProvisionBoot(const char* image, const uint32_t nbVariables, const bool transaction)
+{
+  if (unlink(image) < 0 && errno != ENOENT)
+    return 1;
+  if (!FlashSim_Open(image) || !Flash_Init())
+  {
+    fprintf(stderr, "boot failed\n");
+    return 1;
+  }
+
+  TFlashSimStats boot = *FlashSim_Stats();
+  bool success = true;
+
+  if (transaction)
+    Flash_BeginTransaction();
+  for (uint32_t i = 0; i < nbVariables && success; i++)
+  {
+    volatile uint8_t *variable;
+    if (!Flash_AllocateVar((volatile void**) &variable, sizeof(*variable)))
+    {
+      fprintf(stderr, "variable %u of %u: no space left in the %u bytes of variables\n", i, nbVariables, FLASH_VARIABLES_SIZE);
+      success = false;
+    }
+    else if (!Flash_Write8(variable, i == 0) || (!transaction && !Flash_Flush()))
+    {
+      fprintf(stderr, "variable %u of %u: write failed\n", i, nbVariables);
+      success = false;
+    }
+  }
+  if (transaction && !Flash_CommitTransaction())  //Closed whatever happened, as the tower would
+  {
+    fprintf(stderr, "commit of %u variables failed\n", nbVariables);
+    success = false;
+  }
+  if (!success)
+    return 1;
+
+  const TFlashSimStats *stats = FlashSim_Stats();
+
+  if (!transaction)
+    printf("boot  erases %u  verifies %u  programs %u  modelled %.2f ms\n",
+           boot.erases, boot.verifies, boot.programs, boot.busyUs / 1000.0);
+  printf("%u variables, %-16s erases %u  programs %u  modelled %.2f ms, %.2f ms from boot to first packet\n",
+         nbVariables, transaction ? "one transaction" : "flushed each", stats->erases - boot.erases,
+         stats->programs - boot.programs, (stats->busyUs - boot.busyUs) / 1000.0, stats->busyUs / 1000.0);
+  return 0;
+}
+
+static int Provision(const char* image, const uint32_t nbVariables)
+{
+  for (uint8_t transaction = 0; transaction < 2; transaction++)
+  {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0)
+      exit(ProvisionBoot(image, nbVariables, transaction));
+
+    int status;
+    if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+static int Migrate(const char* image, const uint32_t value)
+{
+  uint8_t block[FLASH_SECTOR_SIZE];
+  memset(block, 0xFF, sizeof(block));
+  for (uint8_t i = 0; i < 3; i++)
+    block[1 + 2 * i] = (uint8_t) (value + i);    //Each variable after a free byte, as older firmware allocated them
+
+  FILE *file = fopen(image, "wb");
+  if (!file)
+    return 1;
+  for (uint32_t written = 0; written < FLASHSIM_SIZE; written += sizeof(block))
+  {
+    if (fwrite(block, 1, sizeof(block), file) != sizeof(block))
+      return 1;
+    memset(block, 0xFF, 8);
+  }
+  fclose(file);
+
+  volatile uint8_t *variables[3];
+
+  if (!FlashSim_Open(image) || !Flash_Init())
+    return 1;
+  for (uint8_t i = 0; i < 3; i++)
+    if (!Flash_AllocateVar((volatile void**) &variables[i], sizeof(*variables[i])))
+      return 1;
+
+  int nbBad = 0;
+  for (uint8_t boot = 0; boot < 2; boot++)
+  {
+    TFlashBoot expected = boot ? FLASH_BOOT_RESTORED : FLASH_BOOT_MIGRATED;
+    if (boot && !Flash_Init())
+      return 1;
+    if (Flash_BootState() != expected)
+    {
+      printf("boot %u: state %d, expected %d\n", boot, Flash_BootState(), expected);
+      nbBad++;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      uint8_t byte;
+      if (!Flash_ReadByte(i, &byte) || byte != (uint8_t) (value + i) || *variables[i] != byte)
+      {
+        printf("boot %u: variable %u reads %u at offset %u, expected %u\n", boot, i, *variables[i], i, (uint8_t) (value + i));
+        nbBad++;
+      }
+    }
+  }
+
+  printf("migrate  erases %u  programs %u  modelled %.2f ms  bad %d\n",
+         FlashSim_Stats()->erases, FlashSim_Stats()->programs, FlashSim_Stats()->busyUs / 1000.0, nbBad);
+  return nbBad ? 1 : 0;
+}
+
+/*! @brief One boot of the power-fail test, in a child process.
+ *
+ *  Reports the counter found at boot, or ~0 if its copy differs, then every value that was committed, on the pipe.
+ */
+static void PowerFailBoot(const char* image, const int pipe, const uint32_t failAfter)
+{
+  volatile uint32_t *pair;
+
+  FlashSim_FailAfter(failAfter);
+
+  if (!FlashSim_Open(image) || !Flash_Init() || FlashSim_PowerLost())
+    _exit(0);                                     //Cut while booting, nothing to report
+  if (!Flash_AllocateRecord(PAIR_ID, 2 * sizeof(*pair), (volatile void**) &pair) || FlashSim_PowerLost())
+    _exit(0);
+  if (pair[0] == 0xFFFFFFFF && pair[1] == 0xFFFFFFFF)
+  {
+    Flash_BeginTransaction();
+    bool written = Flash_Write32(&pair[0], 0) && Flash_Write32(&pair[1], 0);
+    if (!Flash_CommitTransaction() || !written)
+      _exit(0);
+  }
+
+  uint32_t value = (pair[0] == pair[1]) ? pair[0] : ~0U;
+  if (write(pipe, &value, sizeof(value)) != sizeof(value))
+    _exit(1);
+
+  for (;;)
+  {
+    value = pair[0] + 1;
+    Flash_BeginTransaction();
+    bool written = Flash_Write32(&pair[0], value) && Flash_Write32(&pair[1], value);
+    if (!Flash_CommitTransaction() || !written)
+      _exit(0);
+    if (write(pipe, &value, sizeof(value)) != sizeof(value))
+      _exit(1);
+  }
+}
+
+static int PowerFail(const char* image, const uint32_t nbBoots)
+{
+  uint32_t acked = 0;
+  bool known = false;
+  uint32_t nbBad = 0;
+
+  for (uint32_t boot = 0; boot < nbBoots; boot++)
+  {
+    int fds[2];
+    if (pipe(fds) < 0)
+      return 1;
+
+    uint32_t failAfter = 1 + rand() % 600;
+    pid_t child = fork();
+    if (child == 0)
+    {
+      close(fds[0]);
+      srand(boot);
+      PowerFailBoot(image, fds[1], failAfter);
+    }
+    close(fds[1]);
+
+    uint32_t value;
+    bool booted = false;
+    while (read(fds[0], &value, sizeof(value)) == sizeof(value))
+    {
+      if (!booted)
+      {
+        booted = true;
+        //The value being committed when the power was cut may or may not have made it
+        if (value == ~0U || (known && value != acked && value != acked + 1))
+        {
+          if (value == ~0U)
+            printf("boot %u: the copy differs from the counter, last committed %u\n", boot, acked);
+          else
+            printf("boot %u: counter %u, last committed %u\n", boot, value, acked);
+          nbBad++;
+        }
+      }
+      acked = value;
+      known = true;
+    }
+    close(fds[0]);
+    waitpid(child, NULL, 0);
+  }
+
+  printf("boots %u  counter %u  bad boots %u\n", nbBoots, acked, nbBad);
+  return nbBad ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc == 3 && strcmp(argv[2], "check") == 0)
+    return Check(argv[1]);
+
+  if (argc != 4)
+  {
+    fprintf(stderr, "usage: %s image check | image bench <writes> | image powerfail <boots> | image provision <variables> | image migrate <value>\n", argv[0]);
+    return 2;
+  }
+
+  uint32_t count = (uint32_t) strtoul(argv[3], NULL, 0);
+
+  if (strcmp(argv[2], "bench") == 0)
+    return Bench(argv[1], count);
+  if (strcmp(argv[2], "powerfail") == 0)
+    return PowerFail(argv[1], count);
+  if (strcmp(argv[2], "provision") == 0)
+    return Provision(argv[1], count);
+  if (strcmp(argv[2], "migrate") == 0)
+    return Migrate(argv[1], count);
+
+  fprintf(stderr, "unknown mode %s\n", argv[2]);
+  return 2;
+}
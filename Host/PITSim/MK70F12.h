@@ -0,0 +1,63 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the MK70F12 register definitions used by PIT.c.
+ *
+ *  The PIT, SIM and NVIC registers are plain words the harness can read back. Nothing counts down:
+ *  CVAL and TFLG hold whatever the harness stores. Only what PIT.c uses is defined.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-11
+ */
+
+#ifndef MK70F12_H
+#define MK70F12_H
+
+#include <stdint.h>
+
+/*!
+ * @struct TPITSimChannel
+ * @brief The registers of a PIT channel.
+ */
+typedef struct
+{
+  volatile uint32_t LDVAL;
+  volatile uint32_t CVAL;
+  volatile uint32_t TCTRL;
+  volatile uint32_t TFLG;
+} TPITSimChannel;
+
+extern TPITSimChannel PITSim_Channels[4];
+extern volatile uint32_t PITSim_MCR;
+extern volatile uint32_t PITSim_Ignored;    /*!< Sink for the clock gating and NVIC enable registers */
+extern volatile uint32_t PITSim_NVICICPR2;  /*!< The last word written to clear pending interrupts */
+
+#define PIT_MCR     PITSim_MCR
+#define PIT_LDVAL0  PITSim_Channels[0].LDVAL
+#define PIT_CVAL0   PITSim_Channels[0].CVAL
+#define PIT_TCTRL0  PITSim_Channels[0].TCTRL
+#define PIT_TFLG0   PITSim_Channels[0].TFLG
+#define PIT_LDVAL1  PITSim_Channels[1].LDVAL
+#define PIT_CVAL1   PITSim_Channels[1].CVAL
+#define PIT_TCTRL1  PITSim_Channels[1].TCTRL
+#define PIT_TFLG1   PITSim_Channels[1].TFLG
+#define PIT_LDVAL2  PITSim_Channels[2].LDVAL
+#define PIT_CVAL2   PITSim_Channels[2].CVAL
+#define PIT_TCTRL2  PITSim_Channels[2].TCTRL
+#define PIT_TFLG2   PITSim_Channels[2].TFLG
+#define PIT_LDVAL3  PITSim_Channels[3].LDVAL
+#define PIT_CVAL3   PITSim_Channels[3].CVAL
+#define PIT_TCTRL3  PITSim_Channels[3].TCTRL
+#define PIT_TFLG3   PITSim_Channels[3].TFLG
+
+#define PIT_MCR_MDIS_MASK   0x2u
+#define PIT_MCR_FRZ_MASK    0x1u
+#define PIT_TCTRL_TEN_MASK  0x1u
+#define PIT_TCTRL_TIE_MASK  0x2u
+#define PIT_TFLG_TIF_MASK   0x1u
+
+#define SIM_SCGC6           PITSim_Ignored
+#define SIM_SCGC6_PIT_MASK  0x800000u
+#define NVICICPR2           PITSim_NVICICPR2
+#define NVICISER2           PITSim_Ignored
+
+#endif
@@ -0,0 +1,35 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the RTOS calls made by PIT.c.
+ *
+ *  Single threaded, and no interrupt is ever raised, so the calls do nothing.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-11
+ */
+
+#ifndef OS_H
+#define OS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum
+{
+  OS_NO_ERROR,
+  OS_TIMEOUT
+} OS_ERROR;
+
+typedef struct ecb
+{
+  uint32_t count;
+} OS_ECB;
+
+OS_ERROR OS_SemaphoreSignal(OS_ECB* const pEvent);
+
+#define OS_ISREnter()
+#define OS_ISRExit()
+#define OS_DisableInterrupts()
+#define OS_EnableInterrupts()
+
+#endif
@@ -0,0 +1,233 @@
+/*! @file
+ *
+ *  @brief Checks of the PIT period conversion (Sources/PIT.c) over a table of bus clocks.
+ *
+ *  Build (Linux, not part of the firmware build):
+ *    gcc -std=c99 -O2 -Wno-attributes -Dinterrupt=used -I. -I../../Sources -o pit_sim main.c ../../Sources/PIT.c
+ *
+ *  pit_sim check
+ *    For every bus clock of CLOCKS, sets PIT channel 0 with PIT_Set to the sample periods the tower
+ *    asks for, every samples per cycle at mains frequencies around 50Hz and 60Hz, and to random
+ *    periods from 1ns to past what LDVAL holds. Checks that the clocks loaded are the requested
+ *    period rounded to the nearest clock, clamped to 1 to UINT32_MAX, and that PIT_GetPeriod is
+ *    within half a clock of the requested period. Checks PIT_SetTicks and PIT_GetPeriod the same way,
+ *    and reports, for every clock, the worst error of the sample periods next to the error the
+ *    conversion through a whole number of ns per clock had.
+ *    Checks that PIT_Chain sets and clears the chain bit of channels 1 to 3 only, and that setting
+ *    or enabling a chained channel keeps it chained.
+ *    Checks that disabling a channel clears its flag and its pending interrupt in the NVIC, and that
+ *    enabling it leaves them alone.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-11
+ */
+
+#include "MK70F12.h"
+#include "PIT.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Bus clocks to check: the tower's, the FLL default, and the PLL settings of other boards
+static const uint32_t CLOCKS[] = {25000000, 20971520, 24000000, 48000000, 50000000, 60000000, 75000000};
+
+//Mains frequencies and samples per cycle the tower samples at
+static const double MAINS_HZ[][2] = {{47.5, 52.5}, {57.5, 62.5}};
+#define MAINS_STEP_HZ 0.05
+#define SAMPLES_PER_CYCLE_MIN 16
+#define SAMPLES_PER_CYCLE_MAX 128
+
+#define NB_RANDOM_PERIODS 100000
+
+TPITSimChannel PITSim_Channels[4];
+volatile uint32_t PITSim_MCR;
+volatile uint32_t PITSim_Ignored;
+volatile uint32_t PITSim_NVICICPR2;
+
+static int Failures;
+
+//Stand-ins
+
+OS_ERROR OS_SemaphoreSignal(OS_ECB* const pEvent)
+{
+  pEvent->count++;
+  return OS_NO_ERROR;
+}
+
+//Checks
+
+static void Expect(const bool condition, const char* what, const uint32_t clock, const uint64_t value)
+{
+  if (!condition)
+  {
+    fprintf(stderr, "FAIL: %s, clock %u Hz, %llu\n", what, clock, (unsigned long long) value);
+    Failures++;
+  }
+}
+
+/*! @brief The module clocks a period should load, worked out in 128 bits.
+ *
+ */
+static uint32_t ExpectedTicks(const uint64_t period, const uint32_t clock)
+{
+  unsigned __int128 ticks = ((unsigned __int128) period * clock + 500000000) / 1000000000;
+
+  if (ticks > UINT32_MAX)
+    return UINT32_MAX;
+  return ticks ? (uint32_t) ticks : 1;
+}
+
+/*! @brief The period, in picoseconds rounded down, of a number of module clocks, worked out in 128 bits.
+ *
+ */
+static uint64_t ExpectedPeriod(const uint32_t ticks, const uint32_t clock)
+{
+  return (uint64_t) ((unsigned __int128) ticks * 1000000000000ULL / clock);
+}
+
+/*! @brief Sets a period with PIT_Set and checks the clocks loaded and the period read back.
+ *
+ *  @return int64_t - The error of PIT_GetPeriod from the requested period, in picoseconds.
+ */
+static int64_t CheckPeriod(const uint64_t period, const uint32_t clock)
+{
+  uint32_t ticks = ExpectedTicks(period, clock);
+
+  PIT_Set(0, period, true);
+  Expect(PIT_LDVAL0 + 1ULL == ticks, "PIT_Set loads the period rounded to the nearest clock", clock, period);
+  Expect(PIT_TCTRL0 == (PIT_TCTRL_TEN_MASK | PIT_TCTRL_TIE_MASK), "PIT_Set enables the channel and its interrupt", clock, period);
+
+  uint64_t achieved = PIT_GetPeriod(0);
+  Expect(achieved == ExpectedPeriod(ticks, clock), "PIT_GetPeriod is the period of the clocks loaded", clock, period);
+
+  int64_t error = (int64_t) achieved - (int64_t) (period * 1000);
+  uint64_t halfClock = 500000000000ULL / clock + 1;  //Half a clock, in ps, plus the rounding down of PIT_GetPeriod
+
+  if (ticks != 1 && ticks != UINT32_MAX)
+    Expect((uint64_t) llabs(error) <= halfClock, "PIT_GetPeriod is within half a clock of the request", clock, period);
+
+  return error;
+}
+
+static uint64_t RandomPeriod(const uint32_t clock)
+{
+  //Log-uniform from 1ns to twice what LDVAL holds
+  uint64_t limit = (uint64_t) UINT32_MAX * 2000000000ULL / clock;
+  uint8_t nbBits = 1 + rand() % (64 - __builtin_clzll(limit));
+  uint64_t period = (((uint64_t) rand() << 31) ^ (uint64_t) rand()) & ((1ULL << nbBits) - 1);
+
+  return (period > limit) ? limit : period + 1;
+}
+
+/*! @brief Chains and unchains every channel, checking the chain bit of TCTRL.
+ *
+ */
+static void CheckChain(const uint32_t clock)
+{
+  const uint32_t chn = 0x4;                 //TCTRL bit 2, CHN
+
+  Expect(!PIT_Chain(0, true), "PIT_Chain refuses channel 0", clock, 0);
+  Expect(!(PIT_TCTRL0 & chn), "PIT_Chain leaves channel 0 unchained", clock, 0);
+  Expect(!PIT_Chain(PIT_NB_CHANNELS, true), "PIT_Chain refuses a channel past the last", clock, PIT_NB_CHANNELS);
+
+  for (uint8_t channelNb = 1; channelNb < PIT_NB_CHANNELS; channelNb++)
+  {
+    volatile uint32_t * const tctrl = &PITSim_Channels[channelNb].TCTRL;
+
+    *tctrl = 0;
+    Expect(PIT_Chain(channelNb, true), "PIT_Chain accepts channels 1 to 3", clock, channelNb);
+    Expect(*tctrl == chn, "PIT_Chain sets only the chain bit", clock, channelNb);
+
+    PIT_SetTicks(channelNb, 10, true);
+    PIT_Enable(channelNb, false);
+    PIT_Enable(channelNb, true);
+    Expect(*tctrl == (chn | PIT_TCTRL_TEN_MASK | PIT_TCTRL_TIE_MASK), "a chained channel stays chained when set", clock, channelNb);
+
+    Expect(PIT_Chain(channelNb, false), "PIT_Chain unchains channels 1 to 3", clock, channelNb);
+    Expect(*tctrl == (PIT_TCTRL_TEN_MASK | PIT_TCTRL_TIE_MASK), "PIT_Chain clears only the chain bit", clock, channelNb);
+  }
+}
+
+/*! @brief Disables and enables every channel, checking an expiry pending is dropped only when disabling.
+ *
+ */
+static void CheckDisable(const uint32_t clock)
+{
+  for (uint8_t channelNb = 0; channelNb < PIT_NB_CHANNELS; channelNb++)
+  {
+    TPITSimChannel * const channel = &PITSim_Channels[channelNb];
+
+    PIT_SetTicks(channelNb, 10, true);
+    channel->TFLG = 0;                      //TIF is write 1 to clear, so a write shows as 1
+    PITSim_NVICICPR2 = 0;
+    PIT_Enable(channelNb, false);
+    Expect(!(channel->TCTRL & PIT_TCTRL_TEN_MASK), "PIT_Enable disables the channel", clock, channelNb);
+    Expect(channel->TFLG == PIT_TFLG_TIF_MASK, "disabling clears the flag of the channel", clock, channelNb);
+    Expect(PITSim_NVICICPR2 == 1u << ((68 + channelNb) % 32), "disabling clears the pending interrupt of the channel", clock, channelNb);
+
+    channel->TFLG = 0;
+    PITSim_NVICICPR2 = 0;
+    PIT_Enable(channelNb, true);
+    Expect(channel->TFLG == 0 && PITSim_NVICICPR2 == 0, "enabling leaves a pending interrupt alone", clock, channelNb);
+  }
+}
+
+static int Check(void)
+{
+  for (uint8_t c = 0; c < sizeof(CLOCKS) / sizeof(CLOCKS[0]); c++)
+  {
+    uint32_t clock = CLOCKS[c];
+    uint32_t nsPerClock = 1000000000 / clock;   //What PIT_Init used to keep
+    double worst = 0.0, worstTruncated = 0.0;
+
+    memset(PITSim_Channels, 0, sizeof(PITSim_Channels));
+    Expect(PIT_Init(clock, NULL, NULL), "PIT_Init succeeds", clock, 0);
+
+    for (uint8_t range = 0; range < sizeof(MAINS_HZ) / sizeof(MAINS_HZ[0]); range++)
+      for (double hz = MAINS_HZ[range][0]; hz <= MAINS_HZ[range][1] + MAINS_STEP_HZ / 2; hz += MAINS_STEP_HZ)
+        for (uint16_t nbSamples = SAMPLES_PER_CYCLE_MIN; nbSamples <= SAMPLES_PER_CYCLE_MAX; nbSamples *= 2)
+        {
+          uint64_t period = (uint64_t) (1e9 / hz / nbSamples);   //As the tower works it out
+          double error = (double) CheckPeriod(period, clock) / (period * 1000.0);
+          double truncated = ((double) (period / nsPerClock) * 1e9 / clock - period) / period;
+
+          if (error < 0) error = -error;
+          if (truncated < 0) truncated = -truncated;
+          if (error > worst) worst = error;
+          if (truncated > worstTruncated) worstTruncated = truncated;
+        }
+
+    for (uint32_t i = 0; i < NB_RANDOM_PERIODS; i++)
+      CheckPeriod(RandomPeriod(clock), clock);
+    CheckPeriod(0, clock);
+
+    static const uint32_t TICKS[] = {1, 2, 1000, 25000, 0x7FFFFFFF, UINT32_MAX};
+    for (uint8_t i = 0; i < sizeof(TICKS) / sizeof(TICKS[0]); i++)
+    {
+      PIT_SetTicks(2, TICKS[i], true);
+      Expect(PIT_LDVAL2 + 1ULL == TICKS[i], "PIT_SetTicks loads the clocks", clock, TICKS[i]);
+      Expect(PIT_GetPeriod(2) == ExpectedPeriod(TICKS[i], clock), "PIT_GetPeriod is the period of the clocks set", clock, TICKS[i]);
+    }
+
+    CheckChain(clock);
+    CheckDisable(clock);
+
+    printf("%9u Hz  worst sample period error %.2e  (%.2e through whole ns per clock)\n", clock, worst, worstTruncated);
+  }
+
+  printf("%s\n", Failures ? "FAILED" : "passed");
+  return Failures ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 2 || strcmp(argv[1], "check") != 0)
+  {
+    fprintf(stderr, "usage: %s check\n", argv[0]);
+    return 2;
+  }
+
+  srand(1);
+  return Check();
+}
@@ -0,0 +1,14 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the Processor Expert CPU header included by packet.c, which uses none of it.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-10
+ */
+
+#ifndef __Cpu_H
+#define __Cpu_H
+
+#include "PE_Types.h"
+
+#endif
@@ -0,0 +1,16 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the MK70F12 register definitions included by packet.c and its headers.
+ *
+ *  packet.c touches no register itself, so nothing is defined.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-10
+ */
+
+#ifndef MK70F12_H
+#define MK70F12_H
+
+#include <stdint.h>
+
+#endif
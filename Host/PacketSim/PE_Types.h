@@ -0,0 +1,14 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the Processor Expert types header included by packet.c, which uses none of it.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-10
+ */
+
+#ifndef __PE_Types_H
+#define __PE_Types_H
+
+#include <stdint.h>
+
+#endif
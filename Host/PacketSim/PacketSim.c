@@ -0,0 +1,148 @@
+/*! @file
+ *
+ *  @brief Stand-in for the UART, the RTOS and the time base, to run packet.c on a Linux host.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-10
+ */
+
+#include "PacketSim.h"
+#include "OS.h"
+#include "UART.h"
+#include "Time.h"
+#include "packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void (*RxCallback)(const uint8_t);   //Set by packet.c with UART_SetRxCallback
+static uint32_t NbSignals;                  //Semaphore signals, so a queued frame is seen
+static uint64_t Now;                        //Time base, one tick per call
+
+static uint8_t Sent[PACKETSIM_SENT_SIZE];   //Sent bytes not taken yet
+static uint32_t NbSent;                     //Bytes in Sent
+
+static TPacketSimStats Stats;
+
+//Stand-in
+
+uint32_t PacketSim_Receive(const uint8_t data[], const uint32_t nbBytes, void (*received)(void))
+{
+  uint32_t nbFrames = 0;
+
+  if (!RxCallback)
+  {
+    fprintf(stderr, "no receive callback: Packet_Init has not been called\n");
+    abort();
+  }
+
+  for (uint32_t i = 0; i < nbBytes; i++)
+  {
+    uint32_t nbSignals = NbSignals;
+
+    RxCallback(data[i]);
+    Stats.bytesReceived++;
+
+    //The only semaphore the receive callback signals is the one of the frame queue
+    if (NbSignals != nbSignals)
+    {
+      Packet_Get();
+      Stats.framesReceived++;
+      nbFrames++;
+      if (received)
+        received();
+    }
+  }
+
+  return nbFrames;
+}
+
+uint32_t PacketSim_TakeSent(uint8_t data[])
+{
+  uint32_t nbBytes = NbSent;
+
+  if (data)
+    memcpy(data, Sent, nbBytes);
+  NbSent = 0;
+
+  return nbBytes;
+}
+
+const TPacketSimStats* PacketSim_Stats(void)
+{
+  return &Stats;
+}
+
+//UART stand-in
+
+bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
+{
+  (void) baudRate;
+  (void) moduleClk;
+  return true;
+}
+
+void UART_SetRxCallback(void (*userFunction)(const uint8_t))
+{
+  RxCallback = userFunction;
+}
+
+void UART_OutBlock(const uint8_t data[], const uint16_t nbBytes)
+{
+  uint32_t nbKept = (nbBytes < PACKETSIM_SENT_SIZE - NbSent) ? nbBytes : PACKETSIM_SENT_SIZE - NbSent;
+
+  memcpy(&Sent[NbSent], data, nbKept);
+  NbSent += nbKept;
+
+  Stats.bytesSent += nbBytes;
+  Stats.blocksSent++;
+}
+
+//Time stand-in
+
+uint64_t Time_Now64(void)
+{
+  return Now++;
+}
+
+//RTOS stand-in
+
+OS_ECB* OS_SemaphoreCreate(const uint32_t value)
+{
+  OS_ECB *semaphore = malloc(sizeof(OS_ECB));
+
+  semaphore->count = value;
+  return semaphore;
+}
+
+OS_ERROR OS_SemaphoreSignal(OS_ECB* const pEvent)
+{
+  pEvent->count++;
+  NbSignals++;
+  return OS_NO_ERROR;
+}
+
+OS_ERROR OS_SemaphoreWait(OS_ECB* const pEvent, const uint32_t timeout)
+{
+  (void) timeout;
+
+  if (pEvent->count == 0)
+  {
+    fprintf(stderr, "deadlock: waiting on a semaphore nothing can signal\n");
+    abort();
+  }
+
+  pEvent->count--;
+  return OS_NO_ERROR;
+}
+
+void OS_TimeDelay(const uint32_t ticks)
+{
+  (void) ticks;
+}
+
+uint32_t OS_TimeGet(void)
+{
+  return (uint32_t) Now;
+}
@@ -0,0 +1,60 @@
+/*! @file
+ *
+ *  @brief Stand-in for the UART, the RTOS and the time base, to run packet.c on a Linux host.
+ *
+ *  Received bytes are handed to the callback packet.c gives UART_SetRxCallback, as RxThread would.
+ *  Every frame it queues is taken at once with Packet_Get, so the frame queue never fills. The blocks
+ *  packet.c sends with UART_OutBlock are kept in a buffer for the caller, or counted and dropped.
+ *
+ *  Build (Linux, not part of the firmware build):
+ *    gcc -std=c99 -O2 -Wall -Wextra -fcommon -Wno-attributes -Dinterrupt=used -I. -I../../Sources -o packet_sim \
+ *        main.c PacketSim.c ../../Sources/packet.c ../../Sources/CRC.c
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-10
+ */
+
+#ifndef PACKETSIM_H
+#define PACKETSIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PACKETSIM_SENT_SIZE 4096            //Bytes of sent blocks kept for PacketSim_TakeSent
+
+/*!
+ * @struct TPacketSimStats
+ * @brief What packet.c has done since it was initialized.
+ */
+typedef struct
+{
+  uint64_t bytesReceived;                   /*!< Bytes handed to the receive callback */
+  uint64_t framesReceived;                  /*!< Frames queued for Packet_Get */
+  uint64_t bytesSent;                       /*!< Bytes passed to UART_OutBlock */
+  uint64_t blocksSent;                      /*!< Calls to UART_OutBlock */
+} TPacketSimStats;
+
+/*! @brief Hands received bytes to packet.c, as RxThread does.
+ *
+ *  @param data The bytes.
+ *  @param nbBytes The number of bytes.
+ *  @param received Called after Packet_Get for every frame packet.c validates, with Packet holding it. May be NULL.
+ *  @return uint32_t - The number of frames validated.
+ *  @note Assumes Packet_Init has been called.
+ */
+uint32_t PacketSim_Receive(const uint8_t data[], const uint32_t nbBytes, void (*received)(void));
+
+/*! @brief Takes the bytes sent since the last call, up to PACKETSIM_SENT_SIZE; later ones are only counted.
+ *
+ *  @param data Where to copy the bytes, PACKETSIM_SENT_SIZE long. NULL to drop them.
+ *  @return uint32_t - The number of bytes copied.
+ */
+uint32_t PacketSim_TakeSent(uint8_t data[]);
+
+/*! @brief Returns the counters of the stand-in.
+ *
+ *  @return const TPacketSimStats * - The counters.
+ */
+const TPacketSimStats* PacketSim_Stats(void);
+
+#endif
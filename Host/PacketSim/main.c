@@ -0,0 +1,369 @@
+/*! @file
+ *
+ *  @brief Checks and benchmarks of the packet module (Sources/packet.c) on a host stand-in for the UART.
+ *
+ *  packet_sim check <frames>
+ *    For the XOR and the CRC-8 frame checks:
+ *    - sends <frames> random packets through Packet_PutBatch in batches, feeds the bytes sent back to the
+ *      receiver and checks every packet comes back, in order;
+ *    - feeds <frames> packets with random garbage or a truncated packet before some of them, and
+ *      checks the receiver resyncs: a packet is only lost to a window that happens to pass the
+ *      check, and those are as rare as the 8-bit check makes them;
+ *    - feeds <frames> packets with 1 and 2 bit errors and 8-bit bursts, and counts those taken for valid
+ *      packets: none for CRC-8, while XOR misses some 2 bit errors;
+ *    - checks the legacy XOR startup packet is still taken in CRC-8 mode, and other XOR packets are not.
+ *  packet_sim bench <megabytes>
+ *    Receives <megabytes> of valid packets, then of noise, and sends <megabytes> of packets in batches, with each
+ *    check, and reports the host throughput in MB/s. Only the ratios carry over to the tower.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-10
+ */
+
+#define _POSIX_C_SOURCE 199309L     //clock_gettime
+
+#include "PacketSim.h"
+#include "packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_FRAMES 100000                  //Frames a check can track
+
+static const char* const CHECK_NAMES[] = {"xor", "crc8"};
+
+static int Failures;
+
+static TPacket Expected[MAX_FRAMES];       //Frames sent to the receiver, in order
+static uint32_t NbExpected;
+static uint32_t NbMatched;                 //Frames of Expected received or lost so far, in order
+static uint32_t NbLost;                    //Frames of Expected skipped over by a later one
+static uint32_t NbSpurious;                //Frames received that were never sent
+
+static void Expect(const bool condition, const char* what)
+{
+  if (!condition)
+  {
+    fprintf(stderr, "FAIL: %s\n", what);
+    Failures++;
+  }
+}
+
+/*! @brief Called for every frame received: matches it with the next frames sent, in order.
+ *
+ */
+static void Received(void)
+{
+  for (uint32_t i = NbMatched; i < NbExpected; i++)
+    if (memcmp(Expected[i].bytes, Packet.bytes, PACKET_NB_BYTES) == 0)
+    {
+      NbLost += i - NbMatched;             //Any frame skipped is lost
+      NbMatched = i + 1;
+      return;
+    }
+
+  NbSpurious++;
+}
+
+static void Track(const TPacket* const frame)
+{
+  if (NbExpected < MAX_FRAMES)
+    Expected[NbExpected++] = *frame;
+}
+
+static void Untrack(void)
+{
+  NbExpected = NbMatched = NbLost = NbSpurious = 0;
+}
+
+static uint8_t Random8(void)
+{
+  return rand() & 0xFF;
+}
+
+/*! @brief Encodes a frame as the tower would send it, through Packet_Put.
+ *
+ */
+static void Encode(TPacket* const frame, const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3)
+{
+  Packet_Put(command, parameter1, parameter2, parameter3);
+  PacketSim_TakeSent(frame->bytes);
+}
+
+static void RandomFrame(TPacket* const frame)
+{
+  Encode(frame, Random8(), Random8(), Random8(), Random8());
+}
+
+static void RoundTrip(const TPacketCheck check, const uint32_t nbFrames)
+{
+  static uint8_t sent[PACKETSIM_SENT_SIZE];
+  TPacketBatch batch;
+  char what[80];
+
+  Untrack();
+  for (uint32_t i = 0; i < nbFrames; i += PACKET_BATCH_SIZE * 3)
+  {
+    //Batches of up to three times their size, so full batches are sent before the commit
+    uint32_t nbInBatch = (nbFrames - i < PACKET_BATCH_SIZE * 3) ? nbFrames - i : 1 + (uint32_t) rand() % (PACKET_BATCH_SIZE * 3);
+    TPacket frames[PACKET_BATCH_SIZE * 3];
+
+    for (uint32_t j = 0; j < nbInBatch; j++)
+    {
+      RandomFrame(&frames[j]);             //Before the batch, which may send part of itself meanwhile
+      Track(&frames[j]);
+    }
+
+    Packet_BeginBatch(&batch);
+    for (uint32_t j = 0; j < nbInBatch; j++)
+      Packet_PutBatch(&batch, frames[j].packetStruct.command, frames[j].bytes[1], frames[j].bytes[2], frames[j].bytes[3]);
+    Packet_CommitBatch(&batch);
+
+    uint32_t nbBytes = PacketSim_TakeSent(sent);
+    Expect(nbBytes == nbInBatch * PACKET_NB_BYTES, "a batch sends every frame once");
+    PacketSim_Receive(sent, nbBytes, Received);
+  }
+
+  snprintf(what, sizeof(what), "%s: every frame sent comes back (%u of %u, %u spurious)", CHECK_NAMES[check],
+           NbMatched - NbLost, NbExpected, NbSpurious);
+  Expect(NbMatched == NbExpected && NbLost == 0 && NbSpurious == 0, what);
+}
+
+static void Resync(const TPacketCheck check, const uint32_t nbFrames)
+{
+  uint32_t nbGarbage = 0;
+  char what[120];
+
+  Untrack();
+  for (uint32_t i = 0; i < nbFrames; i++)
+  {
+    TPacket frame;
+    uint8_t garbage[PACKET_NB_BYTES - 1];
+    uint8_t nbBytes = (rand() % 4 == 0) ? 1 + rand() % (PACKET_NB_BYTES - 1) : 0;
+
+    //Random bytes, or the start of a frame cut short
+    if (rand() % 2)
+      for (uint8_t j = 0; j < nbBytes; j++)
+        garbage[j] = Random8();
+    else
+    {
+      RandomFrame(&frame);
+      memcpy(garbage, frame.bytes, nbBytes);
+    }
+    nbGarbage += nbBytes;
+    PacketSim_Receive(garbage, nbBytes, Received);
+
+    RandomFrame(&frame);
+    Track(&frame);
+    PacketSim_Receive(frame.bytes, PACKET_NB_BYTES, Received);
+  }
+
+  //Each spurious frame takes some bytes of the frame after it, which is then lost
+  uint32_t nbLost = NbLost + NbExpected - NbMatched;
+  snprintf(what, sizeof(what), "%s: resync after %u garbage bytes loses %u frames to %u spurious ones", CHECK_NAMES[check],
+           nbGarbage, nbLost, NbSpurious);
+  printf("%s\n", what);
+  Expect(nbLost <= NbSpurious + 1, what);
+  //Every garbage byte ends a window holding it that the check passes 1 time in 256
+  Expect(NbSpurious <= nbGarbage / 256 * 2 + 5, "spurious frames are as rare as the check makes them");
+}
+
+/*! @brief Feeds frames with errors and counts the ones taken for valid frames.
+ *
+ *  @param nbBits The bits flipped, at random places, or 0 for a burst of 8 bits from a random place.
+ *  @return uint32_t - The frames with errors received as they were corrupted.
+ */
+static uint32_t Corrupt(const uint32_t nbFrames, const uint8_t nbBits)
+{
+  uint32_t nbMissed = 0;
+
+  for (uint32_t i = 0; i < nbFrames; i++)
+  {
+    TPacket frame, corrupted;
+
+    RandomFrame(&frame);
+    corrupted = frame;
+
+    //Bits are numbered from the most significant of the first byte, in the order the CRC divides them
+    if (nbBits == 0)
+    {
+      uint8_t start = rand() % (PACKET_NB_BYTES * 8 - 7);
+      uint8_t burst = 0x81 | Random8();    //First and last bits flipped, so the burst is 8 bits long
+
+      for (uint8_t bit = 0; bit < 8; bit++)
+        if (burst & (1 << bit))
+          corrupted.bytes[(start + bit) / 8] ^= 0x80 >> ((start + bit) % 8);
+    }
+    else
+    {
+      uint8_t bits[8];
+
+      for (uint8_t j = 0; j < nbBits; j++)
+      {
+        uint8_t bit;
+        bool used;
+
+        do
+        {
+          bit = rand() % (PACKET_NB_BYTES * 8);
+          used = false;
+          for (uint8_t k = 0; k < j; k++)
+            used |= (bits[k] == bit);
+        }
+        while (used);
+
+        bits[j] = bit;
+        corrupted.bytes[bit / 8] ^= 0x80 >> (bit % 8);
+      }
+    }
+
+    Untrack();
+    Track(&corrupted);
+    PacketSim_Receive(corrupted.bytes, PACKET_NB_BYTES, Received);
+    nbMissed += NbMatched;
+  }
+
+  return nbMissed;
+}
+
+static void Detection(const TPacketCheck check, const uint32_t nbFrames)
+{
+  char what[120];
+
+  uint32_t missed1 = Corrupt(nbFrames, 1);
+  uint32_t missed2 = Corrupt(nbFrames, 2);
+  uint32_t missedBurst = Corrupt(nbFrames, 0);
+
+  snprintf(what, sizeof(what), "%s: errors taken for valid frames: 1 bit %u, 2 bits %u, 8-bit bursts %u, of %u each",
+           CHECK_NAMES[check], missed1, missed2, missedBurst, nbFrames);
+  printf("%s\n", what);
+
+  Expect(missed1 == 0, "every 1 bit error is detected");
+  if (check == PACKET_CHECK_CRC8)
+    Expect(missed2 == 0 && missedBurst == 0, "CRC-8 detects every 2 bit error and 8-bit burst");
+  else if (nbFrames >= 1000)                //About 1 in 10 2 bit errors hit the same bit of two bytes
+    Expect(missed2 > 0, "XOR misses the 2 bit errors in the same bit of two bytes");
+}
+
+static void Startup(void)
+{
+  TPacket startup, other;
+
+  Packet_SetCheck(PACKET_CHECK_XOR);
+  Encode(&startup, PACKET_STARTUP_COMMAND, 0, 0, 0);
+  Encode(&other, 0x10, 0, 0, 0);
+  Packet_SetCheck(PACKET_CHECK_CRC8);
+
+  Untrack();
+  Track(&startup);
+  PacketSim_Receive(startup.bytes, PACKET_NB_BYTES, Received);
+  Expect(NbMatched == 1, "crc8: the legacy XOR startup packet is taken");
+
+  Untrack();
+  Track(&other);
+  PacketSim_Receive(other.bytes, PACKET_NB_BYTES, Received);
+  Expect(NbMatched == 0, "crc8: other XOR packets are not");
+}
+
+static int Check(const uint32_t nbFrames)
+{
+  if (nbFrames == 0 || nbFrames > MAX_FRAMES)
+  {
+    fprintf(stderr, "frames must be 1 to %u\n", MAX_FRAMES);
+    return 2;
+  }
+
+  for (TPacketCheck check = PACKET_CHECK_XOR; check <= PACKET_CHECK_CRC8; check++)
+  {
+    Packet_SetCheck(check);
+    RoundTrip(check, nbFrames);
+    Resync(check, nbFrames);
+    Detection(check, nbFrames);
+  }
+  Startup();
+
+  printf("%s\n", Failures ? "FAILED" : "passed");
+  return Failures ? 1 : 0;
+}
+
+static double Seconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int Bench(const uint32_t nbMegabytes)
+{
+  static uint8_t stream[1 << 20];
+  static TPacketBatch batch;
+
+  for (TPacketCheck check = PACKET_CHECK_XOR; check <= PACKET_CHECK_CRC8; check++)
+  {
+    Packet_SetCheck(check);
+
+    //A megabyte of valid frames, encoded once
+    for (uint32_t i = 0; i + PACKET_NB_BYTES <= sizeof(stream); i += PACKET_NB_BYTES)
+    {
+      TPacket frame;
+      RandomFrame(&frame);
+      memcpy(&stream[i], frame.bytes, PACKET_NB_BYTES);
+    }
+    uint32_t nbBytes = sizeof(stream) / PACKET_NB_BYTES * PACKET_NB_BYTES;
+
+    double start = Seconds();
+    for (uint32_t i = 0; i < nbMegabytes; i++)
+      PacketSim_Receive(stream, nbBytes, NULL);
+    double receive = Seconds() - start;
+
+    for (uint32_t i = 0; i < sizeof(stream); i++)
+      stream[i] = Random8();
+    start = Seconds();
+    for (uint32_t i = 0; i < nbMegabytes; i++)
+      PacketSim_Receive(stream, sizeof(stream), NULL);
+    double noise = Seconds() - start;
+
+    start = Seconds();
+    for (uint32_t i = 0; i < nbMegabytes; i++)
+      for (uint32_t j = 0; j < nbBytes / PACKET_NB_BYTES; j += PACKET_BATCH_SIZE)
+      {
+        Packet_BeginBatch(&batch);
+        for (uint8_t k = 0; k < PACKET_BATCH_SIZE; k++)
+          Packet_PutBatch(&batch, stream[j], stream[j + 1], stream[j + 2], k);
+        Packet_CommitBatch(&batch);
+        PacketSim_TakeSent(NULL);
+      }
+    double send = Seconds() - start;
+
+    printf("%-4s  receive %7.1f MB/s  noise %7.1f MB/s  send %7.1f MB/s\n", CHECK_NAMES[check],
+           nbMegabytes / receive, nbMegabytes / noise, nbMegabytes / send);
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "usage: %s check <frames> | bench <megabytes>\n", argv[0]);
+    return 2;
+  }
+
+  uint32_t count = (uint32_t) strtoul(argv[2], NULL, 0);
+
+  srand(1);
+  if (!Packet_Init(115200, 25000000))
+    return 1;
+
+  if (strcmp(argv[1], "check") == 0)
+    return Check(count);
+  if (strcmp(argv[1], "bench") == 0)
+    return Bench(count);
+
+  fprintf(stderr, "unknown mode %s\n", argv[1]);
+  return 2;
+}
@@ -0,0 +1,139 @@
+/*! @file
+ *
+ *  @brief Host side encoding and decoding of "Tower to PC Protocol" packets.
+ *
+ *  Mirrors the 5-byte framing of Sources/packet.h: command, three parameters and a checksum.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-06-28
+ */
+
+#ifndef TOWER_PACKET_H
+#define TOWER_PACKET_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tower
+{
+
+// Packet structure
+constexpr std::size_t PACKET_NB_BYTES = 5;
+
+// Acknowledgment bit mask
+constexpr uint8_t PACKET_ACK_MASK = 0x80u;
+
+// Commands understood by the tower
+constexpr uint8_t STARTUP_COMMAND      = 0x04;
+constexpr uint8_t PROGRAM_BYTE_COMMAND = 0x07;
+constexpr uint8_t READ_BYTE_COMMAND    = 0x08;
+constexpr uint8_t TIMING_MODE_COMMAND  = 0x10;
+constexpr uint8_t NB_RAISES_COMMAND    = 0x11;
+constexpr uint8_t NB_LOWERS_COMMAND    = 0x12;
+constexpr uint8_t FREQUENCY_COMMAND    = 0x17;
+constexpr uint8_t VOLTAGE_COMMAND      = 0x18;
+constexpr uint8_t SPECTRUM_COMMAND     = 0x19;
+constexpr uint8_t EVENT_LOG_COMMAND    = 0x1A;
+
+// Most events returned by one event log command
+constexpr uint8_t EVENT_LOG_PAGE_SIZE  = 8;
+
+// Highest harmonic at the most samples per cycle (SAMPLES_PER_CYCLE_MAX / 2 - 1), the tower NACKs those above its current setting
+constexpr uint8_t SPECTRUM_MAX_HARMONIC = 63;
+
+/*! @brief A decoded packet.
+ *
+ */
+struct Packet
+{
+  uint8_t command;
+  uint8_t parameter1;
+  uint8_t parameter2;
+  uint8_t parameter3;
+
+  /*! @brief Calculates the checksum the tower expects for this packet.
+   *
+   *  @return uint8_t - The XOR of the command and parameters.
+   */
+  uint8_t Checksum() const
+  {
+    return command ^ parameter1 ^ parameter2 ^ parameter3;
+  }
+
+  /*! @brief Encodes the packet as it is sent on the wire.
+   *
+   *  @return std::array - The command, parameters and checksum.
+   */
+  std::array<uint8_t, PACKET_NB_BYTES> Encode() const
+  {
+    return {{command, parameter1, parameter2, parameter3, Checksum()}};
+  }
+
+  /*! @brief Checks whether two packets carry the same parameters.
+   *
+   *  @param other The packet to compare with.
+   *  @return bool - true if the three parameters are equal.
+   */
+  bool SameParameters(const Packet& other) const
+  {
+    return parameter1 == other.parameter1 && parameter2 == other.parameter2 && parameter3 == other.parameter3;
+  }
+};
+
+/*! @brief Reassembles packets from a byte stream.
+ *
+ *  Keeps a sliding window of the last 5 bytes, so a corrupted byte only costs the frames that contain it.
+ */
+class FrameDecoder
+{
+public:
+  /*! @brief Feeds received bytes into the decoder.
+   *
+   *  @param data A pointer to the received bytes.
+   *  @param length The number of received bytes.
+   *  @param packets The vector to which complete packets are appended.
+   */
+  void Feed(const uint8_t* data, std::size_t length, std::vector<Packet>& packets)
+  {
+    for (std::size_t i = 0; i < length; i++)
+    {
+      Window[Position++] = data[i];
+      if (Position < PACKET_NB_BYTES)
+        continue;
+
+      Packet packet = {Window[0], Window[1], Window[2], Window[3]};
+      if (packet.Checksum() == Window[4])
+      {
+        packets.push_back(packet);
+        Position = 0;
+      }
+      else
+      {
+        // Slide the window by one byte and try again on the next one
+        for (std::size_t j = 1; j < PACKET_NB_BYTES; j++)
+          Window[j - 1] = Window[j];
+        Position = PACKET_NB_BYTES - 1;
+        DiscardedBytes++;
+      }
+    }
+  }
+
+  /*! @brief Returns the number of bytes dropped while resynchronising.
+   *
+   */
+  uint64_t Discarded() const
+  {
+    return DiscardedBytes;
+  }
+
+private:
+  std::array<uint8_t, PACKET_NB_BYTES> Window = {};
+  std::size_t Position = 0;
+  uint64_t DiscardedBytes = 0;
+};
+
+} // namespace tower
+
+#endif
@@ -0,0 +1,602 @@
+/*! @file
+ *
+ *  @brief Asynchronous, pipelined client for the tower serial protocol.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-06-28
+ */
+
+#include "TowerClient.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace tower
+{
+
+using Clock = std::chrono::steady_clock;
+
+/****************************************REQUESTS*****************************************************/
+
+static Request MakeRequest(uint8_t command, uint8_t p1, uint8_t p2, uint8_t p3, std::size_t nbReplies)
+{
+  return Request{Packet{static_cast<uint8_t>(command | PACKET_ACK_MASK), p1, p2, p3}, nbReplies};
+}
+
+Request Request::Startup()                              { return MakeRequest(STARTUP_COMMAND, 0, 0, 0, 1); }
+Request Request::ProgramByte(uint8_t offset, uint8_t v) { return MakeRequest(PROGRAM_BYTE_COMMAND, offset, '0', v, 0); }
+Request Request::EraseFlash()                           { return MakeRequest(PROGRAM_BYTE_COMMAND, 8, '0', 0, 0); }
+Request Request::ReadByte(uint8_t offset)               { return MakeRequest(READ_BYTE_COMMAND, offset, '0', 0, 1); }
+Request Request::GetTimingMode()                        { return MakeRequest(TIMING_MODE_COMMAND, 0, 0, 0, 1); }
+Request Request::SetTimingMode(uint8_t mode)            { return MakeRequest(TIMING_MODE_COMMAND, mode, 0, 0, 0); }
+Request Request::GetNbRaises()                          { return MakeRequest(NB_RAISES_COMMAND, 0, 0, 0, 1); }
+Request Request::ResetNbRaises()                        { return MakeRequest(NB_RAISES_COMMAND, 1, 0, 0, 0); }
+Request Request::GetNbLowers()                          { return MakeRequest(NB_LOWERS_COMMAND, 0, 0, 0, 1); }
+Request Request::ResetNbLowers()                        { return MakeRequest(NB_LOWERS_COMMAND, 1, 0, 0, 0); }
+Request Request::GetFrequency()                         { return MakeRequest(FREQUENCY_COMMAND, 0, 0, 0, 1); }
+Request Request::GetVoltage(uint8_t channel)            { return MakeRequest(VOLTAGE_COMMAND, channel, 0, 0, 1); }
+Request Request::GetSpectrum(uint8_t harmonic)          { return MakeRequest(SPECTRUM_COMMAND, harmonic, 0, 0, 1); }
+
+// A header packet, then 4 packets per event. The ACK arrives early if fewer events are logged
+Request Request::GetEvents(uint16_t first, uint8_t count)
+{
+  return MakeRequest(EVENT_LOG_COMMAND, static_cast<uint8_t>(first), static_cast<uint8_t>(first >> 8), count, 1 + 4 * count);
+}
+
+/****************************************SERIAL PORT*****************************************************/
+
+/*! @brief Converts a baud rate to its termios constant.
+ *
+ */
+static speed_t BaudToSpeed(uint32_t baudRate)
+{
+  switch (baudRate)
+  {
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    default:     return B115200;
+  }
+}
+
+/*! @brief Opens a device in non-blocking raw mode.
+ *
+ *  @return int - The file descriptor, or -1 on failure.
+ */
+static int OpenDevice(const std::string& path, uint32_t baudRate)
+{
+  int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct termios tio;
+  if (::tcgetattr(fd, &tio) == 0)   // Only real ttys and ptys, plain files/pipes are left alone
+  {
+    ::cfmakeraw(&tio);
+    ::cfsetispeed(&tio, BaudToSpeed(baudRate));
+    ::cfsetospeed(&tio, BaudToSpeed(baudRate));
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    ::tcsetattr(fd, TCSANOW, &tio);
+    ::tcflush(fd, TCIOFLUSH);
+  }
+  return fd;
+}
+
+/****************************************WORKER*****************************************************/
+
+/*! @brief Completion counter shared by the workers of a Client, used by Drain.
+ *
+ */
+struct Tracker
+{
+  std::mutex Lock;
+  std::condition_variable Idle;
+  uint64_t Outstanding = 0;
+
+  void Add()
+  {
+    std::lock_guard<std::mutex> guard(Lock);
+    Outstanding++;
+  }
+
+  void Done()
+  {
+    std::lock_guard<std::mutex> guard(Lock);
+    if (--Outstanding == 0)
+      Idle.notify_all();
+  }
+};
+
+/*! @brief One epoll loop serving a subset of the towers.
+ *
+ */
+class Worker
+{
+public:
+  Worker(const ClientOptions& options, Tracker& tracker);
+  ~Worker();
+
+  int Add(int fd);
+  void Submit(int local, const Request& request, Callback callback);
+  void AddStats(ClientStats& stats) const;
+
+private:
+  struct Pending
+  {
+    Request request;
+    Callback callback;
+    std::vector<Packet> replies;
+    bool maybeNack;                   /*!< The last reply echoes the request: a NACK, or data equal to it, the next packet tells */
+    unsigned attempts;
+    Clock::time_point sentAt;
+    Clock::time_point deadline;
+  };
+
+  struct Tower
+  {
+    int fd;
+    FrameDecoder decoder;
+    std::deque<Pending> queued;       /*!< Not sent yet, or waiting to be resent */
+    std::deque<Pending> inFlight;     /*!< Sent, replies arrive in this order */
+    std::vector<uint8_t> txBuffer;
+    std::size_t txOffset = 0;
+    bool wantWrite = false;
+    bool hungUp = false;              /*!< The device went away, requests to it time out */
+  };
+
+  struct Incoming
+  {
+    int local;
+    Pending pending;
+  };
+
+  static constexpr uint64_t WAKE_TOKEN = UINT64_MAX;
+
+  void Run();
+  void TakeInbox();
+  void Pump(Tower& tower);
+  void Flush(Tower& tower, uint64_t index);
+  void Receive(Tower& tower);
+  void Match(Tower& tower, const Packet& packet);
+  void Complete(Pending& pending, Response::Status status);
+  void ExpireTimeouts(Clock::time_point now);
+  int NextTimeoutMs(Clock::time_point now) const;
+
+  const ClientOptions& Options;
+  Tracker& Outstanding;
+
+  int Epoll;
+  int WakeFd;
+  std::atomic<bool> Stopping{false};
+  std::thread Thread;
+
+  std::mutex InboxLock;
+  std::vector<int> NewFds;
+  std::vector<Incoming> Inbox;
+  std::atomic<int> NbTowers{0};
+
+  std::vector<std::unique_ptr<Tower>> Towers;   /*!< Only touched by the worker thread */
+
+  std::atomic<uint64_t> Sent{0}, Acked{0}, Nacked{0}, Timeouts{0}, Retries{0}, Unsolicited{0}, Discarded{0};
+};
+
+Worker::Worker(const ClientOptions& options, Tracker& tracker) :
+  Options(options),
+  Outstanding(tracker)
+{
+  Epoll = ::epoll_create1(EPOLL_CLOEXEC);
+  WakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = WAKE_TOKEN;
+  ::epoll_ctl(Epoll, EPOLL_CTL_ADD, WakeFd, &event);
+
+  Thread = std::thread(&Worker::Run, this);
+}
+
+Worker::~Worker()
+{
+  Stopping = true;
+  uint64_t one = 1;
+  (void)::write(WakeFd, &one, sizeof(one));
+  Thread.join();
+
+  for (auto& tower : Towers)
+    ::close(tower->fd);
+  ::close(WakeFd);
+  ::close(Epoll);
+}
+
+int Worker::Add(int fd)
+{
+  int local;
+  {
+    std::lock_guard<std::mutex> guard(InboxLock);
+    NewFds.push_back(fd);
+    local = NbTowers++;
+  }
+  uint64_t one = 1;
+  (void)::write(WakeFd, &one, sizeof(one));
+  return local;
+}
+
+void Worker::Submit(int local, const Request& request, Callback callback)
+{
+  Outstanding.Add();
+  {
+    std::lock_guard<std::mutex> guard(InboxLock);
+    Inbox.push_back(Incoming{local, Pending{request, std::move(callback), {}, false, 0, {}, {}}});
+  }
+  uint64_t one = 1;
+  (void)::write(WakeFd, &one, sizeof(one));
+}
+
+void Worker::AddStats(ClientStats& stats) const
+{
+  stats.sent += Sent;
+  stats.acked += Acked;
+  stats.nacked += Nacked;
+  stats.timeouts += Timeouts;
+  stats.retries += Retries;
+  stats.unsolicited += Unsolicited;
+  stats.discardedBytes += Discarded;
+}
+
+/*! @brief Moves new towers and requests from the other threads into the worker.
+ *
+ */
+void Worker::TakeInbox()
+{
+  std::vector<int> fds;
+  std::vector<Incoming> inbox;
+  {
+    std::lock_guard<std::mutex> guard(InboxLock);
+    fds.swap(NewFds);
+    inbox.swap(Inbox);
+  }
+
+  // Towers first, so requests submitted right after Open find their tower
+  for (int fd : fds)
+  {
+    std::unique_ptr<Tower> tower(new Tower());
+    tower->fd = fd;
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = Towers.size();
+    ::epoll_ctl(Epoll, EPOLL_CTL_ADD, fd, &event);
+
+    Towers.push_back(std::move(tower));
+  }
+
+  for (auto& incoming : inbox)
+    Towers[incoming.local]->queued.push_back(std::move(incoming.pending));
+
+  for (uint64_t index = 0; index < Towers.size(); index++)
+  {
+    Pump(*Towers[index]);
+    Flush(*Towers[index], index);
+  }
+}
+
+/*! @brief Moves queued requests into flight until the pipeline window is full.
+ *
+ */
+void Worker::Pump(Tower& tower)
+{
+  Clock::time_point now = Clock::now();
+
+  while (tower.inFlight.size() < Options.window && !tower.queued.empty())
+  {
+    Pending pending = std::move(tower.queued.front());
+    tower.queued.pop_front();
+
+    auto bytes = pending.request.packet.Encode();
+    tower.txBuffer.insert(tower.txBuffer.end(), bytes.begin(), bytes.end());
+
+    pending.attempts++;
+    pending.sentAt = now;
+    pending.deadline = now + Options.timeout;
+    tower.inFlight.push_back(std::move(pending));
+    Sent++;
+  }
+}
+
+/*! @brief Writes as much of the transmit buffer as the device accepts, and waits for EPOLLOUT for the rest.
+ *
+ */
+void Worker::Flush(Tower& tower, uint64_t index)
+{
+  if (tower.hungUp)
+    return;
+
+  while (tower.txOffset < tower.txBuffer.size())
+  {
+    ssize_t written = ::write(tower.fd, tower.txBuffer.data() + tower.txOffset, tower.txBuffer.size() - tower.txOffset);
+    if (written <= 0)
+      break;
+    tower.txOffset += static_cast<std::size_t>(written);
+  }
+
+  if (tower.txOffset == tower.txBuffer.size())
+  {
+    tower.txBuffer.clear();
+    tower.txOffset = 0;
+  }
+
+  bool wantWrite = !tower.txBuffer.empty();
+  if (wantWrite != tower.wantWrite)
+  {
+    struct epoll_event event = {};
+    event.events = EPOLLIN | (wantWrite ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.u64 = index;
+    ::epoll_ctl(Epoll, EPOLL_CTL_MOD, tower.fd, &event);
+    tower.wantWrite = wantWrite;
+  }
+}
+
+void Worker::Receive(Tower& tower)
+{
+  uint8_t buffer[512];
+  std::vector<Packet> packets;
+
+  for (;;)
+  {
+    ssize_t length = ::read(tower.fd, buffer, sizeof(buffer));
+    if (length <= 0)
+      break;
+
+    uint64_t discarded = tower.decoder.Discarded();
+    tower.decoder.Feed(buffer, static_cast<std::size_t>(length), packets);
+    Discarded += tower.decoder.Discarded() - discarded;
+  }
+
+  for (const Packet& packet : packets)
+    Match(tower, packet);
+}
+
+/*! @brief Matches a received packet against the oldest request in flight.
+ *
+ *  The tower handles commands in order, so replies arrive in the order the requests were sent:
+ *  first the data packets, then the echo of the request with the ACK bit set (ACK) or cleared (NACK).
+ *  A NACK can cut the data short, and can look like a data packet, e.g. a voltage of 0 for channel 1.
+ *  While data is expected, a packet shaped like the NACK is kept as data but marked: more data or the
+ *  ACK show it was data, anything else that it was the NACK, which then fails the request.
+ */
+void Worker::Match(Tower& tower, const Packet& packet)
+{
+  if (tower.inFlight.empty())
+  {
+    Unsolicited++;
+    return;
+  }
+
+  Pending& head = tower.inFlight.front();
+  const Packet& sent = head.request.packet;
+  uint8_t command = sent.command & ~PACKET_ACK_MASK;
+  bool nackShape = (packet.command == command && packet.SameParameters(sent));
+
+  if (packet.command == sent.command && packet.SameParameters(sent))
+  {
+    Complete(head, Response::Status::Ack);
+  }
+  else if (packet.command == command && head.replies.size() < head.request.nbReplies)
+  {
+    head.replies.push_back(packet);
+    head.maybeNack = nackShape;
+    return;
+  }
+  else if (nackShape)
+  {
+    head.maybeNack = false;                       // The data is complete, so this can only be the NACK
+    Complete(head, Response::Status::Nack);
+  }
+  else if (head.maybeNack)
+  {
+    Complete(head, Response::Status::Nack);       // The reply to a later request: the marked packet was the NACK
+    tower.inFlight.pop_front();
+    Match(tower, packet);
+    return;
+  }
+  else
+  {
+    Unsolicited++;
+    return;
+  }
+
+  tower.inFlight.pop_front();
+}
+
+void Worker::Complete(Pending& pending, Response::Status status)
+{
+  if (pending.maybeNack && status == Response::Status::Nack)
+    pending.replies.pop_back();                   // The NACK, not data
+
+  switch (status)
+  {
+    case Response::Status::Ack:     Acked++;    break;
+    case Response::Status::Nack:    Nacked++;   break;
+    case Response::Status::Timeout: Timeouts++; break;
+  }
+
+  Response response{status, std::move(pending.replies), pending.attempts,
+                    std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - pending.sentAt)};
+  if (pending.callback)
+    pending.callback(pending.request, response);
+
+  Outstanding.Done();
+}
+
+/*! @brief Resends or fails requests whose ACK/NACK did not arrive in time.
+ *
+ *  Only the oldest request of a tower can time out first; the requests behind it keep their order.
+ *  A request whose last reply looks like its NACK, with nothing after it, was NACKed.
+ */
+void Worker::ExpireTimeouts(Clock::time_point now)
+{
+  for (auto& tower : Towers)
+  {
+    while (!tower->inFlight.empty() && tower->inFlight.front().deadline <= now)
+    {
+      Pending pending = std::move(tower->inFlight.front());
+      tower->inFlight.pop_front();
+
+      if (pending.maybeNack)
+        Complete(pending, Response::Status::Nack);
+      else if (pending.attempts <= Options.retries)
+      {
+        pending.replies.clear();
+        pending.maybeNack = false;
+        tower->queued.push_front(std::move(pending));   // Resend before anything not sent yet
+        Retries++;
+      }
+      else
+        Complete(pending, Response::Status::Timeout);
+    }
+  }
+}
+
+int Worker::NextTimeoutMs(Clock::time_point now) const
+{
+  bool found = false;
+  Clock::time_point next = now;
+
+  for (const auto& tower : Towers)
+  {
+    if (tower->inFlight.empty())
+      continue;
+    Clock::time_point deadline = tower->inFlight.front().deadline;
+    if (!found || deadline < next)
+      next = deadline;
+    found = true;
+  }
+
+  if (!found)
+    return -1;
+  if (next <= now)
+    return 0;
+  return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count()) + 1;
+}
+
+void Worker::Run()
+{
+  struct epoll_event events[64];
+
+  while (!Stopping)
+  {
+    int nbEvents = ::epoll_wait(Epoll, events, 64, NextTimeoutMs(Clock::now()));
+    if (nbEvents < 0 && errno != EINTR)
+      break;
+
+    for (int i = 0; i < nbEvents; i++)
+    {
+      uint64_t index = events[i].data.u64;
+      if (index == WAKE_TOKEN)
+      {
+        uint64_t count;
+        (void)::read(WakeFd, &count, sizeof(count));
+        TakeInbox();
+        continue;
+      }
+
+      Tower& tower = *Towers[index];
+      if (events[i].events & EPOLLIN)
+        Receive(tower);
+      if (events[i].events & (EPOLLHUP | EPOLLERR))
+      {
+        ::epoll_ctl(Epoll, EPOLL_CTL_DEL, tower.fd, nullptr);   // Stop spinning on a closed pty
+        tower.hungUp = true;
+      }
+      Pump(tower);
+      Flush(tower, index);
+    }
+
+    ExpireTimeouts(Clock::now());
+    for (uint64_t index = 0; index < Towers.size(); index++)
+    {
+      Pump(*Towers[index]);
+      Flush(*Towers[index], index);
+    }
+  }
+}
+
+/****************************************CLIENT*****************************************************/
+
+Client::Client(const ClientOptions& options) :
+  Options(options),
+  Outstanding(new Tracker())
+{
+  unsigned nbThreads = std::max(1u, Options.nbThreads);
+  for (unsigned i = 0; i < nbThreads; i++)
+    Workers.emplace_back(new Worker(Options, *Outstanding));
+}
+
+Client::~Client()
+{
+  Workers.clear();
+}
+
+int Client::Open(const std::string& path)
+{
+  int fd = OpenDevice(path, Options.baudRate);
+  if (fd < 0)
+    return -1;
+
+  std::lock_guard<std::mutex> guard(TowersLock);
+  Worker* worker = Workers[Towers.size() % Workers.size()].get();   // Round robin over the pool
+  Towers.emplace_back(worker, worker->Add(fd));
+  return static_cast<int>(Towers.size() - 1);
+}
+
+bool Client::Submit(int tower, const Request& request, Callback callback)
+{
+  std::pair<Worker*, int> target;
+  {
+    std::lock_guard<std::mutex> guard(TowersLock);
+    if (tower < 0 || static_cast<std::size_t>(tower) >= Towers.size())
+      return false;
+    target = Towers[tower];
+  }
+
+  target.first->Submit(target.second, request, std::move(callback));
+  return true;
+}
+
+void Client::Drain()
+{
+  Tracker& tracker = *Outstanding;
+  std::unique_lock<std::mutex> guard(tracker.Lock);
+  tracker.Idle.wait(guard, [&tracker] { return tracker.Outstanding == 0; });
+}
+
+std::size_t Client::NbTowers() const
+{
+  std::lock_guard<std::mutex> guard(TowersLock);
+  return Towers.size();
+}
+
+ClientStats Client::Stats() const
+{
+  ClientStats stats = {};
+  for (const auto& worker : Workers)
+    worker->AddStats(stats);
+  return stats;
+}
+
+} // namespace tower
@@ -0,0 +1,157 @@
+/*! @file
+ *
+ *  @brief Asynchronous, pipelined client for the tower serial protocol.
+ *
+ *  A Client owns a pool of worker threads. Each worker runs an epoll loop over the non-blocking
+ *  serial ports (or ptys) assigned to it, keeps up to "window" requests in flight per tower,
+ *  matches replies in order and retries requests that time out.
+ *
+ *  Build (Linux, not part of the firmware build):
+ *    g++ -std=c++17 -O2 -Wall -Wextra -pthread -o tower_client TowerClient.cpp main.cpp
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-06-28
+ */
+
+#ifndef TOWER_CLIENT_H
+#define TOWER_CLIENT_H
+
+#include "Packet.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tower
+{
+
+/*! @brief A request and the number of data packets the tower answers it with.
+ *
+ *  The ACK bit is always set, so every request is completed by the tower's ACK or NACK.
+ */
+struct Request
+{
+  Packet packet;
+  std::size_t nbReplies;
+
+  static Request Startup();
+  static Request ProgramByte(uint8_t offset, uint8_t value);
+  static Request EraseFlash();
+  static Request ReadByte(uint8_t offset);
+  static Request GetTimingMode();
+  static Request SetTimingMode(uint8_t mode);
+  static Request GetNbRaises();
+  static Request ResetNbRaises();
+  static Request GetNbLowers();
+  static Request ResetNbLowers();
+  static Request GetFrequency();
+  static Request GetVoltage(uint8_t channel);
+  static Request GetSpectrum(uint8_t harmonic);
+  static Request GetEvents(uint16_t first, uint8_t count);
+};
+
+/*! @brief The outcome of a request.
+ *
+ */
+struct Response
+{
+  enum class Status
+  {
+    Ack,        /*!< The tower acknowledged the command */
+    Nack,       /*!< The tower rejected the command */
+    Timeout     /*!< No reply after all the retries */
+  };
+
+  Status status;
+  std::vector<Packet> replies;            /*!< Data packets received before the ACK/NACK */
+  unsigned attempts;                      /*!< Number of times the request was sent */
+  std::chrono::microseconds latency;      /*!< Time from the last send to completion */
+};
+
+using Callback = std::function<void(const Request&, const Response&)>;
+
+/*! @brief Tuning parameters of a Client.
+ *
+ */
+struct ClientOptions
+{
+  unsigned nbThreads = 1;                                   /*!< Worker threads, each with its own epoll loop */
+  std::size_t window = 4;                                   /*!< Requests in flight per tower, the tower queues 4 frames */
+  std::chrono::milliseconds timeout{200};                   /*!< Time to wait for the ACK/NACK */
+  unsigned retries = 2;                                     /*!< Resends before reporting a timeout */
+  uint32_t baudRate = 115200;
+};
+
+/*! @brief Counters accumulated over all the towers of a Client.
+ *
+ */
+struct ClientStats
+{
+  uint64_t sent;
+  uint64_t acked;
+  uint64_t nacked;
+  uint64_t timeouts;
+  uint64_t retries;
+  uint64_t unsolicited;
+  uint64_t discardedBytes;
+};
+
+class Worker;
+struct Tracker;
+
+/*! @brief Polls any number of towers concurrently.
+ *
+ */
+class Client
+{
+public:
+  explicit Client(const ClientOptions& options = ClientOptions());
+  ~Client();
+
+  Client(const Client&) = delete;
+  Client& operator=(const Client&) = delete;
+
+  /*! @brief Opens a serial port or pty and assigns it to a worker. Safe to call from any thread.
+   *
+   *  @param path The device path, e.g. /dev/ttyUSB0 or /dev/pts/3.
+   *  @return int - The tower handle, or -1 if the device could not be opened.
+   */
+  int Open(const std::string& path);
+
+  /*! @brief Queues a request for a tower. Safe to call from any thread, including callbacks.
+   *
+   *  @param tower The handle returned by Open.
+   *  @param request The request to send.
+   *  @param callback Called from the tower's worker thread when the request completes.
+   *  @return bool - true if the tower handle is valid.
+   */
+  bool Submit(int tower, const Request& request, Callback callback);
+
+  /*! @brief Blocks until every submitted request has completed.
+   *
+   */
+  void Drain();
+
+  /*! @brief Returns the number of towers opened.
+   *
+   */
+  std::size_t NbTowers() const;
+
+  ClientStats Stats() const;
+
+private:
+  ClientOptions Options;
+  std::unique_ptr<Tracker> Outstanding;          /*!< Declared before Workers so it outlives them */
+  std::vector<std::unique_ptr<Worker>> Workers;
+  mutable std::mutex TowersLock;                 /*!< Guards Towers, Open may race Submit */
+  std::vector<std::pair<Worker*, int>> Towers;   /*!< Worker and its local index for each handle */
+};
+
+} // namespace tower
+
+#endif
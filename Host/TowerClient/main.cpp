@@ -0,0 +1,314 @@
+/*! @file
+ *
+ *  @brief Command line front end of the tower client.
+ *
+ *  tower_client [options] command [args] -- device...
+ *    Commands:
+ *      startup | timing [mode] | raises [reset] | lowers [reset]
+ *      frequency | voltage <1..3> | spectrum <0..63> | read <0..7> | program <0..7> <value> | erase
+ *      events <first> <count>   Reads up to 8 events of the log, 0 being the oldest.
+ *      poll <rounds>     Reads the three voltages and the frequency of every tower, <rounds> times.
+ *      load <seconds>    Keeps every tower's pipeline full of read commands and reports throughput.
+ *    Options:
+ *      -t threads  -w window  -T timeout_ms  -r retries  -b baud
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-06-28
+ */
+
+#include "TowerClient.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+using namespace tower;
+
+static const double TOWER_CLOCK_HZ = 25000000.0;   // Bus clock of the tower, the unit of its Time_Now64 stamps
+
+/*! @brief Converts a unit/hundredths pair, as sent by the tower, to a value.
+ *
+ */
+static double Fixed(uint8_t unit, uint8_t decimal)
+{
+  return unit + decimal / 100.0;
+}
+
+static const char* StatusName(Response::Status status)
+{
+  switch (status)
+  {
+    case Response::Status::Ack:  return "ACK";
+    case Response::Status::Nack: return "NACK";
+    default:                     return "TIMEOUT";
+  }
+}
+
+/*! @brief Prints a page of the event log: a header packet, then 4 packets of packed bytes per event.
+ *
+ *  An event is stamped with the 56-bit Time_Now64 of the tower, or with its OS ticks when the top 3 bytes are 0xFF.
+ */
+static void PrintEvents(const std::vector<Packet>& replies)
+{
+  static const char* const names[] = {"alarm on", "alarm off", "raise", "lower", "swell", "sag", "sag/swell end"};
+  const unsigned nbNames = sizeof(names) / sizeof(names[0]);
+
+  std::printf(" %u of %u events", replies[0].parameter1, replies[0].parameter2 | (replies[0].parameter3 << 8));
+
+  for (std::size_t i = 1; i + 3 < replies.size(); i += 4)
+  {
+    uint8_t b[12];
+    for (std::size_t j = 0; j < 4; j++)
+    {
+      b[3 * j]     = replies[i + j].parameter1;
+      b[3 * j + 1] = replies[i + j].parameter2;
+      b[3 * j + 2] = replies[i + j].parameter3;
+    }
+
+    uint64_t time = b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<uint64_t>(b[3]) << 24);
+    unsigned type = b[4] >> 4;
+    if (b[9] == 0xFF && b[10] == 0xFF && b[11] == 0xFF)
+      std::printf("\n  t=%llu ticks", static_cast<unsigned long long>(time));
+    else
+    {
+      time |= (static_cast<uint64_t>(b[9]) << 32) | (static_cast<uint64_t>(b[10]) << 40) | (static_cast<uint64_t>(b[11]) << 48);
+      std::printf("\n  t=%.6fs", time / TOWER_CLOCK_HZ);
+    }
+    std::printf(" ch%u %-13s rms=%umV dev=%umV", b[4] & 0x0F, type < nbNames ? names[type] : "?",
+                b[5] | (b[6] << 8), b[7] | (b[8] << 8));
+  }
+}
+
+/*! @brief Prints the data a tower returned for a command.
+ *
+ */
+static void Print(const std::string& device, const Response& response)
+{
+  std::printf("%s: %-7s", device.c_str(), StatusName(response.status));
+
+  if (!response.replies.empty() && response.replies[0].command == EVENT_LOG_COMMAND)
+  {
+    PrintEvents(response.replies);
+    std::printf(" (%u tries, %lld us)\n", response.attempts, static_cast<long long>(response.latency.count()));
+    return;
+  }
+
+  for (const Packet& reply : response.replies)
+  {
+    switch (reply.command)
+    {
+      case VOLTAGE_COMMAND:
+        std::printf(" V%u=%.2f", reply.parameter1, Fixed(reply.parameter2, reply.parameter3));
+        break;
+      case FREQUENCY_COMMAND:
+        std::printf(" f=%.2fHz", Fixed(reply.parameter1, reply.parameter2));
+        break;
+      case SPECTRUM_COMMAND:
+        std::printf(" H%u=%.2f", reply.parameter1, Fixed(reply.parameter2, reply.parameter3));
+        break;
+      case READ_BYTE_COMMAND:
+        std::printf(" [%u]=0x%02X", reply.parameter1, reply.parameter3);
+        break;
+      default:
+        std::printf(" %02X %02X %02X %02X", reply.command, reply.parameter1, reply.parameter2, reply.parameter3);
+        break;
+    }
+  }
+  std::printf(" (%u tries, %lld us)\n", response.attempts, static_cast<long long>(response.latency.count()));
+}
+
+/*! @brief Parses a single command into a request.
+ *
+ *  @return bool - false if the command is unknown or its arguments are invalid.
+ */
+static bool ParseCommand(int argc, char** argv, Request& request)
+{
+  if (argc < 1)
+    return false;
+
+  std::string name = argv[0];
+  int arg1 = argc > 1 ? std::atoi(argv[1]) : -1;
+  int arg2 = argc > 2 ? std::atoi(argv[2]) : -1;
+
+  if (name == "startup")
+    request = Request::Startup();
+  else if (name == "timing")
+    request = arg1 < 0 ? Request::GetTimingMode() : Request::SetTimingMode(static_cast<uint8_t>(arg1));
+  else if (name == "raises")
+    request = argc > 1 ? Request::ResetNbRaises() : Request::GetNbRaises();
+  else if (name == "lowers")
+    request = argc > 1 ? Request::ResetNbLowers() : Request::GetNbLowers();
+  else if (name == "frequency")
+    request = Request::GetFrequency();
+  else if (name == "voltage" && arg1 >= 1 && arg1 <= 3)
+    request = Request::GetVoltage(static_cast<uint8_t>(arg1));
+  else if (name == "spectrum" && arg1 >= 0 && arg1 <= SPECTRUM_MAX_HARMONIC)
+    request = Request::GetSpectrum(static_cast<uint8_t>(arg1));
+  else if (name == "read" && arg1 >= 0 && arg1 <= 7)
+    request = Request::ReadByte(static_cast<uint8_t>(arg1));
+  else if (name == "program" && arg1 >= 0 && arg1 <= 7 && arg2 >= 0 && arg2 <= 0xFF)
+    request = Request::ProgramByte(static_cast<uint8_t>(arg1), static_cast<uint8_t>(arg2));
+  else if (name == "erase")
+    request = Request::EraseFlash();
+  else if (name == "events" && arg1 >= 0 && arg1 <= 0xFFFF && arg2 >= 1 && arg2 <= EVENT_LOG_PAGE_SIZE)
+    request = Request::GetEvents(static_cast<uint16_t>(arg1), static_cast<uint8_t>(arg2));
+  else
+    return false;
+
+  return true;
+}
+
+/*! @brief Generates load: every tower always has "window" read requests outstanding.
+ *
+ */
+static void RunLoad(Client& client, const std::vector<std::string>& devices, std::size_t window, double seconds)
+{
+  static const Request mix[] =
+  {
+    Request::GetVoltage(1), Request::GetVoltage(2), Request::GetVoltage(3),
+    Request::GetFrequency(), Request::GetTimingMode(), Request::GetNbRaises(),
+    Request::GetNbLowers(), Request::GetSpectrum(1)
+  };
+  const std::size_t nbMix = sizeof(mix) / sizeof(mix[0]);
+
+  auto end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+  std::mutex lock;
+  std::vector<long long> latencies;
+
+  std::function<void(int, std::size_t)> issue = [&](int tower, std::size_t next)
+  {
+    client.Submit(tower, mix[next % nbMix], [&, tower, next](const Request&, const Response& response)
+    {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        latencies.push_back(response.latency.count());
+      }
+      if (std::chrono::steady_clock::now() < end)
+        issue(tower, next + window);   // Keep the pipeline full
+    });
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t tower = 0; tower < devices.size(); tower++)
+    for (std::size_t i = 0; i < window; i++)
+      issue(static_cast<int>(tower), i);
+  client.Drain();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) -> long long
+  {
+    if (latencies.empty())
+      return 0;
+    return latencies[std::min(latencies.size() - 1, static_cast<std::size_t>(p * latencies.size()))];
+  };
+
+  ClientStats stats = client.Stats();
+  std::printf("towers %zu  completed %zu in %.2f s  -> %.1f cmd/s\n", devices.size(), latencies.size(), elapsed, latencies.size() / elapsed);
+  std::printf("latency us  p50 %lld  p90 %lld  p99 %lld  max %lld\n", percentile(0.50), percentile(0.90), percentile(0.99), percentile(1.0));
+  std::printf("sent %llu  ack %llu  nack %llu  timeout %llu  retries %llu  unsolicited %llu  resync bytes %llu\n",
+              (unsigned long long)stats.sent, (unsigned long long)stats.acked, (unsigned long long)stats.nacked,
+              (unsigned long long)stats.timeouts, (unsigned long long)stats.retries,
+              (unsigned long long)stats.unsolicited, (unsigned long long)stats.discardedBytes);
+}
+
+static int Usage(const char* program)
+{
+  std::fprintf(stderr,
+               "usage: %s [-t threads] [-w window] [-T timeout_ms] [-r retries] [-b baud] command [args] -- device...\n"
+               "  commands: startup, timing [mode], raises [reset], lowers [reset], frequency, voltage <1-3>,\n"
+               "            spectrum <0-7>, read <0-7>, program <0-7> <value>, erase, events <first> <count>,\n"
+               "            poll <rounds>, load <seconds>\n",
+               program);
+  return 2;
+}
+
+int main(int argc, char** argv)
+{
+  ClientOptions options;
+  int i = 1;
+
+  for (; i < argc && argv[i][0] == '-' && std::strcmp(argv[i], "--") != 0; i += 2)
+  {
+    if (i + 1 >= argc)
+      return Usage(argv[0]);
+    int value = std::atoi(argv[i + 1]);
+    switch (argv[i][1])
+    {
+      case 't': options.nbThreads = static_cast<unsigned>(std::max(1, value)); break;
+      case 'w': options.window = static_cast<std::size_t>(std::max(1, value)); break;
+      case 'T': options.timeout = std::chrono::milliseconds(std::max(1, value)); break;
+      case 'r': options.retries = static_cast<unsigned>(std::max(0, value)); break;
+      case 'b': options.baudRate = static_cast<uint32_t>(value); break;
+      default:  return Usage(argv[0]);
+    }
+  }
+
+  int commandStart = i;
+  while (i < argc && std::strcmp(argv[i], "--") != 0)
+    i++;
+  int commandArgc = i - commandStart;
+  if (commandArgc < 1 || i >= argc - 1)
+    return Usage(argv[0]);
+
+  Client client(options);
+  std::vector<std::string> devices;
+  for (i++; i < argc; i++)
+  {
+    if (client.Open(argv[i]) < 0)
+    {
+      std::perror(argv[i]);
+      return 1;
+    }
+    devices.push_back(argv[i]);
+  }
+
+  std::string command = argv[commandStart];
+  std::mutex printLock;
+  auto printer = [&printLock](const std::string& device)
+  {
+    return [&printLock, device](const Request&, const Response& response)
+    {
+      std::lock_guard<std::mutex> guard(printLock);
+      Print(device, response);
+    };
+  };
+
+  if (command == "load")
+  {
+    double seconds = commandArgc > 1 ? std::atof(argv[commandStart + 1]) : 10.0;
+    RunLoad(client, devices, options.window, seconds);
+    return 0;
+  }
+
+  if (command == "poll")
+  {
+    int rounds = commandArgc > 1 ? std::atoi(argv[commandStart + 1]) : 1;
+    for (int round = 0; round < rounds; round++)
+    {
+      for (std::size_t tower = 0; tower < devices.size(); tower++)
+      {
+        client.Submit(static_cast<int>(tower), Request::GetVoltage(1), printer(devices[tower]));
+        client.Submit(static_cast<int>(tower), Request::GetVoltage(2), printer(devices[tower]));
+        client.Submit(static_cast<int>(tower), Request::GetVoltage(3), printer(devices[tower]));
+        client.Submit(static_cast<int>(tower), Request::GetFrequency(), printer(devices[tower]));
+      }
+      client.Drain();
+    }
+    return 0;
+  }
+
+  Request request;
+  if (!ParseCommand(commandArgc, argv + commandStart, request))
+    return Usage(argv[0]);
+
+  for (std::size_t tower = 0; tower < devices.size(); tower++)
+    client.Submit(static_cast<int>(tower), request, printer(devices[tower]));
+  client.Drain();
+
+  ClientStats stats = client.Stats();
+  return (stats.timeouts || stats.nacked) ? 1 : 0;
+}
@@ -0,0 +1,35 @@
+/*! @file
+ *
+ *  @brief Routines to calculate cyclic redundancy checks.
+ *
+ *  This contains the CRC-8 of the packet frame check and the CRC-16 of the flash log records.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-06-30
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+// new types
+#include "types.h"
+
+/*! @brief Calculates the CRC-8 (polynomial x^8 + x^2 + x + 1) of some bytes, one table lookup per byte.
+ *
+ *  @param crc The initial value, or the CRC of the preceding bytes to continue a calculation.
+ *  @param data The bytes.
+ *  @param nbBytes The number of bytes.
+ *  @return uint8_t - The CRC-8.
+ */
+uint8_t CRC_8(uint8_t crc, const uint8_t data[], const uint16_t nbBytes);
+
+/*! @brief Calculates the CRC-16 (CCITT polynomial x^16 + x^12 + x^5 + 1) of some bytes, one table lookup per byte.
+ *
+ *  @param crc The initial value, or the CRC of the preceding bytes to continue a calculation.
+ *  @param data The bytes.
+ *  @param nbBytes The number of bytes.
+ *  @return uint16_t - The CRC-16.
+ */
+uint16_t CRC_16(uint16_t crc, const uint8_t data[], const uint16_t nbBytes);
+
+#endif
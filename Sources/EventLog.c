@@ -0,0 +1,238 @@
+/*! @file
+ *
+ *  @brief Routines for the persistent log of alarm, raise and lower events.
+ *
+ *  The log is a ring of EVENTLOG_NB_SECTORS sectors holding 16-byte events. Every event carries a
+ *  sequence number and a CRC-8, so at start-up the end of the ring is the valid event with the
+ *  highest sequence number. A sector is erased just before the ring wraps into it.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-06-30
+ */
+
+#include "EventLog.h"
+#include "Flash.h"
+#include "CRC.h"
+#include "Time.h"
+#include "OS.h"
+#include <stddef.h>
+
+#define EVENT_SIZE sizeof(TEvent)
+#define EVENTS_PER_SECTOR (FLASH_SECTOR_SIZE / EVENT_SIZE)
+#define EVENTLOG_NB_EVENTS (EVENTLOG_NB_SECTORS * EVENTS_PER_SECTOR)
+#define EVENT_ADDRESS(slot) (FLASH_FREE_START + (uint32_t) (slot) * EVENT_SIZE)
+
+static TEvent Staging[EVENTLOG_STAGING_SIZE];   //Events waiting for EventLog_Thread
+static uint8_t StagingStart;                    //Index of the oldest staged event
+static volatile uint8_t NbStaged;               //Number of staged events
+static uint16_t Sequence;                       //Sequence number of the next event
+static uint32_t NbDropped;                      //Events lost because the staging buffer was full
+
+static uint64_t Batch[EVENTLOG_STAGING_SIZE * EVENT_SIZE / sizeof(uint64_t)]; //Events being programmed, as phrases
+
+static uint16_t Head;                           //Slot of the next event in flash
+static uint16_t NbStored;                       //Number of events in flash
+
+static OS_ECB *LogAccess;                       //Guards Head and NbStored
+static OS_ECB *DrainRequest;                    //Wakes EventLog_Thread
+
+/*! @brief Calculates the check byte of an event.
+ *
+ *  @param event The event, its check byte is ignored.
+ *  @return uint8_t - The CRC-8 of the other bytes.
+ */
+static uint8_t EventCheck(const TEvent * const event)
+{
+  return CRC_8(0xFF, (const uint8_t *) event, EVENT_SIZE - 1);
+}
+
+/*! @brief Reads an event slot of the flash ring.
+ *
+ *  @param slot The slot.
+ *  @return const TEvent * - The event, or NULL if the slot is erased or damaged.
+ */
+static const TEvent * StoredEvent(const uint16_t slot)
+{
+  const TEvent *event = (const TEvent *) EVENT_ADDRESS(slot);
+
+  if (event->type == 0xFF || event->check != EventCheck(event))
+    return NULL;
+
+  return event;
+}
+
+/*! @brief Programs the staged events, one batch per call.
+ *
+ *  @return bool - TRUE if events are left to program.
+ */
+static bool Drain()
+{
+  OS_DisableInterrupts();
+  uint8_t start = StagingStart;
+  uint8_t nbEvents = NbStaged;
+  OS_EnableInterrupts();
+
+  if (nbEvents == 0)
+    return false;
+
+  if (nbEvents > EVENTLOG_STAGING_SIZE - start)
+    nbEvents = EVENTLOG_STAGING_SIZE - start;                  //Up to the end of the staging ring
+  if (nbEvents > EVENTS_PER_SECTOR - Head % EVENTS_PER_SECTOR)
+    nbEvents = EVENTS_PER_SECTOR - Head % EVENTS_PER_SECTOR;   //Up to the end of the sector
+
+  if (Head % EVENTS_PER_SECTOR == 0)
+  {
+    OS_SemaphoreWait(LogAccess, 0);
+    if (NbStored > EVENTLOG_NB_EVENTS - EVENTS_PER_SECTOR)
+      NbStored = EVENTLOG_NB_EVENTS - EVENTS_PER_SECTOR;       //The oldest sector goes, EventLog_Get no longer reads it
+    OS_SemaphoreSignal(LogAccess);
+
+    if (!Flash_EraseSector(EVENT_ADDRESS(Head)))
+      return false;                                            //Retried with the next event
+  }
+
+  TEvent *events = (TEvent *) Batch;
+  for (uint8_t i = 0; i < nbEvents; i++)
+    events[i] = Staging[start + i];
+
+  if (!Flash_Program(EVENT_ADDRESS(Head), Batch, nbEvents * EVENT_SIZE / sizeof(uint64_t)))
+    return false;
+
+  OS_SemaphoreWait(LogAccess, 0);
+  Head = (Head + nbEvents) % EVENTLOG_NB_EVENTS;
+  NbStored += nbEvents;
+  OS_SemaphoreSignal(LogAccess);
+
+  OS_DisableInterrupts();
+  StagingStart = (start + nbEvents) % EVENTLOG_STAGING_SIZE;
+  NbStaged -= nbEvents;
+  OS_EnableInterrupts();
+
+  return true;
+}
+
+bool EventLog_Init(void)
+{
+  LogAccess = OS_SemaphoreCreate(1);
+  DrainRequest = OS_SemaphoreCreate(0);
+
+  bool found = false;
+  uint16_t last = 0;
+
+  //The newest event has the highest sequence number, allowing it to wrap
+  for (uint16_t slot = 0; slot < EVENTLOG_NB_EVENTS; slot++)
+  {
+    const TEvent *event = StoredEvent(slot);
+
+    if (event && (!found || (int16_t) (event->sequence - Sequence) > 0))
+    {
+      last = slot;
+      Sequence = event->sequence;
+      found = true;
+    }
+  }
+
+  Head = 0;
+  NbStored = 0;
+
+  if (!found)
+  {
+    Sequence = 0;
+    return true;
+  }
+
+  //Count back the run of consecutive events ending with the newest
+  Head = (last + 1) % EVENTLOG_NB_EVENTS;
+  NbStored = 1;
+  for (uint16_t slot = last; NbStored < EVENTLOG_NB_EVENTS; NbStored++)
+  {
+    uint16_t previous = (slot + EVENTLOG_NB_EVENTS - 1) % EVENTLOG_NB_EVENTS;
+    const TEvent *event = StoredEvent(previous);
+
+    if (!event || event->sequence != (uint16_t) (StoredEvent(slot)->sequence - 1))
+      break;
+    slot = previous;
+  }
+
+  Sequence++;
+  return true;
+}
+
+bool EventLog_Put(const TEventType type, const uint8_t channel, const double rms, const double deviation)
+{
+  TEvent event;
+
+  uint64_t time = Time_Now64();
+
+  event.time = time;
+  event.timeHi[0] = time >> 32;
+  event.timeHi[1] = time >> 40;
+  event.timeHi[2] = time >> 48;
+  event.type = type;
+  event.channel = channel;
+  event.rms = (rms <= 0.0) ? 0 : (rms >= 65.535) ? 0xFFFF : (uint16_t) (rms * 1000.0);
+  event.deviation = (deviation <= 0.0) ? 0 : (deviation >= 65.535) ? 0xFFFF : (uint16_t) (deviation * 1000.0);
+
+  OS_DisableInterrupts();
+
+  if (NbStaged == EVENTLOG_STAGING_SIZE)
+  {
+    NbDropped++;
+    OS_EnableInterrupts();
+    return false;
+  }
+
+  event.sequence = Sequence++;
+  event.check = EventCheck(&event);
+  Staging[(StagingStart + NbStaged) % EVENTLOG_STAGING_SIZE] = event;
+  bool signal = (NbStaged++ == 0);
+
+  OS_EnableInterrupts();
+
+  if (signal)
+    OS_SemaphoreSignal(DrainRequest);
+
+  return true;
+}
+
+uint32_t EventLog_Dropped(void)
+{
+  return NbDropped;
+}
+
+uint16_t EventLog_Count(void)
+{
+  return NbStored;
+}
+
+bool EventLog_Get(const uint16_t index, TEvent * const event)
+{
+  bool success = false;
+
+  OS_SemaphoreWait(LogAccess, 0);
+
+  if (index < NbStored)
+  {
+    uint16_t slot = (Head + EVENTLOG_NB_EVENTS - NbStored + index) % EVENTLOG_NB_EVENTS;
+    success = Flash_Read(EVENT_ADDRESS(slot), event, EVENT_SIZE);  //Not while Drain erases or programs
+  }
+
+  OS_SemaphoreSignal(LogAccess);
+
+  return success;
+}
+
+void EventLog_Thread(void* data)
+{
+  (void) data;
+
+  for (;;)
+  {
+    OS_SemaphoreWait(DrainRequest, 0);
+    do
+    {
+      OS_TimeDelay(EVENTLOG_DRAIN_DELAY);         //Let the rest of the burst be staged
+      while (Drain());
+    } while (NbStaged);                           //A failed erase or program is retried after the next delay
+  }
+}
@@ -0,0 +1,103 @@
+/*! @file
+ *
+ *  @brief Routines for the persistent log of alarm, raise and lower events.
+ *
+ *  Events are staged in RAM by EventLog_Put, which never waits on the flash, and appended in
+ *  batches to a ring of flash sectors by EventLog_Thread.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-06-30
+ */
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+// new types
+#include "types.h"
+
+// Number of flash sectors of the ring, from FLASH_FREE_START. The oldest sector is erased when the ring is full
+#define EVENTLOG_NB_SECTORS 4
+// Number of events that can wait in RAM for EventLog_Thread
+#define EVENTLOG_STAGING_SIZE 16
+// OS ticks EventLog_Thread waits after the first staged event, so a burst of events is programmed at once
+#define EVENTLOG_DRAIN_DELAY 50
+
+/*!
+ * @enum TEventType
+ * @brief The events that are logged.
+ */
+typedef enum
+{
+  EVENT_ALARM_SET,          /*!< A channel went out of its thresholds */
+  EVENT_ALARM_CLEAR,        /*!< A channel came back within its thresholds */
+  EVENT_RAISE,              /*!< A raise was triggered */
+  EVENT_LOWER,              /*!< A lower was triggered */
+  EVENT_SWELL,              /*!< The RMS of a channel over the last half cycle went above its threshold */
+  EVENT_SAG,                /*!< The RMS of a channel over the last half cycle went below its threshold */
+  EVENT_SAG_SWELL_END       /*!< The RMS of a channel over the last half cycle came back within its thresholds */
+} TEventType;
+
+/*!
+ * @struct TEvent
+ * @brief A logged event, two flash phrases.
+ */
+typedef struct
+{
+  uint32_t time;            /*!< Time_Now64 when the event was logged, bits 0 to 31 */
+  uint16_t sequence;        /*!< Incremented with every event */
+  uint8_t type;             /*!< TEventType */
+  uint8_t channel;          /*!< Analog channel the event is about */
+  uint16_t rms;             /*!< RMS of the channel, in mV */
+  uint16_t deviation;       /*!< Deviation of the RMS from the threshold, in mV */
+  uint8_t timeHi[3];        /*!< Time_Now64 when the event was logged, bits 32 to 55; all 0xFF for an event stamped with OS_TimeGet */
+  uint8_t check;            /*!< CRC-8 of the other 15 bytes */
+} TEvent;
+
+/*! @brief Finds the end of the log in flash.
+ *
+ *  @return bool - TRUE if the log was set up successfully.
+ *  @note Reads the flash directly, so it must be called before Flash_Init, while no flash command can run.
+ */
+bool EventLog_Init(void);
+
+/*! @brief Stages an event for the log. Never waits for the flash.
+ *
+ *  @param type The event.
+ *  @param channel The analog channel the event is about.
+ *  @param rms The RMS of the channel, in V.
+ *  @param deviation The deviation of the RMS from the threshold, in V.
+ *  @return bool - TRUE if the event was staged, FALSE if the staging buffer is full and the event dropped.
+ *  @note Assumes EventLog_Init has been called.
+ */
+bool EventLog_Put(const TEventType type, const uint8_t channel, const double rms, const double deviation);
+
+/*! @brief Returns the number of events dropped because the staging buffer was full.
+ *
+ *  @return uint32_t - The number of events dropped since reset.
+ */
+uint32_t EventLog_Dropped(void);
+
+/*! @brief Returns the number of events in the flash log.
+ *
+ *  @return uint16_t - The number of events that can be read with EventLog_Get.
+ *  @note Assumes EventLog_Init has been called.
+ */
+uint16_t EventLog_Count(void);
+
+/*! @brief Reads an event from the flash log.
+ *
+ *  @param index The index of the event, 0 being the oldest.
+ *  @param event The event read.
+ *  @return bool - TRUE if there is an event at that index.
+ *  @note Assumes EventLog_Init has been called.
+ */
+bool EventLog_Get(const uint16_t index, TEvent * const event);
+
+/*! @brief The thread which appends the staged events to the flash log.
+ *
+ *  @param data Unused.
+ *  @note Assumes EventLog_Init has been called.
+ */
+void EventLog_Thread(void* data);
+
+#endif
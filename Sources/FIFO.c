@@ -9,43 +9,95 @@
  */
 #include "FIFO.h"
 
+/*! @brief Wakes the threads waiting on one side of the FIFO.
+ *
+ *  @param semaphore The semaphore they wait on.
+ *  @param nbWaiting The number of threads waiting, taken from the FIFO with BufferAccess held.
+ */
+static void Wake(OS_ECB * const semaphore, uint8_t nbWaiting)
+{
+  while (nbWaiting-- > 0)
+    OS_SemaphoreSignal(semaphore);
+}
+
 void FIFO_Init(TFIFO * const FIFO)
 {
   FIFO->BufferAccess = OS_SemaphoreCreate(1);
-  FIFO->SpaceAvailable = OS_SemaphoreCreate(FIFO_SIZE);
+  FIFO->SpaceAvailable = OS_SemaphoreCreate(0);
   FIFO->ItemsAvailable = OS_SemaphoreCreate(0);
 
   FIFO->Start = 0;
   FIFO->End = 0;
   FIFO->NbBytes = 0;
+  FIFO->SpaceWanted = 0;
+  FIFO->NbPutWaiting = 0;
+  FIFO->NbGetWaiting = 0;
 }
 
 bool FIFO_Put(TFIFO * const FIFO, const uint8_t data)
 {
-  OS_SemaphoreWait(FIFO->SpaceAvailable, 0);          //Wait until there is space available
+  return FIFO_PutBlock(FIFO, &data, 1);
+}
+
+bool FIFO_PutBlock(TFIFO * const FIFO, const uint8_t data[], const uint16_t nbBytes)
+{
+  if (nbBytes > FIFO_SIZE)
+    return false;
+
   OS_SemaphoreWait(FIFO->BufferAccess, 0);            //Wait for exclusive buffer acces
 
-  FIFO->NbBytes++;
-  FIFO->Buffer[FIFO->End] = data;
-  FIFO->End = (FIFO->End +1) % FIFO_SIZE;             // Cycle to the beginning if we reached the end
+  while (FIFO_SIZE - FIFO->NbBytes < nbBytes)         //Reserve the space for the whole block at once
+  {
+    if (nbBytes > FIFO->SpaceWanted)
+      FIFO->SpaceWanted = nbBytes;                    //FIFO_Get wakes the putters once this much is free
+    FIFO->NbPutWaiting++;
+    OS_SemaphoreSignal(FIFO->BufferAccess);
+    OS_SemaphoreWait(FIFO->SpaceAvailable, 0);
+    OS_SemaphoreWait(FIFO->BufferAccess, 0);
+  }
+
+  for (uint16_t i = 0; i < nbBytes; i++)
+  {
+    FIFO->Buffer[FIFO->End] = data[i];
+    FIFO->End = (FIFO->End +1) % FIFO_SIZE;           // Cycle to the beginning if we reached the end
+  }
+  FIFO->NbBytes += nbBytes;
+
+  uint8_t nbGetters = FIFO->NbGetWaiting;
+  FIFO->NbGetWaiting = 0;
 
   OS_SemaphoreSignal(FIFO->BufferAccess);             //Frees the acces to the buffer
-  OS_SemaphoreSignal(FIFO->ItemsAvailable);           //Increments number of available items in buffer
+  Wake(FIFO->ItemsAvailable, nbGetters);              //One signal per waiting getter for the whole block
 
   return true;
 }
 
 bool FIFO_Get(TFIFO * const FIFO, uint8_t * const dataPtr)
 {
-  OS_SemaphoreWait(FIFO->ItemsAvailable, 0);      //Wait until there are items available
   OS_SemaphoreWait(FIFO->BufferAccess, 0);        //Wait for exclusive buffer acces
 
+  while (FIFO->NbBytes == 0)                      //Wait until there are items available
+  {
+    FIFO->NbGetWaiting++;
+    OS_SemaphoreSignal(FIFO->BufferAccess);
+    OS_SemaphoreWait(FIFO->ItemsAvailable, 0);
+    OS_SemaphoreWait(FIFO->BufferAccess, 0);
+  }
+
   *dataPtr = FIFO->Buffer[FIFO->Start];
   FIFO->Start = (FIFO->Start +1) % FIFO_SIZE;     // Cycle to the end if we reached the beginning
   FIFO->NbBytes--;
 
+  uint8_t nbPutters = 0;
+  if (FIFO->NbPutWaiting > 0 && FIFO_SIZE - FIFO->NbBytes >= FIFO->SpaceWanted)
+  {
+    nbPutters = FIFO->NbPutWaiting;               //Enough room for the largest block waiting, each putter checks its own
+    FIFO->NbPutWaiting = 0;
+    FIFO->SpaceWanted = 0;
+  }
+
   OS_SemaphoreSignal(FIFO->BufferAccess);         //Frees the acces to the buffer
-  OS_SemaphoreSignal(FIFO->SpaceAvailable);       //Increments number of available spaces in buffer
+  Wake(FIFO->SpaceAvailable, nbPutters);
 
   return true;
 }
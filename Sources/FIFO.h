@@ -28,9 +28,12 @@ typedef struct
   uint16_t End;     		/*!< The index of the next available empty position in the FIFO */
   uint16_t volatile NbBytes;  	/*!< The number of bytes currently stored in the FIFO */
   uint8_t Buffer[FIFO_SIZE];  	/*!< The actual array of bytes to store the data */
-  OS_ECB *BufferAccess;		/*!< Pointer for access to the buffer in FIFO */
-  OS_ECB *SpaceAvailable;	/*!< Pointer for availability of space in FIFO */
-  OS_ECB *ItemsAvailable;	/*!< Pointer for availability of bytes in FIFO */
+  uint16_t SpaceWanted;		/*!< The largest block a putter is waiting to fit */
+  uint8_t NbPutWaiting;		/*!< The number of putters waiting on SpaceAvailable */
+  uint8_t NbGetWaiting;		/*!< The number of getters waiting on ItemsAvailable */
+  OS_ECB *BufferAccess;		/*!< Pointer for access to the buffer in FIFO, and to the counts */
+  OS_ECB *SpaceAvailable;	/*!< Signalled once per waiting putter when SpaceWanted bytes are free */
+  OS_ECB *ItemsAvailable;	/*!< Signalled once per waiting getter when a block is put */
 } TFIFO;
 
 /*! @brief Initialize the FIFO before first use.
@@ -49,6 +52,18 @@ void FIFO_Init(TFIFO * const FIFO);
  */
 bool FIFO_Put(TFIFO * const FIFO, const uint8_t data);
 
+/*! @brief Put a block of characters into the FIFO.
+ *
+ *  The block is stored contiguously, in one access to the buffer, once there is room for all of it.
+ *  Waiting getters are woken once for the whole block.
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param data A pointer to the bytes to store in the FIFO buffer.
+ *  @param nbBytes The number of bytes to store, at most FIFO_SIZE.
+ *  @return bool - TRUE if data is successfully stored in the FIFO.
+ *  @note Assumes that FIFO_Init has been called.
+ */
+bool FIFO_PutBlock(TFIFO * const FIFO, const uint8_t data[], const uint16_t nbBytes);
+
 /*! @brief Get one character from the FIFO.
  *
  *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
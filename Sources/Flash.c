@@ -4,65 +4,172 @@
  *  @brief Routines to implement a Flash HAL
  *
  *  This contains the implementation for modifying (read/write) flash memory
+ *
+ *  The non-volatile variables live in a RAM image. Every write appends a record (one phrase)
+ *  to a log in the active sector, and at start-up the log is replayed into the image, the latest
+ *  record for a byte winning. When the active sector is full, the image is compacted into the
+ *  least erased of the other FLASH_NB_SECTORS sectors, which then becomes the active one.
+ *  The first phrase of a sector is its header: generation and erase count. It is programmed
+ *  last, so an interrupted compaction leaves the previous sector, still intact, as the newest.
+ *  Records and headers carry a CRC-16, so a phrase torn by a reset while it was programmed is not
+ *  taken for a valid one. The single phrase stored at FLASH_DATA_START by older firmware is
+ *  read once into the variables and compacted into a log.
+ *  Writes only update the image and mark their 4-byte chunks dirty in a bitmap. Flash_CommitThread
+ *  waits for a burst of writes to settle, then logs the dirty chunks, so a burst costs one record per
+ *  chunk it touched, however far apart the chunks are.
+ *  A transaction logs its bytes as a chain of records, each but the last flagged RECORD_MORE. A
+ *  chain cut by a reset is dropped at start-up, so the writes of a transaction survive all or none.
+ *  The image starts with the variables of Flash_AllocateVar, ends with a directory of the records
+ *  of Flash_AllocateRecord, and the records are bump allocated in between. The directory is part
+ *  of the image, so a record is found at the same place after a reset.
+ *  A flash command blocks its caller on a semaphore signalled by the FTFE command complete
+ *  interrupt, so the other threads keep running while a sector is erased or a phrase programmed.
+ *  The data sectors lie in program flash block 1 and the code in block 0, which can be read while block 1
+ *  is erased or programmed, so the threads and interrupts that run meanwhile keep fetching from flash,
+ *  including the RTOS. The code that touches the controller while a command runs is also RAMFUNC, so
+ *  it does not depend on that fetch.
  *  Created on: 11 Apr 2018
  *      Author: 13113117, 11989668
  */
 
 #include "Flash.h"
+#include "OS.h"
+#include "CRC.h"
+#define FLASH_CMD_READ_1S_SECTION 0x01LU //Flash command for checking a section is erased
 #define FLASH_CMD_ERASE_SECTOR 0x09LU //Flash command for erasing a sector
-#define FLASH_CMD_PROGRAM_PHRASE 0x07LU //Flash command for erasing a sector
+#define FLASH_CMD_PROGRAM_PHRASE 0x07LU //Flash command for programming a phrase
+
+#define FLASH_PHRASE_SIZE 8                                         //Size of the programming unit, and of a log record
+#define FLASH_LOG_NB_RECORDS (FLASH_SECTOR_SIZE / FLASH_PHRASE_SIZE) //Number of phrases in a sector, the header included
+
+#define SECTOR_ADDRESS(sector) (FLASH_DATA_START + (sector) * FLASH_SECTOR_SIZE)
+
+#define HEADER_TAG 0xC6               //Marks the header of a sector whose records carry a CRC-16
+#define RECORD_MAX_DATA 4             //Bytes of the image carried by one record
+#define RECORD_MORE 0x20              //Set in lengthOffsetHi: more records of the transaction follow
+#define RECORD_OFFSET_HI 0x1F         //Offset bits 12-8 in lengthOffsetHi
+#define MARGIN_USER 0x01              //Read 1s Section at the user margin, so a weakly erased sector fails
+
+#define NB_CHUNKS ((FLASH_SIZE + RECORD_MAX_DATA - 1) / RECORD_MAX_DATA) //Chunks of the image, one record each
+#define DIRECTORY_OFFSET (FLASH_SIZE - FLASH_DIRECTORY_NB_ENTRIES * sizeof(TDirectoryEntry)) //Offset of the directory in the image
+#define DIRECTORY_FREE_ID 0xFF        //Id of an unused directory entry, as erased
+
+#define FLASH_BLOCK_1 0x00080000LU   //Start of program flash block 1, read-while-write with block 0
+
+#if FLASH_DATA_START < FLASH_BLOCK_1
+#error "The code in block 0 would stall while the data sectors are erased or programmed"
+#endif
+
+#if FLASH_NB_SECTORS < 2
+#error "The log needs at least 2 sectors to compact into"
+#endif
 
-static uint8_t AllocationMap[FLASH_SIZE] = {0}; //Map of the allocation space, initialiazed to 0
+#if FLASH_SIZE > (RECORD_OFFSET_HI + 1) * 256
+#error "A record cannot address the whole image"
+#endif
+
+#if FLASH_SIZE / RECORD_MAX_DATA > FLASH_LOG_NB_RECORDS / 2
+#error "A compacted image must leave at least half a sector for new records"
+#endif
+
+/*!
+ * @union TRecord
+ * @brief A log record: up to 4 bytes of the image and where they go, or a sector header.
+ */
+typedef union
+{
+  uint64_t l;
+  uint8_t bytes[FLASH_PHRASE_SIZE];
+  struct
+  {
+    uint8_t checkHi;                  /*!< CRC-16 of the other 6 bytes, bits 15-8 */
+    uint8_t offsetLo;                 /*!< Offset in the image, bits 7-0 */
+    uint8_t lengthOffsetHi;           /*!< Bits 7-6: length - 1, bit 5: RECORD_MORE, bits 4-0: offset bits 12-8 */
+    uint8_t checkLo;                  /*!< CRC-16, bits 7-0 */
+    uint8_t data[RECORD_MAX_DATA];    /*!< The bytes, 0xFF padded */
+  } s;
+  struct
+  {
+    uint8_t tag;                      /*!< HEADER_TAG */
+    uint8_t generationLo;             /*!< Incremented each time a sector becomes the active one */
+    uint8_t generationHi;
+    uint8_t checkLo;                  /*!< CRC-16 of the other 6 bytes, bits 7-0 */
+    uint8_t eraseCount[3];            /*!< Number of times this sector has been erased, little endian */
+    uint8_t checkHi;                  /*!< CRC-16, bits 15-8 */
+  } h;
+} TRecord;
+
+/*!
+ * @struct TDirectoryEntry
+ * @brief Where a record allocated by Flash_AllocateRecord lives in the image.
+ */
+typedef struct
+{
+  uint16_t offset;                    /*!< Offset of the record in the image */
+  uint16_t size;                      /*!< Size of the record in bytes */
+  uint8_t id;                         /*!< Id given by the owner, DIRECTORY_FREE_ID if unused */
+  uint8_t spare;
+} TDirectoryEntry;
+
+static uint8_t Image[FLASH_SIZE] __attribute__ ((aligned(0x08))); //Current value of the non-volatile variables
+static const TDirectoryEntry * const Directory = (const TDirectoryEntry *) &Image[DIRECTORY_OFFSET];
+static uint8_t VariablesEnd;          //Next free byte of the Flash_AllocateVar space
+
+//Offsets of the byte variables in the phrase of older firmware, which left a free byte before each one
+static const uint8_t LEGACY_OFFSETS[] = {1, 3, 5};
+static uint16_t LogPosition;          //Index of the next free phrase in the active sector
+
+static uint8_t ActiveSector;          //Sector holding the log
+static uint16_t Generation;           //Generation of the active sector
+static uint32_t EraseCounts[FLASH_NB_SECTORS]; //Erase count of every sector, from their headers
+static TFlashBoot BootState;          //What Flash_Init found
+
+static uint32_t Dirty[(NB_CHUNKS + 31) / 32]; //Bit n set: chunk n of the image is not yet logged
+static bool CommitPending;            //The commit thread has been signalled
+static bool TransactionOpen;          //The dirty bytes belong to a transaction, only its commit logs them
+
+static OS_ECB *FlashAccess;           //Guards the image, the dirty chunks and the flash controller
+static OS_ECB *CommitRequest;         //Wakes the commit thread
+static OS_ECB *CommandComplete;       //Signalled by FTFE_ISR
+static OS_ECB *Transaction;           //Held by the thread with a transaction open
 
 //Private functions
 
 /*! @brief Waits for the CCIF flag.
  *
  */
-static void WaitCCIF()
+static void RAMFUNC WaitCCIF()
 {
   while (!(FTFE_FSTAT & FTFE_FSTAT_CCIF_MASK));
 }
 
-/*! @brief Sets the CCIF flag.
+/*! @brief Launches the command loaded in the FCCOB registers and blocks until it completes.
  *
+ *  @return bool - TRUE if the command completed without an access or protection error.
  */
-static void SetCCIF()
+static bool RAMFUNC LaunchCommand()
 {
-  FTFE_FSTAT = FTFE_FSTAT_CCIF_MASK;
-  WaitCCIF();
-}
+  FTFE_FSTAT = FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK; //Clear the errors of a previous command (w1c)
+  FTFE_FSTAT = FTFE_FSTAT_CCIF_MASK;                              //Launch the command
+  FTFE_FCNFG |= FTFE_FCNFG_CCIE_MASK;                             //Interrupt once CCIF is set again
+  OS_SemaphoreWait(CommandComplete, 0);
 
-/*! @brief Reads a phrase from flash memory.
- *
- *  @param phrase The address of where to store the read phrase.
- *  @return bool - TRUE if the phrase was read successfully.
- */
-static bool ReadPhrase(uint64_t *const phrase)
-{
-  WaitCCIF();
-  *phrase = _FP(FLASH_DATA_START);
+  return !(FTFE_FSTAT & (FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK | FTFE_FSTAT_MGSTAT0_MASK));
 }
 
-
-
-/*! @brief Writes a phrase from flash memory.
+/*! @brief Programs a phrase into erased flash.
  *
+ *  @param address The address of the phrase, 8-byte aligned.
  *  @param phrase The phrase to be written
  *  @return bool - TRUE if the phrase was written successfully.
  */
-static bool WritePhrase(const uint64_t phrase)
+static bool ProgramPhrase(const uint32_t address, const uint64_t phrase)
 {
-  WaitCCIF();
-
-  if (!Flash_Erase())
-    return false;
-
   uint32_8union_t flashStart;
-  flashStart.l = FLASH_DATA_START;
+  flashStart.l = address;
 
   FTFE_FCCOB0 = FLASH_CMD_PROGRAM_PHRASE;  //Command to write
-  FTFE_FCCOB1 = flashStart.s.Byte2;      //sets the flash address of the correct sector
+  FTFE_FCCOB1 = flashStart.s.Byte2;      //sets the flash address of the phrase
   FTFE_FCCOB2 = flashStart.s.Byte3;
   FTFE_FCCOB3 = flashStart.s.Byte4 & 0xF8;
 
@@ -77,21 +184,429 @@ static bool WritePhrase(const uint64_t phrase)
   FTFE_FCCOBA = data[5];
   FTFE_FCCOBB = data[4];
 
-  //WaitCCIF();
-  SetCCIF();
-  //WaitCCIF();
-  return true; //Check if everything is actually OK
+  return LaunchCommand();
+}
+
+/*! @brief Erases a sector.
+ *
+ *  @param address The address of the sector.
+ *  @return bool - TRUE if the sector was erased successfully.
+ */
+static bool EraseSector(const uint32_t address)
+{
+  uint32_8union_t flashStart;
+  flashStart.l = address;
+
+  FTFE_FCCOB0 = FLASH_CMD_ERASE_SECTOR;  //Command to erase
+  FTFE_FCCOB1 = flashStart.s.Byte2;      //sets the flash address of the correct sector
+  FTFE_FCCOB2 = flashStart.s.Byte3;
+  FTFE_FCCOB3 = flashStart.s.Byte4 & 0xF0;
+
+  return LaunchCommand();
+}
+
+/*! @brief Checks that a sector is erased, reading it at the user margin.
+ *
+ *  @param address The address of the sector.
+ *  @return bool - TRUE if every bit of the sector reads as 1.
+ */
+static bool SectorBlank(const uint32_t address)
+{
+  uint32_8union_t flashStart;
+  flashStart.l = address;
+
+  FTFE_FCCOB0 = FLASH_CMD_READ_1S_SECTION;
+  FTFE_FCCOB1 = flashStart.s.Byte2;
+  FTFE_FCCOB2 = flashStart.s.Byte3;
+  FTFE_FCCOB3 = flashStart.s.Byte4 & 0xF0;
+  FTFE_FCCOB4 = (FLASH_LOG_NB_RECORDS >> 8) & 0xFF; //Number of phrases
+  FTFE_FCCOB5 = FLASH_LOG_NB_RECORDS & 0xFF;
+  FTFE_FCCOB6 = MARGIN_USER;
+
+  return LaunchCommand();                         //MGSTAT0 is set if any bit reads as 0
+}
+
+/*! @brief Calculates the check of a record or header.
+ *
+ *  @param record The record, its check bytes are ignored.
+ *  @param hi The index of the byte holding the check bits 15-8, 0 for a record and 7 for a header.
+ *  @return uint16_t - The CRC-16 of the other 6 bytes.
+ */
+static uint16_t RecordCheck(const TRecord * const record, const uint8_t hi)
+{
+  uint16_t crc = 0xFFFF;
+
+  for (uint8_t i = 0; i < FLASH_PHRASE_SIZE; i++)
+    if (i != 3 && i != hi)
+      crc = CRC_16(crc, &record->bytes[i], 1);
+
+  return crc;
+}
+
+/*! @brief Checks the CRC-16 of a record or header.
+ *
+ *  @param record The record.
+ *  @param hi The index of the byte holding the check bits 15-8.
+ *  @return bool - TRUE if the check matches.
+ */
+static bool RecordChecked(const TRecord * const record, const uint8_t hi)
+{
+  return ((record->bytes[hi] << 8) | record->bytes[3]) == RecordCheck(record, hi);
+}
+
+/*! @brief Reads the header of a sector.
+ *
+ *  @param sector The sector.
+ *  @param generation The generation of the sector.
+ *  @param eraseCount The erase count of the sector.
+ *  @return bool - TRUE if the sector has a valid header.
+ */
+static bool ReadHeader(const uint8_t sector, uint16_t * const generation, uint32_t * const eraseCount)
+{
+  TRecord header;
+  header.l = _FP(SECTOR_ADDRESS(sector));
+
+  if (header.h.tag != HEADER_TAG || !RecordChecked(&header, 7))
+    return false;
+
+  *eraseCount = header.h.eraseCount[0] | (header.h.eraseCount[1] << 8) | ((uint32_t) header.h.eraseCount[2] << 16);
+  *generation = header.h.generationLo | (header.h.generationHi << 8);
+  return true;
+}
+
+/*! @brief Programs the record holding some bytes of the image at the end of the log.
+ *
+ *  @param offset The offset of the first byte in the image.
+ *  @param length The number of bytes, 1 to 4.
+ *  @param more TRUE if more records of the same transaction follow.
+ *  @return bool - TRUE if the record was written successfully.
+ */
+static bool ProgramRecord(const uint16_t offset, const uint8_t length, const bool more)
+{
+  TRecord record;
+  record.l = ~0ULL;
+  record.s.offsetLo = offset & 0xFF;
+  record.s.lengthOffsetHi = ((length - 1) << 6) | (more ? RECORD_MORE : 0) | ((offset >> 8) & RECORD_OFFSET_HI);
+  for (uint8_t i = 0; i < length; i++)
+    record.s.data[i] = Image[offset + i];
+
+  uint16_t check = RecordCheck(&record, 0);
+  record.s.checkHi = check >> 8;
+  record.s.checkLo = check & 0xFF;
+
+  if (!ProgramPhrase(SECTOR_ADDRESS(ActiveSector) + LogPosition * FLASH_PHRASE_SIZE, record.l))
+    return false;
+  LogPosition++;
+
+  return true;
+}
+
+/*! @brief Moves the image, as one record per 4 bytes, into the least erased of the other sectors.
+ *
+ *  @return bool - TRUE if the new sector was erased, written and given its header successfully.
+ */
+static bool Compact()
+{
+  uint8_t target = (ActiveSector + 1) % FLASH_NB_SECTORS;
+
+  for (uint8_t sector = 0; sector < FLASH_NB_SECTORS; sector++)
+    if (sector != ActiveSector && EraseCounts[sector] < EraseCounts[target])
+      target = sector;
+
+  if (!SectorBlank(SECTOR_ADDRESS(target)))      //A blank device needs no erase before its first packet
+  {
+    if (!EraseSector(SECTOR_ADDRESS(target)))
+      return false;
+    EraseCounts[target]++;
+  }
+
+  uint8_t previousSector = ActiveSector;
+  ActiveSector = target;
+  LogPosition = 1;                                //Phrase 0 is left erased for the header
+
+  for (uint16_t offset = 0; offset < FLASH_SIZE; offset += RECORD_MAX_DATA)
+  {
+    uint8_t length = (FLASH_SIZE - offset < RECORD_MAX_DATA) ? FLASH_SIZE - offset : RECORD_MAX_DATA;
+    bool erased = true;
+
+    for (uint8_t i = 0; i < length; i++)
+      erased &= (Image[offset + i] == 0xFF);
+
+    if (erased)                                   //Nothing to keep, an erased byte reads as 0xFF anyway
+      continue;
+
+    if (!ProgramRecord(offset, length, false))
+    {
+      ActiveSector = previousSector;              //Carry on in the full sector, the next write retries
+      LogPosition = FLASH_LOG_NB_RECORDS;
+      return false;
+    }
+  }
+
+  TRecord header;
+  header.l = ~0ULL;
+  header.h.tag = HEADER_TAG;
+  header.h.generationLo = (Generation + 1) & 0xFF;
+  header.h.generationHi = (Generation + 1) >> 8;
+  header.h.eraseCount[0] = EraseCounts[target] & 0xFF;
+  header.h.eraseCount[1] = (EraseCounts[target] >> 8) & 0xFF;
+  header.h.eraseCount[2] = (EraseCounts[target] >> 16) & 0xFF;
+
+  uint16_t check = RecordCheck(&header, 7);
+  header.h.checkHi = check >> 8;
+  header.h.checkLo = check & 0xFF;
+
+  if (!ProgramPhrase(SECTOR_ADDRESS(target), header.l))
+  {
+    ActiveSector = previousSector;
+    LogPosition = FLASH_LOG_NB_RECORDS;
+    return false;
+  }
+  Generation++;
+
+  return true;
+}
+
+/*! @brief Reads a record of the log and checks it.
+ *
+ *  @param sector The sector.
+ *  @param position The index of the phrase in the sector.
+ *  @param record The record read.
+ *  @param offset The offset in the image of its first byte.
+ *  @param length The number of bytes it carries.
+ *  @return bool - TRUE if the record is intact and lies in the image.
+ */
+static bool ReadRecord(const uint8_t sector, const uint16_t position, TRecord * const record, uint16_t * const offset, uint8_t * const length)
+{
+  record->l = _FP(SECTOR_ADDRESS(sector) + position * FLASH_PHRASE_SIZE);
+
+  *offset = record->s.offsetLo | ((record->s.lengthOffsetHi & RECORD_OFFSET_HI) << 8);
+  *length = (record->s.lengthOffsetHi >> 6) + 1;
+
+  return RecordChecked(record, 0) && *offset + *length <= FLASH_SIZE;
+}
+
+/*! @brief Replays the log of a sector into the image, and finds the end of the log.
+ *
+ *  The records of a transaction are only applied once its last record is found.
+ *  @param sector The sector.
+ *  @param first The first phrase of the log.
+ *  @param torn Set to TRUE if the log ends in the middle of a transaction.
+ *  @return bool - TRUE if at least one valid record was found.
+ */
+static bool Replay(const uint8_t sector, const uint16_t first, bool * const torn)
+{
+  bool found = false;
+  uint16_t chainStart = FLASH_LOG_NB_RECORDS;     //First record of the open transaction, none
+
+  for (LogPosition = first; LogPosition < FLASH_LOG_NB_RECORDS; LogPosition++)
+  {
+    TRecord record;
+    uint16_t offset;
+    uint8_t length;
+
+    if (_FP(SECTOR_ADDRESS(sector) + LogPosition * FLASH_PHRASE_SIZE) == ~0ULL)
+      break;                                      //First erased phrase, the log ends here
+
+    if (!ReadRecord(sector, LogPosition, &record, &offset, &length))
+      continue;                                   //Damaged record, skip it
+
+    if (record.s.lengthOffsetHi & RECORD_MORE)
+    {
+      if (chainStart == FLASH_LOG_NB_RECORDS)
+        chainStart = LogPosition;
+      continue;
+    }
+
+    for (uint16_t position = chainStart; position < LogPosition; position++)
+    {
+      TRecord chained;
+      uint16_t chainedOffset;
+      uint8_t chainedLength;
+
+      if (ReadRecord(sector, position, &chained, &chainedOffset, &chainedLength))
+        for (uint8_t i = 0; i < chainedLength; i++)
+          Image[chainedOffset + i] = chained.s.data[i];
+    }
+    chainStart = FLASH_LOG_NB_RECORDS;
+
+    for (uint8_t i = 0; i < length; i++)
+      Image[offset + i] = record.s.data[i];       //Later records win
+    found = true;
+  }
+
+  *torn = (chainStart != FLASH_LOG_NB_RECORDS);
+  return found;
+}
+
+/*! @brief Finds the next dirty chunk of the image.
+ *
+ *  @param chunk The first chunk to look at.
+ *  @return int16_t - The chunk, or -1 if none from there on is dirty.
+ */
+static int16_t NextDirty(uint16_t chunk)
+{
+  for (; chunk < NB_CHUNKS; chunk++)
+  {
+    if (Dirty[chunk / 32] == 0)
+      chunk |= 31;                                //Skip a clean word at once
+    else if (Dirty[chunk / 32] & (1UL << (chunk % 32)))
+      return chunk;
+  }
+
+  return -1;
+}
+
+/*! @brief Marks the clean image as logged.
+ *
+ */
+static void ClearDirty()
+{
+  for (uint8_t i = 0; i < sizeof(Dirty) / sizeof(Dirty[0]); i++)
+    Dirty[i] = 0;
+}
+
+/*! @brief Logs the dirty chunks of the image, one record each.
+ *
+ *  @param transaction TRUE to chain the records, so they are replayed all or none.
+ *  @return bool - TRUE if the image is clean.
+ *  @note Must be called with FlashAccess held.
+ */
+static bool CommitDirty(const bool transaction)
+{
+  int16_t chunk = NextDirty(0);
+
+  while (chunk >= 0)
+  {
+    if (LogPosition >= FLASH_LOG_NB_RECORDS)
+    {
+      if (!Compact())
+        return false;                             //Stays dirty, the next commit retries
+      break;                                      //The compacted log holds the whole image
+    }
+
+    int16_t next = NextDirty(chunk + 1);
+    uint16_t offset = chunk * RECORD_MAX_DATA;
+    uint8_t length = (FLASH_SIZE - offset < RECORD_MAX_DATA) ? FLASH_SIZE - offset : RECORD_MAX_DATA;
+
+    if (!ProgramRecord(offset, length, transaction && next >= 0))
+      return false;
+    Dirty[chunk / 32] &= ~(1UL << (chunk % 32));
+    chunk = next;
+  }
+
+  ClearDirty();
+  return true;
+}
+
+/*! @brief Updates some bytes of the image and marks their chunks dirty.
+ *
+ *  @param offset The offset of the first byte in the image.
+ *  @param data The bytes.
+ *  @param size The number of bytes.
+ */
+static void WriteImage(const uint16_t offset, const uint8_t data[], const uint16_t size)
+{
+  OS_SemaphoreWait(FlashAccess, 0);
+
+  for (uint16_t i = 0; i < size; i++)
+    Image[offset + i] = data[i];
+
+  for (uint16_t chunk = offset / RECORD_MAX_DATA; chunk * RECORD_MAX_DATA < offset + size; chunk++)
+    Dirty[chunk / 32] |= 1UL << (chunk % 32);
+
+  bool signal = !CommitPending;
+  CommitPending = true;
+
+  OS_SemaphoreSignal(FlashAccess);
+
+  if (signal)
+    OS_SemaphoreSignal(CommitRequest);
+}
+
+/*! @brief Converts the address of a variable to its offset in the image.
+ *
+ *  @return bool - TRUE if the variable lies entirely in the image.
+ */
+static bool ImageOffset(volatile void* const address, const uint16_t size, uint16_t * const offset)
+{
+  volatile uint8_t *byteAddress = (volatile uint8_t *) address;
+
+  if (byteAddress < Image || byteAddress + size > Image + FLASH_SIZE)
+    return false;
+
+  *offset = (uint16_t) (byteAddress - Image);
+  return true;
+}
+
+/*! @brief Restores the image from the newest log, or from the phrase of older firmware, compacting it if needed.
+ *
+ *  @return bool - TRUE if the image was restored, and any compaction succeeded.
+ *  @note Must be called with FlashAccess held.
+ */
+static bool Restore()
+{
+  for (uint16_t i = 0; i < FLASH_SIZE; i++)
+    Image[i] = 0xFF;
+
+  bool found = false;
+  bool torn;
+
+  //A single scan of the headers, then of the active sector only
+  for (uint8_t sector = 0; sector < FLASH_NB_SECTORS; sector++)
+  {
+    uint16_t generation;
+
+    if (!ReadHeader(sector, &generation, &EraseCounts[sector]))
+    {
+      EraseCounts[sector] = 0;                    //Blank, or its compaction was interrupted: count unknown
+      continue;
+    }
+
+    if (!found || (int16_t) (generation - Generation) > 0) //Newest, allowing the generation to wrap
+    {
+      ActiveSector = sector;
+      Generation = generation;
+      found = true;
+    }
+  }
+
+  if (found)
+  {
+    Replay(ActiveSector, 1, &torn);
+    BootState = FLASH_BOOT_RESTORED;
+    return torn ? Compact() : true;               //Records appended after a torn transaction would complete it
+  }
+
+  //No header anywhere: a blank device, or older firmware's single phrase of variables at FLASH_DATA_START
+  ActiveSector = 0;
+  Generation = 0;
+  BootState = FLASH_BOOT_BLANK;
+  if (_FP(FLASH_DATA_START) != ~0ULL && _FP(FLASH_DATA_START + FLASH_PHRASE_SIZE) == ~0ULL)
+  {
+    for (uint8_t i = 0; i < sizeof(LEGACY_OFFSETS); i++)
+      Image[i] = _FB(FLASH_DATA_START + LEGACY_OFFSETS[i]); //Packed, in the order Flash_AllocateVar now hands them out
+    BootState = FLASH_BOOT_MIGRATED;
+  }
+  return Compact();                               //Never into sector 0, so the phrase survives until the header is down
 }
 
 //Public Functions
 
 bool Flash_ReadByte(uint8_t offset, uint8_t *const byte)
 {
-  WaitCCIF();
-  if (offset > 7 || offset < 0)
+  if (offset >= FLASH_VARIABLES_SIZE)
+    return false;
+  *byte = Image[offset];
+  return true;
+}
+
+bool Flash_WriteByte(const uint8_t offset, const uint8_t data)
+{
+  if (offset >= FLASH_VARIABLES_SIZE)
     return false;
-  volatile uint32_t* const address = FLASH_DATA_START + offset;
-  *byte = _FP(address);
+
+  return Flash_Write8(&Image[offset], data);
 }
 
 bool Flash_Init(void)
@@ -100,111 +615,249 @@ bool Flash_Init(void)
 
   WaitCCIF();
 
-  return true;
+  FlashAccess = OS_SemaphoreCreate(0);            //Held until the image is restored, other threads may run during its commands
+  CommitRequest = OS_SemaphoreCreate(0);
+  CommandComplete = OS_SemaphoreCreate(0);
+  Transaction = OS_SemaphoreCreate(1);
+
+  FTFE_FCNFG &= ~FTFE_FCNFG_CCIE_MASK;
+  NVICICPR0 = (1 << (18 % 32));                   //Clear any pending FTFE command complete interrupt
+  NVICISER0 = (1 << (18 % 32));                   //Enable the FTFE command complete interrupt
+
+  bool success = Restore();
+
+  OS_SemaphoreSignal(FlashAccess);
+
+  return success;
+}
+
+TFlashBoot Flash_BootState(void)
+{
+  OS_SemaphoreWait(FlashAccess, 0);               //Waits for Flash_Init to finish restoring
+  TFlashBoot state = BootState;
+  OS_SemaphoreSignal(FlashAccess);
+
+  return state;
 }
 
 bool Flash_AllocateVar(volatile void** variable, const uint8_t size)
 {
-  uint8_t NbContiniousUnallocatedBytes = 0;
+  if (size != 1 && size != 2 && size != 4)
+    return false;
 
-  uint8_t position = 0;
+  uint8_t position = (VariablesEnd + size - 1) & ~(size - 1); //Next naturally aligned byte
 
-  for (uint8_t i = 0; i < FLASH_SIZE; i++) {
-      if (AllocationMap[i] == 0)
-        NbContiniousUnallocatedBytes++;
-      else
-        NbContiniousUnallocatedBytes = 0;
+  if (position + size > FLASH_VARIABLES_SIZE)
+    return false;
 
-      if (i % size == 0)
-        position = i;
+  VariablesEnd = position + size;
+  *variable = (void*) &Image[position];
+  return true;
+}
 
-      if (size < NbContiniousUnallocatedBytes && (i + 1) % size == 0) {
-        for (uint8_t j = position; j <= i; j++) {
-          AllocationMap[j] = 1;
-        }
+bool Flash_AllocateRecord(const uint8_t id, const uint16_t size, volatile void** record)
+{
+  if (id == DIRECTORY_FREE_ID || size == 0)
+    return false;
 
-        *variable = (void*) (FLASH_DATA_START + position);
-        return true;
-      }
+  uint16_t end = FLASH_VARIABLES_SIZE;
+  int8_t freeEntry = -1;
+
+  for (uint8_t i = 0; i < FLASH_DIRECTORY_NB_ENTRIES; i++)
+  {
+    if (Directory[i].id == DIRECTORY_FREE_ID)
+    {
+      if (freeEntry < 0)
+        freeEntry = i;
+      continue;
+    }
+
+    if (Directory[i].id == id)
+    {
+      if (Directory[i].size != size)
+        return false;                             //The record changed shape, don't hand out its old bytes
+      *record = (void*) &Image[Directory[i].offset];
+      return true;
+    }
+
+    if (Directory[i].offset + Directory[i].size > end)
+      end = Directory[i].offset + Directory[i].size;
   }
 
-  return false;
-}
+  if (freeEntry < 0)
+    return false;
 
+  uint16_t align = (size >= 8) ? 8 : (size >= 4) ? 4 : (size >= 2) ? 2 : 1;
+  uint16_t offset = (end + align - 1) & ~(align - 1);
 
-bool Flash_Write32(volatile uint32_t* const address, const uint32_t data)
+  if (offset + size > DIRECTORY_OFFSET)
+    return false;
+
+  TDirectoryEntry entry = {offset, size, id, 0xFF};
+  WriteImage(DIRECTORY_OFFSET + freeEntry * sizeof(entry), (const uint8_t *) &entry, sizeof(entry));
+
+  *record = (void*) &Image[offset];
+  return true;
+}
+
+bool Flash_Write(volatile void* const address, const void* const data, const uint16_t size)
 {
-  uint32_t index = (uint32_t) (address - FLASH_DATA_START);
+  uint16_t offset;
 
-  if (index >= FLASH_SIZE || index < 0)
+  if (!ImageOffset(address, size, &offset))
     return false;
-  if (index % 4 != 0)
-    return  false;
-  index /= 4;
 
-  uint64_t tempPhrase;
+  WriteImage(offset, (const uint8_t *) data, size);
+  return true;
+}
+
 
-  ReadPhrase(&tempPhrase);
+bool Flash_Write32(volatile uint32_t* const address, const uint32_t data)
+{
+  uint16_t offset;
 
-  uint32_t *tempArray = (uint32_t *) &tempPhrase;
-  tempArray[index] = data;
+  if (!ImageOffset(address, sizeof(data), &offset))
+    return false;
+  if (offset % 4 != 0)
+    return  false;
 
-  return WritePhrase(tempPhrase);
+  WriteImage(offset, (const uint8_t *) &data, sizeof(data));
+  return true;
 }
 
 
 bool Flash_Write16(volatile uint16_t* const address, const uint16_t data)
 {
-  uint16_t index = (uint16_t) (address - FLASH_DATA_START);
+  uint16_t offset;
 
-  if (index >= FLASH_SIZE || index < 0)
+  if (!ImageOffset(address, sizeof(data), &offset))
     return false;
-  if (index % 2 != 0)
+  if (offset % 2 != 0)
     return  false;
-  index /= 2;
 
-  uint64_t tempPhrase;
+  WriteImage(offset, (const uint8_t *) &data, sizeof(data));
+  return true;
+}
+
 
-  ReadPhrase(&tempPhrase);
+bool Flash_Write8(volatile uint8_t* const address, const uint8_t data)
+{
+  uint16_t offset;
 
-  uint16_t *tempArray = (uint16_t *) &tempPhrase;
-  tempArray[index] = data;
+  if (!ImageOffset(address, sizeof(data), &offset))
+    return false;
 
-  return WritePhrase(tempPhrase);
+  WriteImage(offset, &data, sizeof(data));
+  return true;
 }
 
+bool Flash_EraseSector(const uint32_t address)
+{
+  if (address < FLASH_FREE_START || address >= FLASH_FREE_END || address % FLASH_SECTOR_SIZE != 0)
+    return false;
+
+  OS_SemaphoreWait(FlashAccess, 0);
+  bool success = EraseSector(address);
+  OS_SemaphoreSignal(FlashAccess);
 
-bool Flash_Write8(volatile uint8_t* const address, const uint8_t data)
+  return success;
+}
+
+bool Flash_Read(const uint32_t address, void* const data, const uint16_t nbBytes)
 {
-  uint8_t index = (uint8_t) (address - FLASH_DATA_START);
+  if (address < FLASH_FREE_START || address + nbBytes > FLASH_FREE_END)
+    return false;
+
+  OS_SemaphoreWait(FlashAccess, 0);               //No command runs on the block meanwhile
+  for (uint16_t i = 0; i < nbBytes; i++)
+    ((uint8_t *) data)[i] = _FB((uintptr_t) address + i);
+  OS_SemaphoreSignal(FlashAccess);
+
+  return true;
+}
 
-  if (index >= FLASH_SIZE || index < 0)
+bool Flash_Program(const uint32_t address, const uint64_t phrases[], const uint16_t nbPhrases)
+{
+  if (address < FLASH_FREE_START || address + nbPhrases * FLASH_PHRASE_SIZE > FLASH_FREE_END || address % FLASH_PHRASE_SIZE != 0)
     return false;
 
-  uint64_t tempPhrase;
+  bool success = true;
 
-  ReadPhrase(&tempPhrase);
+  OS_SemaphoreWait(FlashAccess, 0);
+  for (uint16_t i = 0; i < nbPhrases && success; i++)
+    success = ProgramPhrase(address + i * FLASH_PHRASE_SIZE, phrases[i]);
+  OS_SemaphoreSignal(FlashAccess);
 
-  uint8_t *tempArray = (uint8_t *) &tempPhrase;
-  tempArray[index] = data;
+  return success;
+}
 
-  return WritePhrase(tempPhrase);
+bool Flash_Flush(void)
+{
+  OS_SemaphoreWait(FlashAccess, 0);
+
+  CommitPending = false;
+  bool success = !TransactionOpen && CommitDirty(false);
+
+  OS_SemaphoreSignal(FlashAccess);
+
+  return success;
+}
+
+void Flash_BeginTransaction(void)
+{
+  OS_SemaphoreWait(Transaction, 0);
+
+  OS_SemaphoreWait(FlashAccess, 0);
+  TransactionOpen = true;
+  OS_SemaphoreSignal(FlashAccess);
+}
+
+bool Flash_CommitTransaction(void)
+{
+  OS_SemaphoreWait(FlashAccess, 0);
+
+  TransactionOpen = false;
+  bool success = CommitDirty(true);
+
+  OS_SemaphoreSignal(FlashAccess);
+  OS_SemaphoreSignal(Transaction);
+
+  return success;
+}
+
+void Flash_CommitThread(void* data)
+{
+  (void) data;
+
+  for (;;)
+  {
+    OS_SemaphoreWait(CommitRequest, 0);
+    OS_TimeDelay(FLASH_COMMIT_DELAY);             //Let the rest of the burst land in the image
+    (void) Flash_Flush();
+  }
 }
 
 bool Flash_Erase(void)
 {
-  uint32_8union_t flashStart;
-  flashStart.l = FLASH_DATA_START;
+  OS_SemaphoreWait(FlashAccess, 0);
 
-  WaitCCIF();
+  for (uint16_t i = 0; i < DIRECTORY_OFFSET; i++)
+    Image[i] = 0xFF;                              //The directory stays, so allocated records keep their place
+  ClearDirty();
 
-  FTFE_FCCOB0 = FLASH_CMD_ERASE_SECTOR;  //Command to erase
-  FTFE_FCCOB1 = flashStart.s.Byte2;      //sets the flash address of the correct sector
-  FTFE_FCCOB2 = flashStart.s.Byte3;
-  FTFE_FCCOB3 = flashStart.s.Byte4 & 0xF0;
-  //WaitCCIF();
-  SetCCIF();
- // WaitCCIF();
+  bool success = Compact();                       //Moves on to a fresh sector holding only the header
 
-  return true;
+  OS_SemaphoreSignal(FlashAccess);
+
+  return success;
+}
+
+void RAMFUNC __attribute__ ((interrupt)) FTFE_ISR(void)
+{
+  OS_ISREnter();
+
+  FTFE_FCNFG &= ~FTFE_FCNFG_CCIE_MASK;            //CCIF stays set while idle, so stop interrupting
+  OS_SemaphoreSignal(CommandComplete);
+
+  OS_ISRExit();
 }
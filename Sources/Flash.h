@@ -24,20 +24,53 @@
 
 // Address of the start of the Flash block we are using for data storage
 #define FLASH_DATA_START 0x00080000LU
-// Address of the end of the Flash block we are using for data storage
-#define FLASH_DATA_END   0x00080007LU
-//Size of the flash block we are using for data storage
-#define FLASH_SIZE (FLASH_DATA_END - FLASH_DATA_START + 1)
+//Size of the non-volatile space, held in RAM and logged to the data sectors
+#define FLASH_SIZE 1024
+//Size of the start of the space handed out by Flash_AllocateVar, also read and programmed by the PC by offset
+#define FLASH_VARIABLES_SIZE 8
+//Number of records Flash_AllocateRecord can hand out
+#define FLASH_DIRECTORY_NB_ENTRIES 16
+//Size of a sector of the log of writes
+#define FLASH_SECTOR_SIZE 0x1000LU
+//Number of sectors, from FLASH_DATA_START, the log rotates over. Endurance scales with it
+#define FLASH_NB_SECTORS 4
+//Start of the flash after the sectors of the log, for other modules (Flash_EraseSector, Flash_Program)
+#define FLASH_FREE_START (FLASH_DATA_START + FLASH_NB_SECTORS * FLASH_SECTOR_SIZE)
+//End of the flash
+#define FLASH_FREE_END   0x00100000LU
+//OS ticks the commit thread waits after the first write of a burst before logging it
+#define FLASH_COMMIT_DELAY 50
 
-/*! @brief Enables the Flash module.
+/*!
+ * @enum TFlashBoot
+ * @brief What Flash_Init found in the data sectors.
+ */
+typedef enum
+{
+  FLASH_BOOT_BLANK,         /*!< Nothing stored, the variables need their defaults */
+  FLASH_BOOT_RESTORED,      /*!< The variables were restored from the log */
+  FLASH_BOOT_MIGRATED       /*!< The variables were restored from the phrase of older firmware, and logged */
+} TFlashBoot;
+
+/*! @brief Enables the Flash module and restores the non-volatile variables from the log.
  *
+ *  A compaction blocks on the flash commands, so other threads run meanwhile; the other functions wait until it is done.
  *  @return bool - TRUE if the Flash was setup successfully.
+ *  @note Every OS object a thread may wait on must exist before it is called.
  */
 bool Flash_Init(void);
  
+/*! @brief Tells whether Flash_Init found stored variables.
+ *
+ *  @return TFlashBoot - FLASH_BOOT_BLANK on a blank device, otherwise how the variables were restored.
+ *  @note Assumes Flash has been initialized.
+ */
+TFlashBoot Flash_BootState(void);
+
 /*! @brief Allocates space for a non-volatile variable in the Flash memory.
  *
  *  @param variable is the address of a pointer to a variable that is to be allocated space in Flash memory.
+ *         The pointer points to the RAM image of the variable, which is read directly and written with Flash_Write.
  *         The pointer will be allocated to a relevant address:
  *         If the variable is a byte, then any address.
  *         If the variable is a half-word, then an even address.
@@ -45,16 +78,41 @@ bool Flash_Init(void);
  *         This allows the resulting variable to be used with the relevant Flash_Write function which assumes a certain memory address.
  *         e.g. a 16-bit variable will be on an even address
  *  @param size The size, in bytes, of the variable that is to be allocated space in the Flash memory. Valid values are 1, 2 and 4.
- *  @return bool - TRUE if the variable was allocated space in the Flash memory.
+ *  @return bool - TRUE if the variable was allocated space in the first FLASH_VARIABLES_SIZE bytes of the Flash memory.
  *  @note Assumes Flash has been initialized.
  */
 bool Flash_AllocateVar(volatile void** variable, const uint8_t size);
 
+/*! @brief Allocates space for a record (a struct, a table...) in the Flash memory, found again after a reset by its id.
+ *
+ *  The first call with an id bump allocates the record, naturally aligned, and records it in a directory kept in Flash.
+ *  Later calls with the same id, including after a reset, return the same record.
+ *  @param id The id of the record, 0x00 to 0xFE.
+ *  @param size The size, in bytes, of the record.
+ *  @param record is the address of a pointer which is set to the RAM image of the record, written with Flash_Write.
+ *  @return bool - TRUE if the record was found or allocated, FALSE if the space or the directory is full, or
+ *          the id is already used by a record of another size.
+ *  @note Assumes Flash has been initialized. Records are allocated at start-up, from a single thread.
+ */
+bool Flash_AllocateRecord(const uint8_t id, const uint16_t size, volatile void** record);
+
+/*! @brief Writes any number of bytes, e.g. a record, to Flash.
+ *
+ *  The RAM image is updated at once, the flash by Flash_CommitThread or Flash_Flush.
+ *  @param address The address of the data, in a variable or record.
+ *  @param data The bytes to write.
+ *  @param size The number of bytes.
+ *  @return bool - TRUE if the data was written, FALSE if it does not lie in the allocated space.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Write(volatile void* const address, const void* const data, const uint16_t size);
+
 /*! @brief Writes a 32-bit number to Flash.
  *
+ *  The RAM image is updated at once, the flash by Flash_CommitThread or Flash_Flush.
  *  @param address The address of the data.
  *  @param data The 32-bit data to write.
- *  @return bool - TRUE if Flash was written successfully, FALSE if address is not aligned to a 4-byte boundary or if there is a programming error.
+ *  @return bool - TRUE if the data was written, FALSE if address is not aligned to a 4-byte boundary or not allocated.
  *  @note Assumes Flash has been initialized.
  */
 bool Flash_Write32(volatile uint32_t* const address, const uint32_t data);
@@ -63,7 +121,7 @@ bool Flash_Write32(volatile uint32_t* const address, const uint32_t data);
  *
  *  @param address The address of the data.
  *  @param data The 16-bit data to write.
- *  @return bool - TRUE if Flash was written successfully, FALSE if address is not aligned to a 2-byte boundary or if there is a programming error.
+ *  @return bool - TRUE if the data was written, FALSE if address is not aligned to a 2-byte boundary or not allocated.
  *  @note Assumes Flash has been initialized.
  */
 bool Flash_Write16(volatile uint16_t* const address, const uint16_t data);
@@ -72,23 +130,100 @@ bool Flash_Write16(volatile uint16_t* const address, const uint16_t data);
  *
  *  @param address The address of the data.
  *  @param data The 8-bit data to write.
- *  @return bool - TRUE if Flash was written successfully, FALSE if there is a programming error.
+ *  @return bool - TRUE if the data was written, FALSE if address is not allocated.
  *  @note Assumes Flash has been initialized.
  */
 bool Flash_Write8(volatile uint8_t* const address, const uint8_t data);
 
-/*! @brief Erases the entire Flash sector.
+/*! @brief Writes a byte of the non-volatile space, by offset.
+ *
+ *  @param offset The offset of the byte, from 0 to FLASH_VARIABLES_SIZE - 1.
+ *  @param data The byte to write.
+ *  @return bool - TRUE if Flash was written successfully.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_WriteByte(const uint8_t offset, const uint8_t data);
+
+/*! @brief Erases a sector of the flash after the non-volatile variables.
+ *
+ *  @param address The address of the sector, from FLASH_FREE_START.
+ *  @return bool - TRUE if the sector was erased successfully.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_EraseSector(const uint32_t address);
+
+/*! @brief Reads the flash after the non-volatile variables.
+ *
+ *  The data sectors cannot be read while a command erases or programs them, so it waits for the
+ *  command in progress, if any.
+ *  @param address The address of the first byte, from FLASH_FREE_START.
+ *  @param data Where the bytes are copied to.
+ *  @param nbBytes The number of bytes.
+ *  @return bool - TRUE if the bytes lie in the flash after the non-volatile variables.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Read(const uint32_t address, void* const data, const uint16_t nbBytes);
+
+/*! @brief Programs consecutive phrases of erased flash after the non-volatile variables.
  *
+ *  @param address The address of the first phrase, 8-byte aligned, from FLASH_FREE_START.
+ *  @param phrases The phrases.
+ *  @param nbPhrases The number of phrases.
+ *  @return bool - TRUE if every phrase was programmed successfully.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Program(const uint32_t address, const uint64_t phrases[], const uint16_t nbPhrases);
+
+/*! @brief Writes every pending change to the flash now, e.g. before a reset or on brown-out.
+ *
+ *  @return bool - TRUE if the flash holds the whole image, FALSE if it failed or a transaction is open.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Flush(void);
+
+/*! @brief Opens a transaction: the writes that follow, until Flash_CommitTransaction, reach the flash all or none.
+ *
+ *  The RAM image is still updated at once. Blocks while another thread has a transaction open.
+ *  @note Assumes Flash has been initialized.
+ */
+void Flash_BeginTransaction(void);
+
+/*! @brief Writes the changes made since Flash_BeginTransaction to the flash, and closes the transaction.
+ *
+ *  Writes to consecutive bytes, e.g. the variables of Flash_AllocateVar, cost one program per 4 bytes.
+ *  @return bool - TRUE if the flash holds the whole image.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_CommitTransaction(void);
+
+/*! @brief The thread which writes bursts of changes to the flash.
+ *
+ *  @param data Unused.
+ *  @note Assumes Flash has been initialized.
+ */
+void Flash_CommitThread(void* data);
+
+/*! @brief Erases all the non-volatile variables and records.
+ *
+ *  The directory of records is kept, so records already allocated stay where they are.
+ *  The log moves on to the next sector, so the erase counts stay levelled.
  *  @return bool - TRUE if the Flash "data" sector was erased successfully.
  *  @note Assumes Flash has been initialized.
  */
 bool Flash_Erase(void);
 
-/*! @brief Reads a single byte.
+/*! @brief Reads a single byte of the non-volatile space, by offset.
  *
  *  @return bool - TRUE if the Flash "data" sector was read successfully.
  *  @note Assumes Flash has been initialized.
  */
 bool Flash_ReadByte(uint8_t offset, uint8_t *const byte);
 
+/*! @brief Interrupt service routine for the FTFE command complete interrupt.
+ *
+ *  Wakes the thread waiting for the flash command.
+ *  @note Assumes Flash has been initialized.
+ */
+void RAMFUNC __attribute__ ((interrupt)) FTFE_ISR(void);
+
 #endif
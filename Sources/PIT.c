@@ -3,6 +3,8 @@
  *  @brief Functions to handle PIT commands
  *
  *  This contains the structure for the functions that handle PIT commands.
+ *  Every channel is reached through Registers, and what happens when it expires through Channels,
+ *  so the four channels share one implementation.
  *
  *  @author 11989668, 13113117
  *  @date 2018-05-01
@@ -10,116 +12,241 @@
 
 #include "PIT.h"
 #include "MK70F12.h"
+#include <stddef.h>
 
+#define PIT0_IRQ 68                    //IRQ of channel 0, the other channels follow
+#define PIT_TCTRL_CHN_MASK 0x4u        //Chain mode bit of TCTRL, which MK70F12.h does not define
 
-static uint32_t ModulePeriodNanoSec;
+/*!
+ * @struct TPITRegisters
+ * @brief The registers of a channel.
+ */
+typedef struct
+{
+  volatile uint32_t *ldval;            /*!< Load value */
+  volatile uint32_t *cval;             /*!< Current value */
+  volatile uint32_t *tctrl;            /*!< Timer control */
+  volatile uint32_t *tflg;             /*!< Timer flag */
+} TPITRegisters;
+
+/*!
+ * @struct TPITChannel
+ * @brief What happens when a channel expires.
+ */
+typedef struct
+{
+  void (*callback)(void*);             /*!< Called from the interrupt, NULL if none */
+  void *arguments;                     /*!< Passed to the callback */
+  OS_ECB *semaphore;                   /*!< Signalled from the interrupt, NULL if none */
+  uint32_t load;                       /*!< Module clocks of the current count */
+  uint32_t nextLoad;                   /*!< Module clocks of the count after the next reload */
+  volatile uint32_t nbInterrupts;      /*!< Interrupts run, so PIT_Elapsed can tell when one ran meanwhile */
+} TPITChannel;
+
+static const TPITRegisters Registers[PIT_NB_CHANNELS] =
+{
+  {&PIT_LDVAL0, &PIT_CVAL0, &PIT_TCTRL0, &PIT_TFLG0},
+  {&PIT_LDVAL1, &PIT_CVAL1, &PIT_TCTRL1, &PIT_TFLG1},
+  {&PIT_LDVAL2, &PIT_CVAL2, &PIT_TCTRL2, &PIT_TFLG2},
+  {&PIT_LDVAL3, &PIT_CVAL3, &PIT_TCTRL3, &PIT_TFLG3}
+};
 
-static void* PITUserArguments;
+static TPITChannel Channels[PIT_NB_CHANNELS];
 
-static void (*PITCallbackFunction)(void*);
+static uint32_t ModuleClk;                     //Module clock in Hz
 
+/*! @brief Converts a period to a whole number of module clocks.
+ *
+ *  period * ModuleClk is formed exactly in 64 bits, so the only error is the rounding to the nearest clock,
+ *  whatever the module clock.
+ *  @param period The period in nanoseconds.
+ *  @return uint32_t - The number of module clocks, at least 1 and clamped to what LDVAL can hold.
+ */
+static uint32_t Ticks(const uint64_t period)
+{
+  //Past this the product could overflow, and the ticks could not be loaded anyway
+  if (period >= ((uint64_t) UINT32_MAX * 1000000000) / ModuleClk)
+    return UINT32_MAX;
 
+  uint32_t ticks = (period * ModuleClk + 500000000) / 1000000000;
 
-bool PIT_Init(const uint32_t moduleClk, void (*userFunction)(void*), void* userArguments)
+  return ticks ? ticks : 1;
+}
+
+/*! @brief Acknowledges the interrupt of a channel and runs its handlers.
+ *
+ *  @param channelNb The channel.
+ */
+static void RAMFUNC Interrupt(const uint8_t channelNb)
 {
-  PIT0_Semaphore = OS_SemaphoreCreate(0);
-  PIT1_Semaphore = OS_SemaphoreCreate(0);
+  TPITChannel * const channel = &Channels[channelNb];
 
-  //PITCallbackFunction = userFunction;
-  //PITUserArguments = userArguments;
+  OS_ISREnter();
+
+  *Registers[channelNb].tflg = PIT_TFLG_TIF_MASK;   //Clear interrupt Flag (w1c)
+  channel->load = channel->nextLoad;                //The reload took LDVAL
+  channel->nbInterrupts++;
 
-  ModulePeriodNanoSec = 1000000000/moduleClk; //Stores the module clock in nanoseconds
+  if (channel->callback)
+    (*channel->callback)(channel->arguments);
+  if (channel->semaphore)
+    OS_SemaphoreSignal(channel->semaphore);
+
+  OS_ISRExit();
+}
+
+bool PIT_Init(const uint32_t moduleClk, void (*userFunction)(void*), void* userArguments)
+{
+  ModuleClk = moduleClk;
 
   SIM_SCGC6 |= SIM_SCGC6_PIT_MASK;         //Enable PIT clock
 
   PIT_MCR &= ~PIT_MCR_MDIS_MASK;           //Enable PIT timer (0 to enable)
   PIT_MCR |= PIT_MCR_FRZ_MASK;             //Timers are stopped in Debug Mode
 
-  PIT_TCTRL0 |= PIT_TCTRL_TIE_MASK;        //Enable PIT interrupts
-  PIT_TCTRL1 |= PIT_TCTRL_TIE_MASK;        //Enable PIT interrupts
+  for (uint8_t channelNb = 0; channelNb < PIT_NB_CHANNELS; channelNb++)
+  {
+    *Registers[channelNb].tctrl = 0;                          //Disabled until PIT_Set
+    *Registers[channelNb].tflg = PIT_TFLG_TIF_MASK;
+    Channels[channelNb] = (TPITChannel) {NULL, NULL, NULL, 0, 0, 0};
+
+    NVICICPR2 = (1 << ((PIT0_IRQ + channelNb) % 32));         //Clear any pending interrupts on the channel
+    NVICISER2 = (1 << ((PIT0_IRQ + channelNb) % 32));         //Enable the channel's interrupts
+  }
+
+  Channels[0].callback = userFunction;
+  Channels[0].arguments = userArguments;
+
+  return true;
+}
+
+bool PIT_SetHandler(const uint8_t channelNb, void (*userFunction)(void*), void* userArguments, OS_ECB* const semaphore)
+{
+  if (channelNb >= PIT_NB_CHANNELS)
+    return false;
+
+  OS_DisableInterrupts();                  //The interrupt never sees half a handler
+  Channels[channelNb].callback = userFunction;
+  Channels[channelNb].arguments = userArguments;
+  Channels[channelNb].semaphore = semaphore;
+  OS_EnableInterrupts();
+
+  return true;
+}
 
-  NVICICPR2 = (1<<(68 % 32));              //Clear any pending interrupts on PIT Channel 0
-  NVICISER2 = (1<<(68 % 32));              //Enable PIT Channel 0 interrupts
+bool PIT_Chain(const uint8_t channelNb, const bool chain)
+{
+  if (channelNb == 0 || channelNb >= PIT_NB_CHANNELS)
+    return false;                          //Channel 0 has no channel before it
 
-  NVICICPR2 = (1<<(69 % 32));              //Clear any pending interrupts on PIT Channel 0
-  NVICISER2 = (1<<(69 % 32));              //Enable PIT Channel 0 interrupts
+  if (chain)
+    *Registers[channelNb].tctrl |= PIT_TCTRL_CHN_MASK;      //Count the expiries of channel channelNb - 1
+  else
+    *Registers[channelNb].tctrl &= ~PIT_TCTRL_CHN_MASK;     //Count module clocks
 
   return true;
 }
 
 void PIT_Set(const uint8_t channelNb, const uint64_t period, const bool restart)
 {
-  int64_t temp, temp1, temp2;
-  switch(channelNb)
-  {
-    case 0:
-      if (restart)
-        PIT_Enable(channelNb, false);      //Disable the timer
-      temp = (period/ModulePeriodNanoSec);
-      temp1 = PIT_LDVAL0;
-      PIT_LDVAL0 = (period/ModulePeriodNanoSec) - 1;
-      temp2 = PIT_LDVAL0;
-
-      if (restart)
-        PIT_Enable(channelNb, true);      //Re-Enable the timer
-      PIT_TCTRL0 |= PIT_TCTRL_TIE_MASK;        //Enable PIT interrupts
-      break;
-    case 1:
-      if (restart)
-        PIT_Enable(channelNb, false);      //Disable the timer
-      temp = (period/ModulePeriodNanoSec);
-      temp1 = PIT_LDVAL1;
-      PIT_LDVAL1 = (period/ModulePeriodNanoSec) - 1;
-      temp2 = PIT_LDVAL1;
-
-      if (restart)
-        PIT_Enable(channelNb, true);      //Re-Enable the timer
-      PIT_TCTRL1 |= PIT_TCTRL_TIE_MASK;        //Enable PIT interrupts
-      break;
-  }
+  PIT_SetTicks(channelNb, Ticks(period), restart);
 }
 
-void PIT_Enable(const uint8_t channelNb, const bool enable)
+void PIT_SetTicks(const uint8_t channelNb, const uint32_t ticks, const bool restart)
 {
-  switch(channelNb)
+  if (channelNb >= PIT_NB_CHANNELS || ticks == 0)
+    return;
+
+  if (restart)
+    PIT_Enable(channelNb, false);          //Disable the timer
+
+  OS_DisableInterrupts();
+  *Registers[channelNb].ldval = ticks - 1; //Without a restart, loaded at the next reload: the count in progress is kept
+  Channels[channelNb].nextLoad = ticks;
+  if (restart || !(*Registers[channelNb].tctrl & PIT_TCTRL_TEN_MASK))
+    Channels[channelNb].load = ticks;      //Loaded when the timer is enabled
+  OS_EnableInterrupts();
+
+  if (restart)
+    PIT_Enable(channelNb, true);           //Re-Enable the timer
+  *Registers[channelNb].tctrl |= PIT_TCTRL_TIE_MASK; //Enable PIT interrupts
+}
+
+uint32_t PIT_Elapsed(const uint8_t channelNb)
+{
+  if (channelNb >= PIT_NB_CHANNELS)
+    return 0;
+
+  uint32_t nbInterrupts, load, count;
+
+  //Read again if the interrupt ran meanwhile, so the load and the count belong together
+  do
   {
-    case 0:
-      if (enable)
-        PIT_TCTRL0 |= PIT_TCTRL_TEN_MASK;       //Enable the timer
-      else
-        PIT_TCTRL0 &= ~PIT_TCTRL_TEN_MASK;      //Disable the timer
-      break;
-    case 1:
-      if (enable)
-        PIT_TCTRL1 |= PIT_TCTRL_TEN_MASK;       //Enable the timer
-      else
-        PIT_TCTRL1 &= ~PIT_TCTRL_TEN_MASK;      //Disable the timer
-      break;
+    nbInterrupts = Channels[channelNb].nbInterrupts;
+    load = Channels[channelNb].load;
+    count = *Registers[channelNb].cval;
+
+    if (*Registers[channelNb].tflg & PIT_TFLG_TIF_MASK)
+    {
+      load = Channels[channelNb].nextLoad; //Reloaded, and the interrupt has not run yet
+      count = *Registers[channelNb].cval;
+    }
   }
+  while (nbInterrupts != Channels[channelNb].nbInterrupts);
+
+  return load - 1 - count;
 }
 
-void __attribute__ ((interrupt)) PIT0_ISR(void)
+bool PIT_Pending(const uint8_t channelNb)
 {
-  OS_ISREnter();
+  if (channelNb >= PIT_NB_CHANNELS)
+    return false;
+
+  return (*Registers[channelNb].tflg & PIT_TFLG_TIF_MASK) != 0;
+}
+
+uint64_t PIT_GetPeriod(const uint8_t channelNb)
+{
+  if (channelNb >= PIT_NB_CHANNELS)
+    return 0;
 
-  PIT_TFLG0 |= PIT_TFLG_TIF_MASK;       //Clear interrupt Flag (w1c)
-  // if (PITCallbackFunction)
-  //     (*PITCallbackFunction)(PITUserArguments);     //Calls the RTC ISR callback function
-  OS_SemaphoreSignal(PIT0_Semaphore);
+  uint64_t ticks = (uint64_t) *Registers[channelNb].ldval + 1;
 
-  OS_ISRExit();
+  //1e12 / ModuleClk split into whole and fractional picoseconds per clock, so nothing overflows
+  return ticks * (1000000000000ULL / ModuleClk) + ticks * (1000000000000ULL % ModuleClk) / ModuleClk;
 }
 
-void __attribute__ ((interrupt)) PIT1_ISR(void)
+void PIT_Enable(const uint8_t channelNb, const bool enable)
 {
-  OS_ISREnter();
+  if (channelNb >= PIT_NB_CHANNELS)
+    return;
+
+  if (enable)
+    *Registers[channelNb].tctrl |= PIT_TCTRL_TEN_MASK;       //Enable the timer
+  else
+  {
+    *Registers[channelNb].tctrl &= ~PIT_TCTRL_TEN_MASK;      //Disable the timer
+    *Registers[channelNb].tflg = PIT_TFLG_TIF_MASK;          //Drop an expiry whose interrupt has not run yet
+    NVICICPR2 = (1 << ((PIT0_IRQ + channelNb) % 32));         //The NVIC keeps it pending once latched
+  }
+}
 
-  PIT_TFLG1 |= PIT_TFLG_TIF_MASK;       //Clear interrupt Flag (w1c)
+void RAMFUNC __attribute__ ((interrupt)) PIT0_ISR(void)
+{
+  Interrupt(0);
+}
 
-  OS_SemaphoreSignal(PIT1_Semaphore);
+void __attribute__ ((interrupt)) PIT1_ISR(void)
+{
+  Interrupt(1);
+}
 
-  //if (PITCallbackFunction)
-    //(*PITCallbackFunction)(PITUserArguments);     //Calls the RTC ISR callback function
+void __attribute__ ((interrupt)) PIT2_ISR(void)
+{
+  Interrupt(2);
+}
 
-  OS_ISRExit();
+void __attribute__ ((interrupt)) PIT3_ISR(void)
+{
+  Interrupt(3);
 }
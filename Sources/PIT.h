@@ -3,6 +3,10 @@
  *  @brief Routines for controlling Periodic Interrupt Timer (PIT) on the TWR-K70F120M.
  *
  *  This contains the functions for operating the periodic interrupt timer (PIT).
+ *  The four channels are driven through one table. When a channel expires its callback, if any,
+ *  is called from the interrupt, then its semaphore, if any, is signalled.
+ *  Channel 1 belongs to the Timer module, which multiplexes software timers on it,
+ *  and channel 3 to the Time module, which keeps the 64-bit time base on it.
  *
  *  @author PMcL
  *  @date 2015-08-22
@@ -15,44 +19,106 @@
 #include "types.h"
 #include "OS.h"
 
-
-// PIT semaphore
-OS_ECB *PIT0_Semaphore;
-OS_ECB *PIT1_Semaphore;
+// Number of PIT channels
+#define PIT_NB_CHANNELS 4
 
 /*! @brief Sets up the PIT before first use.
  *
- *  Enables the PIT and freezes the timer when debugging.
+ *  Enables the PIT and freezes the timer when debugging. Every channel starts disabled, without a handler.
  *  @param moduleClk The module clock rate in Hz.
- *  @param userFunction is a pointer to a user callback function.
+ *  @param userFunction is a pointer to a user callback function, called from the interrupt of channel 0. May be NULL.
  *  @param userArguments is a pointer to the user arguments to use with the user callback function.
  *  @return bool - TRUE if the PIT was successfully initialized.
- *  @note Assumes that moduleClk has a period which can be expressed as an integral number of nanoseconds.
  */
 bool PIT_Init(const uint32_t moduleClk, void (*userFunction)(void*), void* userArguments);
 
+/*! @brief Sets what happens when a channel expires.
+ *
+ *  @param channelNb The channel, 0 to PIT_NB_CHANNELS - 1.
+ *  @param userFunction Called from the interrupt of the channel. May be NULL.
+ *  @param userArguments Passed to userFunction.
+ *  @param semaphore Signalled from the interrupt of the channel, after userFunction. May be NULL.
+ *  @return bool - TRUE if the channel exists.
+ *  @note Assumes the PIT has been initialized.
+ */
+bool PIT_SetHandler(const uint8_t channelNb, void (*userFunction)(void*), void* userArguments, OS_ECB* const semaphore);
+
+/*! @brief Chains a channel to the one before it, or unchains it.
+ *
+ *  A chained channel decrements once every time channel channelNb - 1 expires, instead of once
+ *  every module clock. Its period is then a number of expiries, set with PIT_SetTicks, and
+ *  PIT_Set and PIT_GetPeriod, which work in module clocks, do not apply to it.
+ *  @param channelNb The channel, 1 to PIT_NB_CHANNELS - 1.
+ *  @param chain TRUE to chain the channel, FALSE to count module clocks again.
+ *  @return bool - TRUE if the channel can be chained.
+ *  @note Assumes the PIT has been initialized. Chaining is kept when the channel is set or enabled.
+ */
+bool PIT_Chain(const uint8_t channelNb, const bool chain);
+
 /*! @brief Sets the value of the desired period of the PIT.
  *
- *  @param period The desired value of the timer period in nanoseconds.
+ *  @param channelNb The channel, 0 to PIT_NB_CHANNELS - 1.
+ *  @param period The desired value of the timer period in nanoseconds, rounded to the nearest module clock.
  *  @param restart TRUE if the PIT is disabled, a new value set, and then enabled.
  *                 FALSE if the PIT will use the new value after a trigger event.
  *  @note The function will enable the timer and interrupts for the PIT.
  */
 void PIT_Set(const uint8_t channelNb, const uint64_t period, const bool restart);
 
+/*! @brief Sets the period of the PIT as a number of module clocks.
+ *
+ *  @param channelNb The channel, 0 to PIT_NB_CHANNELS - 1.
+ *  @param ticks The desired period in module clocks, at least 1.
+ *  @param restart As for PIT_Set.
+ *  @note The function will enable the timer and interrupts for the PIT.
+ */
+void PIT_SetTicks(const uint8_t channelNb, const uint32_t ticks, const bool restart);
+
+/*! @brief Gets how far a channel has counted since it last reloaded.
+ *
+ *  The reloads of a channel left running are a fixed grid, so successive values taken at events
+ *  paced by the channel measure the jitter of those events.
+ *  Takes no lock and disables no interrupts, so it may be called from critical sections.
+ *  @param channelNb The channel, 0 to PIT_NB_CHANNELS - 1.
+ *  @return uint32_t - The module clocks since the last reload.
+ *  @note Assumes the channel is enabled and its period was set with PIT_Set or PIT_SetTicks.
+ */
+uint32_t PIT_Elapsed(const uint8_t channelNb);
+
+/*! @brief Tells whether a channel has reloaded and its interrupt has not run yet.
+ *
+ *  Read together with PIT_Elapsed, it tells a reload counted by the interrupt from one still to be counted.
+ *  @param channelNb The channel, 0 to PIT_NB_CHANNELS - 1.
+ *  @return bool - TRUE if the interrupt of the channel is pending.
+ */
+bool PIT_Pending(const uint8_t channelNb);
+
+/*! @brief Gets the period the PIT actually runs at, after rounding to module clocks.
+ *
+ *  @param channelNb The channel, 0 to PIT_NB_CHANNELS - 1.
+ *  @return uint64_t - The period in picoseconds, rounded down; 0 if the channel does not exist.
+ */
+uint64_t PIT_GetPeriod(const uint8_t channelNb);
+
 /*! @brief Enables or disables the PIT.
  *
+ *  Disabling a channel also drops an expiry whose interrupt has not run yet, so none runs once it returns.
+ *  @param channelNb The channel, 0 to PIT_NB_CHANNELS - 1.
  *  @param enable - TRUE if the PIT is to be enabled, FALSE if the PIT is to be disabled.
  */
 void PIT_Enable(const uint8_t channelNb, const bool enable);
 
-/*! @brief Interrupt service routine for the PIT.
+/*! @brief Interrupt service routines for the PIT channels.
  *
  *  The periodic interrupt timer has timed out.
- *  The user callback function will be called.
+ *  The channel's callback is called and its semaphore signalled.
+ *  PIT0_ISR runs from RAM, but the callbacks and the RTOS calls it makes run from flash. Sampling is not
+ *  held up by flash operations because they only erase and program block 1, while the code is in block 0.
  *  @note Assumes the PIT has been initialized.
  */
-void __attribute__ ((interrupt)) PIT0_ISR(void);
+void RAMFUNC __attribute__ ((interrupt)) PIT0_ISR(void);
 void __attribute__ ((interrupt)) PIT1_ISR(void);
+void __attribute__ ((interrupt)) PIT2_ISR(void);
+void __attribute__ ((interrupt)) PIT3_ISR(void);
 
 #endif
@@ -0,0 +1,167 @@
+/*! @file
+ *
+ *  @brief I/O routines for the K70 SPI2 interface, wired to the TWR-ADCDAC-LTC board.
+ *
+ *  SCK and the delay after a frame are built from the module clock by a prescaler and a scaler,
+ *  which SPI_Init picks from their short lists of values.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-08
+ */
+
+#include "SPI.h"
+#include "MK70F12.h"
+#include <stddef.h>
+
+#define DECODER_A0_MASK (1u << 27)     //PTE27, bit 0 of the address of the chip select decoder
+#define DECODER_A1_MASK (1u << 5)      //PTE5, bit 1 of the address of the chip select decoder
+#define SLAVE_FIRST 4                  //Device of decoder address 0
+
+static const uint8_t BAUD_PRESCALERS[4] = {2, 3, 5, 7};
+static const uint16_t BAUD_SCALERS[16] = {2, 4, 6, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768};
+static const uint8_t DELAY_PRESCALERS[4] = {1, 3, 5, 7};
+
+/*! @brief Works out the baud rate fields of a CTAR.
+ *
+ *  @param baudRate The SCK frequency wanted, in Hz.
+ *  @param moduleClock The module clock rate in Hz.
+ *  @return uint32_t - PBR and BR of the nearest SCK frequency.
+ */
+static uint32_t BaudRateFields(const uint32_t baudRate, const uint32_t moduleClock)
+{
+  uint32_t bestError = UINT32_MAX, bestPrescaler = 0, bestScaler = 0;
+
+  for (uint32_t prescaler = 0; prescaler < 4; prescaler++)
+    for (uint32_t scaler = 0; scaler < 16; scaler++)
+    {
+      uint32_t rate = moduleClock / (BAUD_PRESCALERS[prescaler] * BAUD_SCALERS[scaler]);
+      uint32_t error = (rate > baudRate) ? rate - baudRate : baudRate - rate;
+
+      if (error < bestError)
+      {
+        bestError = error;
+        bestPrescaler = prescaler;
+        bestScaler = scaler;
+      }
+    }
+
+  return SPI_CTAR_PBR(bestPrescaler) | SPI_CTAR_BR(bestScaler);
+}
+
+/*! @brief Works out the delay after transfer fields of a CTAR.
+ *
+ *  @param delay The minimum delay, in ns.
+ *  @param moduleClock The module clock rate in Hz.
+ *  @return uint32_t - PDT and DT of the shortest delay that is not less than delay, or of the longest delay.
+ */
+static uint32_t DelayFields(const uint32_t delay, const uint32_t moduleClock)
+{
+  uint64_t needed = ((uint64_t) delay * moduleClock + 999999999) / 1000000000; //Module clocks, rounded up
+  uint32_t bestClocks = UINT32_MAX, bestPrescaler = 3, bestScaler = 15;
+
+  for (uint32_t prescaler = 0; prescaler < 4; prescaler++)
+    for (uint32_t scaler = 0; scaler < 16; scaler++)
+    {
+      uint32_t clocks = DELAY_PRESCALERS[prescaler] * (2u << scaler);
+
+      if (clocks >= needed && clocks < bestClocks)
+      {
+        bestClocks = clocks;
+        bestPrescaler = prescaler;
+        bestScaler = scaler;
+      }
+    }
+
+  return SPI_CTAR_PDT(bestPrescaler) | SPI_CTAR_DT(bestScaler);
+}
+
+/*! @brief Works out a CTAR.
+ *
+ *  @param setup How its frames are sent.
+ *  @param moduleClock The module clock rate in Hz.
+ *  @return uint32_t - The value of the CTAR.
+ */
+static uint32_t CTARValue(const TSPICTARSetup* const setup, const uint32_t moduleClock)
+{
+  uint32_t ctar = SPI_CTAR_FMSZ(setup->frameSize - 1);
+
+  if (setup->inactiveHighClock)
+    ctar |= SPI_CTAR_CPOL_MASK;
+  if (setup->changedOnLeadingClockEdge)
+    ctar |= SPI_CTAR_CPHA_MASK;
+  if (setup->LSBFirst)
+    ctar |= SPI_CTAR_LSBFE_MASK;
+
+  return ctar | DelayFields(setup->delayAfterTransfer, moduleClock) | BaudRateFields(setup->baudRate, moduleClock);
+}
+
+bool SPI_Init(const TSPIModule* const aSPIModule, const uint32_t moduleClock)
+{
+  SIM_SCGC3 |= SIM_SCGC3_DSPI2_MASK;                      //Enable SPI2 clock
+  SIM_SCGC5 |= SIM_SCGC5_PORTD_MASK | SIM_SCGC5_PORTE_MASK;
+
+  PORTD_PCR11 = PORT_PCR_MUX(2);                          //SPI2_PCS0
+  PORTD_PCR12 = PORT_PCR_MUX(2);                          //SPI2_SCK
+  PORTD_PCR13 = PORT_PCR_MUX(2);                          //SPI2_SOUT
+  PORTD_PCR14 = PORT_PCR_MUX(2);                          //SPI2_SIN
+  PORTD_PCR15 = PORT_PCR_MUX(2);                          //SPI2_PCS1
+
+  SPI2_MCR = SPI_MCR_HALT_MASK;                           //Halted while it is set up
+
+  uint32_t mcr = SPI_MCR_HALT_MASK | SPI_MCR_FRZ_MASK     //Stopped in Debug Mode
+               | SPI_MCR_PCSIS(1)                         //PCS0 is active low
+               | SPI_MCR_DIS_TXF_MASK | SPI_MCR_DIS_RXF_MASK
+               | SPI_MCR_CLR_TXF_MASK | SPI_MCR_CLR_RXF_MASK;
+
+  if (aSPIModule->isMaster)
+    mcr |= SPI_MCR_MSTR_MASK;
+  if (aSPIModule->continuousClock)
+    mcr |= SPI_MCR_CONT_SCKE_MASK;
+  SPI2_MCR = mcr;
+
+  SPI2_CTAR0 = CTARValue(&aSPIModule->ctar[0], moduleClock);
+  SPI2_CTAR1 = CTARValue(&aSPIModule->ctar[1], moduleClock);
+
+  PORTE_PCR5 = PORT_PCR_MUX(1) | PORT_PCR_DSE_MASK;       //Address lines of the chip select decoder
+  PORTE_PCR27 = PORT_PCR_MUX(1) | PORT_PCR_DSE_MASK;
+  GPIOE_PCOR = DECODER_A0_MASK | DECODER_A1_MASK;
+  GPIOE_PDDR |= DECODER_A0_MASK | DECODER_A1_MASK;
+
+  SPI2_MCR &= ~SPI_MCR_HALT_MASK;                         //Start
+
+  return true;
+}
+
+void SPI_SelectSlaveDevice(const uint8_t slaveAddress)
+{
+  uint8_t address = slaveAddress - SLAVE_FIRST;
+
+  if (address & 0x1)
+    GPIOE_PSOR = DECODER_A0_MASK;
+  else
+    GPIOE_PCOR = DECODER_A0_MASK;
+
+  if (address & 0x2)
+    GPIOE_PSOR = DECODER_A1_MASK;
+  else
+    GPIOE_PCOR = DECODER_A1_MASK;
+}
+
+void SPI_Exchange(const uint16_t dataTx, uint16_t* const dataRx, const uint8_t ctas, const bool continuous)
+{
+  uint32_t pushr = SPI_PUSHR_TXDATA(dataTx) | SPI_PUSHR_CTAS(ctas) | SPI_PUSHR_PCS(1);
+
+  if (continuous)
+    pushr |= SPI_PUSHR_CONT_MASK;
+
+  while (!(SPI2_SR & SPI_SR_TFFF_MASK));                  //Wait for room to send
+  SPI2_SR = SPI_SR_TFFF_MASK;
+  SPI2_PUSHR = pushr;
+
+  while (!(SPI2_SR & SPI_SR_RFDF_MASK));                  //Wait for the frame clocked in
+  uint16_t data = SPI2_POPR;
+  SPI2_SR = SPI_SR_RFDF_MASK;
+
+  if (dataRx)
+    *dataRx = data;
+}
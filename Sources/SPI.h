@@ -0,0 +1,72 @@
+/*! @file
+ *
+ *  @brief I/O routines for the K70 SPI2 interface, wired to the TWR-ADCDAC-LTC board.
+ *
+ *  SPI2 is a master with its FIFOs disabled. Its PCS0 goes to a decoder on the board, whose
+ *  address lines are PTE27 and PTE5, so SPI_SelectSlaveDevice picks the device PCS0 reaches.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-08
+ */
+
+#ifndef SPI_H
+#define SPI_H
+
+// new types
+#include "types.h"
+
+// Number of clock and transfer attribute registers that can be set up
+#define SPI_NB_CTARS 2
+
+/*!
+ * @struct TSPICTARSetup
+ * @brief How the frames of one clock and transfer attribute register are sent.
+ */
+typedef struct
+{
+  uint8_t frameSize;                /*!< Bits per frame, 4 to 16 */
+  bool inactiveHighClock;           /*!< SCK is high between frames */
+  bool changedOnLeadingClockEdge;   /*!< Data is changed on the leading edge of SCK, captured on the trailing one */
+  bool LSBFirst;                    /*!< Frames are sent least significant bit first */
+  uint32_t delayAfterTransfer;      /*!< Minimum time PCS stays negated after a frame, in ns */
+  uint32_t baudRate;                /*!< SCK frequency in Hz, the nearest the prescalers allow is used */
+} TSPICTARSetup;
+
+/*!
+ * @struct TSPIModule
+ * @brief How SPI2 is set up.
+ */
+typedef struct
+{
+  bool isMaster;                    /*!< SPI2 drives SCK */
+  bool continuousClock;             /*!< SCK runs between frames too */
+  TSPICTARSetup ctar[SPI_NB_CTARS]; /*!< Selected frame by frame with the ctas argument of SPI_Exchange */
+} TSPIModule;
+
+/*! @brief Sets up SPI2 and the pins of the TWR-ADCDAC-LTC board before first use.
+ *
+ *  @param aSPIModule How SPI2 is set up.
+ *  @param moduleClock The module clock rate in Hz.
+ *  @return bool - TRUE if SPI2 was successfully initialized.
+ */
+bool SPI_Init(const TSPIModule* const aSPIModule, const uint32_t moduleClock);
+
+/*! @brief Sets the address lines of the chip select decoder.
+ *
+ *  @param slaveAddress The device PCS0 reaches, 4 to 7.
+ *  @note Assumes SPI_Init has been called.
+ */
+void SPI_SelectSlaveDevice(const uint8_t slaveAddress);
+
+/*! @brief Sends a frame and receives the frame clocked in meanwhile.
+ *
+ *  @param dataTx The frame to send.
+ *  @param dataRx Where to place the frame received. May be NULL.
+ *  @param ctas The clock and transfer attribute register to use, 0 to SPI_NB_CTARS - 1.
+ *  @param continuous TRUE to keep PCS0 asserted after the frame, so the next one continues it.
+ *  @note Waits for the frame, so it takes the time of the frame and any delay after the previous one.
+ *        Assumes SPI_Init has been called.
+ */
+void SPI_Exchange(const uint16_t dataTx, uint16_t* const dataRx, const uint8_t ctas, const bool continuous);
+
+#endif
@@ -0,0 +1,72 @@
+/*! @file
+ *
+ *  @brief Routines for a monotonic 64-bit timestamp at bus clock resolution, driven by PIT channel 3.
+ *
+ *  PIT channel 3 counts TIME_WRAP module clocks and reloads; its interrupt counts the wraps. A reader
+ *  takes the wraps, PIT_Pending and PIT_Elapsed, and starts again if the wraps or the pending interrupt
+ *  moved meanwhile. A pending interrupt means the channel has wrapped and the wrap is not counted yet.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-05
+ */
+
+#include "Time.h"
+#include "PIT.h"
+#include <stddef.h>
+
+#define TIME_WRAP UINT32_MAX                    //Module clocks PIT channel 3 counts between wraps, as many as PIT_SetTicks takes
+
+static uint32_t ModuleClk;                      //Module clock in Hz
+static volatile uint32_t NbWraps;               //Wraps of PIT channel 3 counted by its interrupt
+
+//Private functions
+
+/*! @brief Called from the interrupt of PIT channel 3, once per wrap.
+ *
+ *  @param arguments Unused.
+ */
+static void Wrapped(void* arguments)
+{
+  NbWraps++;
+}
+
+//Public functions
+
+bool Time_Init(const uint32_t moduleClk)
+{
+  ModuleClk = moduleClk;
+  NbWraps = 0;
+
+  if (!PIT_SetHandler(3, Wrapped, NULL, NULL))
+    return false;
+
+  PIT_SetTicks(3, TIME_WRAP, true);
+
+  return true;
+}
+
+uint64_t Time_Now64(void)
+{
+  uint32_t nbWraps, elapsed;
+  bool pending;
+
+  //Interrupts share one priority, so a reader never runs between the flag being cleared and the wrap being counted
+  do
+  {
+    nbWraps = NbWraps;
+    pending = PIT_Pending(3);
+    elapsed = PIT_Elapsed(3);                   //From the reload if pending
+  }
+  while (nbWraps != NbWraps || pending != PIT_Pending(3));
+
+  if (pending)
+    nbWraps++;
+
+  return (uint64_t) nbWraps * TIME_WRAP + elapsed;
+}
+
+uint64_t Time_ToNs(const uint64_t ticks)
+{
+  //Whole seconds apart, so nothing overflows
+  return (ticks / ModuleClk) * 1000000000 + (ticks % ModuleClk) * 1000000000 / ModuleClk;
+}
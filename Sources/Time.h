@@ -0,0 +1,42 @@
+/*! @file
+ *
+ *  @brief Routines for a monotonic 64-bit timestamp at bus clock resolution, driven by PIT channel 3.
+ *
+ *  PIT channel 3 counts down freely and the module counts its wraps, so a timestamp is the wraps
+ *  and the count read together. Time_Now64 takes no lock and disables no interrupts, so it may be
+ *  called from threads, interrupts and critical sections alike.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-05
+ */
+
+#ifndef TIME_H
+#define TIME_H
+
+// new types
+#include "types.h"
+
+/*! @brief Sets up PIT channel 3 and starts the time base at 0.
+ *
+ *  @param moduleClk The module clock rate in Hz.
+ *  @return bool - TRUE if the time base was successfully initialized.
+ *  @note Assumes the PIT has been initialized.
+ */
+bool Time_Init(const uint32_t moduleClk);
+
+/*! @brief Reads the time base.
+ *
+ *  @return uint64_t - The module clocks since Time_Init.
+ *  @note Assumes Time_Init has been called.
+ */
+uint64_t Time_Now64(void);
+
+/*! @brief Converts a number of module clocks, such as the difference of two timestamps, to nanoseconds.
+ *
+ *  @param ticks The module clocks.
+ *  @return uint64_t - The nanoseconds, rounded down.
+ *  @note Assumes Time_Init has been called.
+ */
+uint64_t Time_ToNs(const uint64_t ticks);
+
+#endif
@@ -0,0 +1,284 @@
+/*! @file
+ *
+ *  @brief Routines for one-shot and periodic software timers, all driven by PIT channel 1.
+ *
+ *  A timer sits in the slot of the wheel given by the low bits of its expiry tick, in a doubly
+ *  linked list, so it is inserted and removed in constant time. Timer_Thread visits the slots of
+ *  the ticks that have passed and expires the timers due; the timers of later turns stay put.
+ *  The ticks are counted on the time base of the Time module, so reprogramming PIT channel 1 does not
+ *  make the timers drift: the channel only wakes Timer_Thread, at or after the next deadline.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-02
+ */
+
+#include "Timer.h"
+#include "PIT.h"
+#include "Time.h"
+#include "OS.h"
+#include <stddef.h>
+
+#define WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+
+#if TIMER_WHEEL_SIZE & WHEEL_MASK
+#error "TIMER_WHEEL_SIZE must be a power of 2"
+#endif
+#if TIMER_WHEEL_SIZE > 64
+#error "TIMER_WHEEL_SIZE must fit the bits of Occupied"
+#endif
+
+static TTimer *Wheel[TIMER_WHEEL_SIZE];         //Running timers, by the low bits of their expiry
+static uint64_t Occupied;                       //A bit per slot of the wheel holding a timer
+static uint32_t NbRunning;                      //Number of timers in the wheel
+static uint32_t Processed;                      //Last tick whose slot Timer_Thread has visited
+
+static uint32_t ClocksPerTick;                  //Module clocks in a tick
+static uint32_t Deadline;                       //Tick PIT channel 1 is programmed for
+static bool Programmed;                         //PIT channel 1 is running
+
+static OS_ECB *TimerAccess;                     //Guards the wheel
+static OS_ECB *TimerExpired;                    //Signalled by the interrupt of PIT channel 1
+
+//Private functions
+
+/*! @brief Reads the current tick.
+ *
+ *  @param clocks Set to the module clocks of the tick already gone. May be NULL.
+ *  @return uint32_t - The tick.
+ */
+static uint32_t CurrentTick(uint32_t * const clocks)
+{
+  uint64_t now = Time_Now64();
+
+  if (clocks)
+    *clocks = now % ClocksPerTick;
+
+  return now / ClocksPerTick;
+}
+
+/*! @brief Programs PIT channel 1 to expire at a tick.
+ *
+ *  @param deadline The tick. A tick already passed expires on the next one.
+ *  @param earlierOnly TRUE to leave the channel alone if it will expire by then anyway.
+ *  @note Must be called with TimerAccess held.
+ */
+static void Program(uint32_t deadline, const bool earlierOnly)
+{
+  uint32_t clocks;
+  uint32_t now = CurrentTick(&clocks);
+
+  if ((int32_t) (deadline - now) > TIMER_WHEEL_SIZE)
+    deadline = now + TIMER_WHEEL_SIZE;          //Approached a turn at a time, so the clocks fit the channel
+
+  //A deadline already passed has woken Timer_Thread, which reprograms the channel
+  if (earlierOnly && Programmed && (int32_t) (Deadline - deadline) <= 0)
+    return;
+
+  if ((int32_t) (deadline - now) <= 0)
+    deadline = now + 1;
+
+  Deadline = deadline;
+  Programmed = true;
+
+  //Counted from the time read above, so the channel can only expire late, never early
+  PIT_SetTicks(1, (deadline - now) * ClocksPerTick - clocks, true);
+}
+
+/*! @brief Stops PIT channel 1.
+ *
+ *  @note Must be called with TimerAccess held.
+ */
+static void Halt()
+{
+  PIT_Enable(1, false);
+  Programmed = false;
+}
+
+/*! @brief Puts a timer in the slot of its expiry.
+ *
+ *  @param timer The timer.
+ *  @note Must be called with TimerAccess held.
+ */
+static void Insert(TTimer * const timer)
+{
+  TTimer **slot = &Wheel[timer->expiry & WHEEL_MASK];
+
+  timer->previous = NULL;
+  timer->next = *slot;
+  if (*slot)
+    (*slot)->previous = timer;
+  *slot = timer;
+  Occupied |= (uint64_t) 1 << (timer->expiry & WHEEL_MASK);
+
+  timer->armed = true;
+  NbRunning++;
+}
+
+/*! @brief Takes a timer out of the wheel.
+ *
+ *  @param timer The timer, which must be in the wheel.
+ *  @note Must be called with TimerAccess held.
+ */
+static void Remove(TTimer * const timer)
+{
+  if (timer->previous)
+    timer->previous->next = timer->next;
+  else if (!(Wheel[timer->expiry & WHEEL_MASK] = timer->next))
+    Occupied &= ~((uint64_t) 1 << (timer->expiry & WHEEL_MASK));
+  if (timer->next)
+    timer->next->previous = timer->previous;
+
+  timer->armed = false;
+  NbRunning--;
+}
+
+/*! @brief Programs PIT channel 1 for the earliest expiry in the wheel, or stops it if the wheel is empty.
+ *
+ *  Only the occupied slots are visited, in tick order from Processed, by rotating Occupied to start
+ *  there. At most one turn of the wheel is searched; a later expiry is approached one turn at a time.
+ *  @note Must be called with TimerAccess held.
+ */
+static void Reschedule()
+{
+  if (NbRunning == 0)
+  {
+    Halt();
+    return;
+  }
+
+  uint32_t first = (Processed + 1) & WHEEL_MASK;
+#if TIMER_WHEEL_SIZE == 64
+  uint64_t pending = first ? (Occupied >> first) | (Occupied << (64 - first)) : Occupied;
+#else
+  //Two turns side by side, so a shift rotates
+  uint64_t pending = ((Occupied | (Occupied << TIMER_WHEEL_SIZE)) >> first) & (((uint64_t) 1 << TIMER_WHEEL_SIZE) - 1);
+#endif
+
+  while (pending)
+  {
+    uint32_t offset = __builtin_ctzll(pending);
+    uint32_t tick = Processed + 1 + offset;
+
+    for (TTimer *timer = Wheel[tick & WHEEL_MASK]; timer; timer = timer->next)
+      if (timer->expiry == tick)
+      {
+        Program(tick, false);
+        return;
+      }
+    pending &= pending - 1;                     //Only timers of later turns in this slot
+  }
+
+  Program(Processed + TIMER_WHEEL_SIZE, false);
+}
+
+//Public functions
+
+bool Timer_Init(const uint32_t moduleClk)
+{
+  ClocksPerTick = (uint64_t) moduleClk * TIMER_TICK_NS / 1000000000;
+
+  TimerAccess = OS_SemaphoreCreate(1);
+  TimerExpired = OS_SemaphoreCreate(0);
+  Processed = CurrentTick(NULL);                //The time base runs from Time_Init
+
+  PIT_Enable(1, false);
+
+  return PIT_SetHandler(1, NULL, NULL, TimerExpired);
+}
+
+void Timer_Start(TTimer* const timer, const uint32_t delay, const uint32_t period, void (*callback)(void*), void* arguments)
+{
+  OS_SemaphoreWait(TimerAccess, 0);
+
+  if (timer->armed)
+    Remove(timer);
+
+  timer->callback = callback;
+  timer->arguments = arguments;
+  timer->period = period;
+  timer->expiry = CurrentTick(NULL) + (delay ? delay : 1);
+  Insert(timer);
+
+  Program(timer->expiry, true);
+
+  OS_SemaphoreSignal(TimerAccess);
+}
+
+void Timer_Stop(TTimer* const timer)
+{
+  OS_SemaphoreWait(TimerAccess, 0);
+
+  if (timer->armed)
+    Remove(timer);                              //PIT channel 1 may wake Timer_Thread for nothing, once
+
+  OS_SemaphoreSignal(TimerAccess);
+}
+
+bool Timer_Running(const TTimer* const timer)
+{
+  OS_SemaphoreWait(TimerAccess, 0);
+  bool armed = timer->armed;                    //Timer_Thread may be expiring it
+  OS_SemaphoreSignal(TimerAccess);
+
+  return armed;
+}
+
+void Timer_Thread(void* data)
+{
+  (void) data;
+
+  for (;;)
+  {
+    OS_SemaphoreWait(TimerExpired, 0);
+    OS_SemaphoreWait(TimerAccess, 0);
+
+    uint32_t now = CurrentTick(NULL);
+    uint32_t nbTicks = now - Processed;
+    TTimer *expired = NULL;
+    TTimer **last = &expired;
+
+    if (nbTicks > TIMER_WHEEL_SIZE)
+      nbTicks = TIMER_WHEEL_SIZE;               //Every slot once is enough
+
+    for (uint32_t tick = Processed + 1; tick != Processed + 1 + nbTicks; tick++)
+    {
+      TTimer *timer = Wheel[tick & WHEEL_MASK];
+
+      while (timer)
+      {
+        TTimer *next = timer->next;
+
+        if ((int32_t) (timer->expiry - now) <= 0)
+        {
+          Remove(timer);
+          if (timer->period)
+          {
+            do
+              timer->expiry += timer->period;   //From the expiry, not from now, so it does not drift
+            while ((int32_t) (timer->expiry - now) <= 0);
+            Insert(timer);
+          }
+
+          timer->nextExpired = NULL;
+          *last = timer;
+          last = &timer->nextExpired;
+        }
+
+        timer = next;
+      }
+    }
+
+    Processed = now;
+    Reschedule();
+
+    OS_SemaphoreSignal(TimerAccess);
+
+    //Without TimerAccess, so a callback can start and stop timers
+    while (expired)
+    {
+      TTimer *timer = expired;
+      expired = timer->nextExpired;
+      timer->callback(timer->arguments);
+    }
+  }
+}
@@ -0,0 +1,81 @@
+/*! @file
+ *
+ *  @brief Routines for one-shot and periodic software timers, all driven by PIT channel 1.
+ *
+ *  The timers hang off a hashed timing wheel of TIMER_WHEEL_SIZE slots, so starting, stopping and
+ *  expiring a timer costs the same however many are running. PIT channel 1 is programmed for the
+ *  next deadline only, and stopped while no timer runs. Callbacks run in Timer_Thread, so they may
+ *  wait on semaphores, write to flash and start or stop timers.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-02
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+// new types
+#include "types.h"
+
+// Resolution of the timers in nanoseconds: delays and periods are in ms
+#define TIMER_TICK_NS 1000000
+// Number of slots of the wheel, a power of 2 up to 64. A deadline further away costs an extra wake-up per turn
+#define TIMER_WHEEL_SIZE 64
+
+/*!
+ * @struct TTimer
+ * @brief A software timer. Owned by the caller, usually static; its fields are private to the Timer module.
+ */
+typedef struct TTimer
+{
+  struct TTimer *next;              /*!< Next timer in the same slot of the wheel */
+  struct TTimer *previous;          /*!< Previous timer in the same slot of the wheel */
+  struct TTimer *nextExpired;       /*!< Next timer whose callback is due */
+  uint32_t expiry;                  /*!< Tick at which the timer expires */
+  uint32_t period;                  /*!< Ticks between expiries, 0 for a one-shot */
+  void (*callback)(void*);          /*!< Called from Timer_Thread when the timer expires */
+  void *arguments;                  /*!< Passed to the callback */
+  bool armed;                       /*!< The timer is in the wheel */
+} TTimer;
+
+/*! @brief Sets up PIT channel 1 and the timer service before first use.
+ *
+ *  @param moduleClk The module clock rate in Hz.
+ *  @return bool - TRUE if the timer service was successfully initialized.
+ *  @note Assumes the PIT and the Time module have been initialized, and a tick is a whole number of module clock periods.
+ */
+bool Timer_Init(const uint32_t moduleClk);
+
+/*! @brief Starts a timer, or restarts it if it is running.
+ *
+ *  @param timer The timer.
+ *  @param delay The time until the first expiry, in ms. 0 expires on the next tick.
+ *  @param period The time between later expiries, in ms. 0 for a one-shot timer.
+ *  @param callback The function called at every expiry.
+ *  @param arguments Passed to the callback.
+ *  @note Assumes Timer_Init has been called.
+ */
+void Timer_Start(TTimer* const timer, const uint32_t delay, const uint32_t period, void (*callback)(void*), void* arguments);
+
+/*! @brief Stops a timer. Stopping a timer that is not running does nothing.
+ *
+ *  @param timer The timer.
+ *  @note Assumes Timer_Init has been called.
+ */
+void Timer_Stop(TTimer* const timer);
+
+/*! @brief Tells whether a timer is running.
+ *
+ *  @param timer The timer.
+ *  @return bool - TRUE if the timer will expire again.
+ */
+bool Timer_Running(const TTimer* const timer);
+
+/*! @brief The thread which expires the timers and calls their callbacks.
+ *
+ *  @param data Unused.
+ *  @note Assumes Timer_Init has been called.
+ */
+void Timer_Thread(void* data);
+
+#endif
@@ -26,6 +26,8 @@ static TFIFO TxFIFO;
 OS_ECB *RxSemaphore; //Receive semaphore
 OS_ECB *TxSemaphore; //Transmit semaphore
 
+static void (*RxCallbackFunction)(const uint8_t); //Consumer of received bytes, NULL to use RxFIFO
+
 /****************************************PUBLIC FUNCTION DEFINITION***************************************/
 
 /*! @brief Sets up the UART interface before first use.
@@ -95,6 +97,16 @@ void UART_InChar(uint8_t * const dataPtr)
   FIFO_Get(&RxFIFO, dataPtr);
 }
 
+/*! @brief Registers a function to be called from RxThread for every received byte.
+ *
+ *  @param userFunction is a pointer to the function that consumes received bytes, or NULL to queue them in the receive FIFO.
+ *  @note Assumes that UART_Init has been called.
+ */
+void UART_SetRxCallback(void (*userFunction)(const uint8_t))
+{
+  RxCallbackFunction = userFunction;
+}
+
 /*! @brief Put a byte in the transmit FIFO if it is not full.
  *
  *  @param data The byte to be placed in the transmit FIFO.
@@ -106,6 +118,17 @@ void UART_OutChar(const uint8_t data)
   FIFO_Put(&TxFIFO, data); //Place the value stored in data into the TxFIFO
 }
 
+/*! @brief Put a block of bytes in the transmit FIFO, contiguously.
+ *
+ *  @param data The bytes to be placed in the transmit FIFO.
+ *  @param nbBytes The number of bytes to send.
+ *  @note Assumes that UART_Init has been called.
+ */
+void UART_OutBlock(const uint8_t data[], const uint16_t nbBytes)
+{
+  FIFO_PutBlock(&TxFIFO, data, nbBytes); //Place the whole block in the TxFIFO at once
+}
+
 /*! @brief The thread which handles the receiving of data
  *
  *  @param data
@@ -116,8 +139,12 @@ void RxThread(void *data)
   for(;;)
   {
     OS_SemaphoreWait(RxSemaphore, 0);
-    FIFO_Put(&RxFIFO, UART2_D);
-    // Something in RxFIFO, Let Packet Know
+    uint8_t rxData = UART2_D;
+
+    if (RxCallbackFunction)
+      (*RxCallbackFunction)(rxData);  //Hand the byte straight to the consumer (the packet frame assembler)
+    else
+      FIFO_Put(&RxFIFO, rxData);      //Something in RxFIFO, let UART_InChar know
 
     UART2_C2 |= UART_C2_RIE_MASK; //Enable receive interrupt
   }
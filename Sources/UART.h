@@ -35,6 +35,13 @@ bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk);
  */
 void UART_InChar(uint8_t * const dataPtr);
 
+/*! @brief Registers a function to be called from RxThread for every received byte.
+ *
+ *  @param userFunction is a pointer to the function that consumes received bytes, or NULL to queue them in the receive FIFO.
+ *  @note Assumes that UART_Init has been called.
+ */
+void UART_SetRxCallback(void (*userFunction)(const uint8_t));
+
 /*! @brief Put a byte in the transmit FIFO if it is not full.
  *
  *  @param data The byte to be placed in the transmit FIFO.
@@ -42,6 +49,14 @@ void UART_InChar(uint8_t * const dataPtr);
  */
 void UART_OutChar(const uint8_t data);
 
+/*! @brief Put a block of bytes in the transmit FIFO, contiguously.
+ *
+ *  @param data The bytes to be placed in the transmit FIFO.
+ *  @param nbBytes The number of bytes to send.
+ *  @note Assumes that UART_Init has been called.
+ */
+void UART_OutBlock(const uint8_t data[], const uint16_t nbBytes);
+
 /*! @brief The thread which handles the receiving of data
  *
  *  @param data
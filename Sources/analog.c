@@ -0,0 +1,129 @@
+/*! @file
+ *
+ *  @brief Routines for setting up and reading from the ADC, and writing to the DAC.
+ *
+ *  The LTC1859 ADC is device 7 and the LTC2704 DAC device 4 of the chip select decoder on SPI2.
+ *  The ADC takes a 16-bit command per frame and starts converting when PCS0 negates; the frame
+ *  clocks out the conversion the previous command started. CTAR0 leaves it the conversion time
+ *  between frames. The DAC takes a 32-bit word, as two frames of CTAR1 with PCS0 held asserted.
+ *  Analog_GetMany runs in the PIT0 interrupt, so a DAC word is sent with interrupts disabled: an
+ *  ADC burst between its frames would move PCS0 to the ADC in the middle of the word.
+ *
+ *  @author 11989668, 13113117
+ *  @date 2018-07-08
+ */
+
+#include "analog.h"
+#include "SPI.h"
+#include "OS.h"
+#include <stddef.h>
+
+#define ADC_DEVICE 7
+#define DAC_DEVICE 4
+
+#define ADC_CTAS 0
+#define DAC_CTAS 1
+
+// LTC1859 command, in the upper byte of the frame
+#define ADC_SGL_MASK     0x8000u       //Single ended input
+#define ADC_ODD_MASK     0x4000u       //Odd channel of the pair
+#define ADC_SELECT_SHIFT 12            //Pair of channels, 2 bits
+#define ADC_UNI_MASK     0x0800u       //Unipolar range
+#define ADC_GAIN_MASK    0x0400u       //Range of +/- 10V rather than +/- 5V
+#define ADC_NAP_MASK     0x0200u
+#define ADC_SLEEP_MASK   0x0100u
+
+// LTC2704 commands
+#define DAC_WRITE_SPAN        0x2
+#define DAC_WRITE_CODE        0x3
+#define DAC_UPDATE            0x4
+#define DAC_WRITE_CODE_UPDATE 0x7
+#define DAC_ALL               0xF      //Address of all the DACs
+#define DAC_SPAN_BIPOLAR_10V  0x3
+
+static const uint8_t DAC_ADDRESSES[ANALOG_NB_OUTPUTS] = {0x0, 0x2, 0x4, 0x6};
+
+static const TSPIModule SPI_SETUP =
+{
+  true,                                //isMaster
+  false,                               //continuousClock
+  {
+    {16, false, false, false, 5000, 1000000}, //ADC: 16-bit frames, then the conversion time
+    {16, false, false, false, 0, 1000000}     //DAC: 16-bit frames, back to back
+  }
+};
+
+/*! @brief Builds the LTC1859 command that converts an input channel.
+ *
+ *  @param channelNb The analog input channel.
+ *  @return uint16_t - The frame.
+ */
+static uint16_t ADCCommand(const uint8_t channelNb)
+{
+  return ADC_SGL_MASK | ADC_GAIN_MASK | ((channelNb >> 1) << ADC_SELECT_SHIFT) | ((channelNb & 0x1) ? ADC_ODD_MASK : 0);
+}
+
+/*! @brief Sends a 32-bit word to the LTC2704.
+ *
+ *  @param command The command.
+ *  @param address The DAC, or DAC_ALL.
+ *  @param data The code or span.
+ *  @note Must not be called from an interrupt, interrupts are enabled on return.
+ */
+static void DACWrite(const uint8_t command, const uint8_t address, const uint16_t data)
+{
+  OS_DisableInterrupts();
+  SPI_SelectSlaveDevice(DAC_DEVICE);
+  SPI_Exchange(((command & 0xF) << 4) | (address & 0xF), NULL, DAC_CTAS, true);
+  SPI_Exchange(data, NULL, DAC_CTAS, false);
+  OS_EnableInterrupts();
+}
+
+bool Analog_Init(const uint32_t moduleClock)
+{
+  if (!SPI_Init(&SPI_SETUP, moduleClock))
+    return false;
+
+  DACWrite(DAC_WRITE_SPAN, DAC_ALL, DAC_SPAN_BIPOLAR_10V);
+  DACWrite(DAC_WRITE_CODE, DAC_ALL, 0x8000);               //0V
+  DACWrite(DAC_UPDATE, DAC_ALL, 0x8000);
+
+  return true;
+}
+
+bool Analog_Get(const uint8_t channelNb, int16_t* const valuePtr)
+{
+  return Analog_GetMany(&channelNb, valuePtr, 1);
+}
+
+bool Analog_GetMany(const uint8_t channelNb[], int16_t values[], const uint8_t nbChannels)
+{
+  if (nbChannels == 0 || nbChannels > ANALOG_NB_INPUTS || !values)
+    return false;
+
+  for (uint8_t i = 0; i < nbChannels; i++)
+    if (channelNb[i] >= ANALOG_NB_INPUTS)
+      return false;
+
+  SPI_SelectSlaveDevice(ADC_DEVICE);
+
+  //The first frame only starts a conversion, the last only fetches one
+  SPI_Exchange(ADCCommand(channelNb[0]), NULL, ADC_CTAS, false);
+  for (uint8_t i = 0; i < nbChannels; i++)
+  {
+    uint16_t next = ADCCommand(channelNb[(i + 1 < nbChannels) ? i + 1 : 0]);
+    SPI_Exchange(next, (uint16_t*) &values[i], ADC_CTAS, false);
+  }
+
+  return true;
+}
+
+bool Analog_Put(uint8_t const channelNb, int16_t const value)
+{
+  if (channelNb >= ANALOG_NB_OUTPUTS)
+    return false;
+
+  DACWrite(DAC_WRITE_CODE_UPDATE, DAC_ADDRESSES[channelNb], (uint16_t) value ^ 0x8000); //Two's complement to offset binary
+
+  return true;
+}
@@ -36,11 +36,23 @@ bool Analog_Init(const uint32_t moduleClock);
  */
 bool Analog_Get(const uint8_t channelNb, int16_t* const valuePtr);
 
+/*! @brief Gets a value from each of several analog input channels, in one burst of conversions.
+ *
+ *  The LTC1859 returns each conversion during the transfer of the next command, so N channels
+ *  take N + 1 frames, where N calls to Analog_Get take 2N.
+ *  @param channelNb The analog input channels, in the order they are converted.
+ *  @param values Where to place the analog values, one per channel.
+ *  @param nbChannels The number of channels, 1 to ANALOG_NB_INPUTS.
+ *  @return bool - true if the analog values were acquired successfully.
+ */
+bool Analog_GetMany(const uint8_t channelNb[], int16_t values[], const uint8_t nbChannels);
+
 /*! @brief Sends a value to an analog input channel.
  *
  *  @param channelNb is the number of the analog output channel to send the value to.
  *  @param value is the value to write to the analog channel.
  *  @return bool - true if the analog value was output successfully.
+ *  @note Called from a thread, never an interrupt: it briefly disables interrupts so an Analog_GetMany in an interrupt cannot split the DAC word.
  */
 bool Analog_Put(uint8_t const channelNb, int16_t const value);
 
@@ -32,14 +32,28 @@
 #include "types.h"
 
 #include "PIT.h"
+#include "Timer.h"
+#include "Time.h"
 #include "UART.h"
 #include "packet.h"
 #include "Flash.h"
 #include "LEDs.h"
 #include "FFT_UT.h"
+#include "EventLog.h"
 
 #define NB_ANALOG_CHANNELS 3
 
+// Samples taken per cycle of the input, a power of two: SAMPLES_PER_CYCLE at reset, up to SAMPLES_PER_CYCLE_MAX
+// at run time. 256 leaves no time between samples: sampling the channels keeps SPI2 busy for 77us, and 256
+// samples of a 50Hz cycle are 78us apart.
+#ifndef SAMPLES_PER_CYCLE
+#define SAMPLES_PER_CYCLE 16
+#endif
+#ifndef SAMPLES_PER_CYCLE_MAX
+#define SAMPLES_PER_CYCLE_MAX 128
+#endif
+#define SAMPLES_PER_CYCLE_MIN 16
+
 /*! @brief Data structure used to pass Analog configuration to a user thread
  *
  */
@@ -50,8 +64,15 @@ typedef struct AnalogThreadData
   double rms;
   uint8_t alarm;         //0 for nit triggered, 1 high trigger, 2 for low triggered
   double deviation;      //Deviation from acceptable SetDefaultFlashValues
-  int16_t samples[16];   //Deviation from acceptable SetDefaultFlashValues
+  int16_t windows[2][SAMPLES_PER_CYCLE_MAX];  //Sample windows, window n in windows[n & 1]: see WindowNb
   uint16_t trigCount;    //Deviation from acceptable SetDefaultFlashValues
+  uint16_t overruns;     //Windows whose processing outlasted the filling of the next one
+  uint32_t cost;         //Bus clocks the last window took to process
+  uint64_t cycleSquares; //Sum of the squared samples of the last cycle, slid on by every sample
+  uint64_t halfSquares;  //Sum of the squared samples of the last half cycle, slid on by every sample
+  uint64_t windowSquares[2];  //cycleSquares when each window in windows was completed
+  uint16_t nbSlid;       //Samples in cycleSquares, up to a cycle: 0 after the samples per cycle change
+  uint8_t halfCycle;     //0 if the half cycle RMS is within the thresholds, 1 for a swell, 2 for a sag
 
 } TAnalogThreadData;
 
@@ -66,7 +87,6 @@ static TAnalogThreadData ChannelData[NB_ANALOG_CHANNELS] =
     .rms = 0.0,
     .alarm =0,
     .deviation = 0.0,
-    .samples[0] = 0,
     .trigCount = 0
   },
   {  //Channel B in
@@ -75,7 +95,6 @@ static TAnalogThreadData ChannelData[NB_ANALOG_CHANNELS] =
     .rms = 0.0,
     .alarm =0,
     .deviation = 0.0,
-    .samples[0] = 0,
     .trigCount = 0
   },
   {  //Channel C in
@@ -84,7 +103,6 @@ static TAnalogThreadData ChannelData[NB_ANALOG_CHANNELS] =
     .rms = 0.0,
     .alarm =0,
     .deviation = 0.0,
-    .samples[0] = 0,
     .trigCount = 0
   },
 };
@@ -109,6 +127,10 @@ static TAnalogThreadData ChannelData[NB_ANALOG_CHANNELS] =
 
 const static double LO_TRESHHOLD = 2.00;
 const static double HI_TRESHHOLD = 3.00;
+const static double SAG_SWELL_HYSTERESIS = 0.05;  //V, a sag or swell ends this far within the threshold
+
+//Half cycle sums of squares the thresholds come to, for the samples per cycle: see SetSagSwellLimits
+static uint64_t SwellStart, SwellEnd, SagStart, SagEnd;
 
 //Variables for keeping track of each raise or lower
 static bool Raise = false;
@@ -122,8 +144,7 @@ static bool Triggered = false;
 OS_THREAD_STACK(InitModulesThreadStack, THREAD_STACK_SIZE); /*!< The stack for the LED Init thread. */
 static uint32_t AnalogThreadStacks[NB_ANALOG_CHANNELS][THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));
 //-------         -----------------       --------------
-extern OS_ECB *PIT0_Semaphore;           /*!< Binary semaphore for signaling PIT0 interrupt */
-extern OS_ECB *PIT1_Semaphore;           /*!< Binary semaphore for signaling PIT1 interrupt */
+static OS_ECB *PIT0_Semaphore;           /*!< Binary semaphore for signaling PIT0 interrupt */
 OS_ECB *SamplesReadySem;
 OS_ECB *AlarmEventSem;
 
@@ -131,9 +152,11 @@ OS_ECB *AlarmEventSem;
 //Stacks
 static uint32_t PacketThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));   /*!< The stack for the packet checking thread. */
 static uint32_t PIT0ThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));   /*!< The stack for the packet checking thread. */
-static uint32_t PIT1ThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));   /*!< The stack for the packet checking thread. */
+static uint32_t TimerThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));   /*!< The stack for the timer thread. */
 static uint32_t RxThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));   /*!< The stack for the packet checking thread. */
 static uint32_t TxThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));   /*!< The stack for the packet checking thread. */
+static uint32_t FlashCommitThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));   /*!< The stack for the flash commit thread. */
+static uint32_t EventLogThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));   /*!< The stack for the event log thread. */
 
 
 //-------         -----------------       --------------
@@ -148,23 +171,46 @@ const uint8_t ANALOG_THREAD_PRIORITIES[NB_ANALOG_CHANNELS] = {3, 4, 5};
 volatile uint8_t *Timing_Mode;       //1 definitive, 2 inverse
 volatile uint8_t *NbRaises;          //Number of raises done
 volatile uint8_t *NbLowers;          //Number of lowers done
+volatile uint16_t *NvSamplesPerCycle; //Samples per cycle set by the last samples per cycle packet
+#define SAMPLES_PER_CYCLE_RECORD 0x01 //Id of the record of NvSamplesPerCycle
 //TODO Check if it is fine to store NbRaises and NbLowers in s single byte
 int16union_t FrequencyInt;    //Frecuency
 static float Frequency;
 static float PeriodNs;
 static float SamplingRate;
-
-const static uint64_t PIT1_RATE = 10000000;  //100Hz
-
-static void PITCallback(void* arg);
-double rmsCalc(int16_t samples[16]);
+static uint32_t SampleJitterPeak;   //Largest deviation of a sample interval from the PIT0 period, in bus clocks
+
+#define JITTER_NB_BINS 8
+static const uint32_t JITTER_BIN_LIMITS[JITTER_NB_BINS - 1] = {1000, 2000, 5000, 10000, 20000, 50000, 100000}; //ns, upper limit of each bin but the last
+static uint16_t SampleJitterHistogram[JITTER_NB_BINS];  //Sample intervals by deviation from the PIT0 period, saturating
+
+static bool SampleInISR = true;     //Samples are taken in the PIT0 interrupt, instead of in PIT0Thread
+static uint16_t NbSamples;          //Samples taken in the current window
+static uint16_t NbSamplesPerCycle = SAMPLES_PER_CYCLE;  //Samples in a window, changed only while PIT0 is stopped
+static volatile uint32_t WindowNb;  //Windows completed: the last is in windows[WindowNb & 1], the other is being filled
+static uint16_t WindowLength[2];    //Samples in each window, NbSamplesPerCycle when it was filled
+static uint64_t WindowTime[2];      //Time_Now64 when each window was completed
+static uint32_t LastSampleOffset;   //PIT_Elapsed(0) at the previous sample
+static bool SampleOffsetValid;      //LastSampleOffset is from the previous period
+
+const static uint32_t ALARM_TICK_PERIOD = 10;  //ms, 100Hz
+static TTimer AlarmTimer;                     //Advances the alarm timing while an alarm, raise or lower is on
+
+static void StartAlarmTick(void);
+static void SetSamplingMode(const bool inISR);
+static bool SetSamplesPerCycle(const uint16_t nbSamples);
+static void SetSagSwellLimits(void);
+static double SlidingRMS(TAnalogThreadData* const data);
+static void AlarmTick(void* arg);
+double squaresToRMS(uint64_t squares, uint16_t nbSamples);
+uint64_t rmsToSquares(double rms, uint16_t nbSamples);
 int16_t voltageToRaw(double voltage);
-void FrequencyTracking(uint8_t index);
+void FrequencyTracking(const int16_t samples[], uint16_t length, uint16_t index);
 double Spectral_Analysis(unsigned long k);
 
 //Packet Handling Functions
 //{
-  #define STARTUP_COMMAND 0x04
+  #define STARTUP_COMMAND PACKET_STARTUP_COMMAND
   #define READ_BYTE_COMMAND 0x08
   #define PROGRAM_BYTE_COMMAND 0x07
 
@@ -174,6 +220,12 @@ double Spectral_Analysis(unsigned long k);
   #define FREQUENCY_COMMAND 0x17
   #define VOLTAGE_COMMAND 0x18
   #define SPECTRUM_COMMAND 0x19
+  #define EVENT_LOG_COMMAND 0x1A
+  #define JITTER_COMMAND 0x1B
+  #define SAMPLING_MODE_COMMAND 0x1C
+  #define SAMPLES_PER_CYCLE_COMMAND 0x1D
+
+  #define EVENT_LOG_PAGE_SIZE 8  //Maximum number of events returned by one event log command
 
   static const uint8_t towerNumberHi = 0x31;
   static const uint8_t towerNumberLo = 0x17;
@@ -191,43 +243,58 @@ double Spectral_Analysis(unsigned long k);
   	PacketParameter1,
   	PacketParameter2,
   	PacketParameter3;
+
+  static TPacketCheck NegotiatedCheck = PACKET_CHECK_XOR;  //Frame check to use once the current command has been answered
+  static TPacketBatch ReplyBatch;    //Replies of PacketThread, sent with their ACK/NACK
   //TODO: Remove PacketCommand et al, and change it in the functions
 
   /*! @brief Tries to get the Mode and Number values from flash, if not there, sets the defaults
+   *  Defaults are only provisioned on a blank device: a restored counter of 0xFF is a real count.
+   *  The samples per cycle are kept in a record, so they are found again by id whatever the variables;
+   *  a valid stored value is applied at once.
    *  @return bool - TRUE if everything if the read (of the stored values) or writes (of defaults) are succesfull
    */
   bool SetDefaultFlashValues()
   {
+    bool blank = (Flash_BootState() == FLASH_BOOT_BLANK);
+
     if (!Flash_AllocateVar(&Timing_Mode, sizeof(*Timing_Mode)))  //Allocate the flash space for timing mode
       return false;
-    if (*Timing_Mode == 0xFF)
-      if(!Flash_Write8(Timing_Mode, 0x01))           //If flash is empty, use default value
-        return false;
-
     if (!Flash_AllocateVar(&NbRaises, sizeof(*NbRaises)))        //Allocate the flash space for number of raises
       return false;
-    if (*NbRaises == 0xFF)
-      if(!Flash_Write8(NbRaises, 0x00))              //If flash is empty, use default value
-        return false;
-
     if (!Flash_AllocateVar(&NbLowers, sizeof(*NbLowers)))        //Allocate the flash space for number of lowers
       return false;
-    if (*NbLowers == 0xFF)
-      if (!Flash_Write8(NbLowers, 0x00))             //If flash is empty, use default value
-        return false;
-    return true;
+    if (!Flash_AllocateRecord(SAMPLES_PER_CYCLE_RECORD, sizeof(*NvSamplesPerCycle), (volatile void**)&NvSamplesPerCycle))
+      return false;
+
+    bool success = true;
+
+    Flash_BeginTransaction();                        //The defaults land together, in one program
+    if (blank || (*Timing_Mode != 1 && *Timing_Mode != 2))
+      success &= Flash_Write8(Timing_Mode, 0x01);    //If flash is empty, or the mode invalid, use default value
+    if (blank)
+    {
+      success &= Flash_Write8(NbRaises, 0x00);       //If flash is empty, use default value
+      success &= Flash_Write8(NbLowers, 0x00);
+    }
+    if (!SetSamplesPerCycle(*NvSamplesPerCycle))
+      success &= Flash_Write16(NvSamplesPerCycle, NbSamplesPerCycle); //Erased or invalid, keep the reset value
+
+    return Flash_CommitTransaction() && success;
   }
 
   /*! @brief Sends the startup packet.
+   *  @param check The frame check the tower will use, reported in parameter 1.
    *  @return bool - TRUE if data is successfully sent.
    */
-  bool SendStartupPacket()
+  bool SendStartupPacket(const TPacketCheck check)
   {
     PacketCommand = STARTUP_COMMAND;
-    PacketParameter1 = 0;
+    PacketParameter1 = check;
     PacketParameter2 = 0;
     PacketParameter3 = 0;
-    Packet_Put(PacketCommand, PacketParameter1, PacketParameter2, PacketParameter3);
+    Packet_PutBatch(&ReplyBatch, PacketCommand, PacketParameter1, PacketParameter2, PacketParameter3);
+    return true;
   }
 
   /*! @brief Sends the Read Byte from Flash packet.
@@ -238,18 +305,25 @@ double Spectral_Analysis(unsigned long k);
     PacketCommand = READ_BYTE_COMMAND;
     uint8_t byte;
 
-    Flash_ReadByte(offset, &byte);
-    Packet_Put(READ_BYTE_COMMAND, offset, 0, byte);
+    if (!Flash_ReadByte(offset, &byte))
+      return false;
+    Packet_PutBatch(&ReplyBatch, READ_BYTE_COMMAND, offset, 0, byte);
+    return true;
   }
 
   /*! @brief Handles a received startup packet.
+   *
+   *  Parameter 1 is the frame check requested by the PC: 0 (old PC software) for XOR, 1 for CRC-8.
+   *  The reply and the ACK still use the current check, the new one applies from the next packet.
    *  @return bool - TRUE if data is correct and corresponds to the packet.
    */
   bool HandleStartupPacket()
   {
-    if (Packet_Parameter1 != 0 || Packet_Parameter2 != 0 || Packet_Parameter3 != 0) //Check that the values are correct
+    if (Packet_Parameter1 > PACKET_CHECK_CRC8 || Packet_Parameter2 != 0 || Packet_Parameter3 != 0) //Check that the values are correct
       return false;
-    if (!SendStartupPacket())
+
+    NegotiatedCheck = (TPacketCheck)Packet_Parameter1;
+    if (!SendStartupPacket(NegotiatedCheck))
       return false;
 
     return true;
@@ -260,13 +334,12 @@ double Spectral_Analysis(unsigned long k);
    */
   bool HandleProgramBytePacket()
   {
-      if (Packet_Parameter1 > 8 || Packet_Parameter1 < 0 || Packet_Parameter2 != '0' || Packet_Parameter3 != 0)  //Check that the values are correct
+      if (Packet_Parameter1 > FLASH_VARIABLES_SIZE || Packet_Parameter1 < 0 || Packet_Parameter2 != '0' || Packet_Parameter3 != 0)  //Check that the values are correct
         return false;
 
-      if (PacketParameter1 == 8)
+      if (Packet_Parameter1 == FLASH_VARIABLES_SIZE)  //One past the variables erases them all
         return Flash_Erase();
-      volatile uint32_t* const address = FLASH_DATA_START + Packet_Parameter1;
-      return Flash_Write8(address, Packet_Parameter3);
+      return Flash_WriteByte(Packet_Parameter1, Packet_Parameter3);
   }
 
   /*! @brief Handles a received READ_BYTE_COMMAND packet.
@@ -274,7 +347,7 @@ double Spectral_Analysis(unsigned long k);
    */
   bool HandleReadBytePacket()
   {
-      if (Packet_Parameter1 > 7 || Packet_Parameter1 < 0 || Packet_Parameter2 != '0' || Packet_Parameter3 != 0)  //Check that the values are correct
+      if (Packet_Parameter1 >= FLASH_VARIABLES_SIZE || Packet_Parameter1 < 0 || Packet_Parameter2 != '0' || Packet_Parameter3 != 0)  //Check that the values are correct
         return false;
       return SendReadBytePacket(Packet_Parameter1);
   }
@@ -287,7 +360,7 @@ double Spectral_Analysis(unsigned long k);
     if (Packet_Parameter1 > 2 ||Packet_Parameter1 < 0 || Packet_Parameter2 != 0 || Packet_Parameter3 != 0) //Check that the values are correct
       return false;
     if (Packet_Parameter1 == 0)
-      Packet_Put(TIMING_MODE_COMMAND, *Timing_Mode, 0, 0);
+      Packet_PutBatch(&ReplyBatch, TIMING_MODE_COMMAND, *Timing_Mode, 0, 0);
     else if (!Flash_Write8(Timing_Mode, Packet_Parameter1))
       return false;
       //TODO check if this is enough for changing the timing mode
@@ -303,7 +376,7 @@ double Spectral_Analysis(unsigned long k);
     if (Packet_Parameter1 > 1 || Packet_Parameter1 < 0 || Packet_Parameter2 != 0 || Packet_Parameter3 != 0) //Check that the values are correct
       return false;
     if (Packet_Parameter1 == 0)
-      Packet_Put(NB_RAISES_COMMAND, *NbRaises, 0, 0);
+      Packet_PutBatch(&ReplyBatch, NB_RAISES_COMMAND, *NbRaises, 0, 0);
     else if (!Flash_Write8((uint8_t *)NbRaises, 0x00))
       return false;
 
@@ -318,7 +391,7 @@ double Spectral_Analysis(unsigned long k);
     if (Packet_Parameter1 > 1 || Packet_Parameter1 < 0 || Packet_Parameter2 != 0 || Packet_Parameter3 != 0) //Check that the values are correct
       return false;
     if (Packet_Parameter1 == 0)
-      Packet_Put(NB_LOWERS_COMMAND, *NbLowers, 0, 0);
+      Packet_PutBatch(&ReplyBatch, NB_LOWERS_COMMAND, *NbLowers, 0, 0);
     else if (!Flash_Write8((uint8_t *)NbLowers, 0x00))
       return false;
 
@@ -326,6 +399,8 @@ double Spectral_Analysis(unsigned long k);
   }
 
   /*! @brief Handles a received voltage packet.
+   *
+   *  The voltage is the RMS over the last cycle, up to the last sample taken.
    *  @return bool - TRUE if data is correct and corresponds to the packet.
    */
   bool HandleVoltagePacket()
@@ -333,11 +408,11 @@ double Spectral_Analysis(unsigned long k);
     if (Packet_Parameter1 < 1 || Packet_Parameter1 > 3 || Packet_Parameter2 != 0 || Packet_Parameter3 != 0) //Check that the values are correct
       return false;
 
-    double voltage = ChannelData[Packet_Parameter1-1].rms;
+    double voltage = SlidingRMS(&ChannelData[Packet_Parameter1-1]);
     uint8_t unit = (uint8_t)voltage;
     uint8_t decimal = (uint8_t)((voltage-unit)*100);
 
-    Packet_Put(VOLTAGE_COMMAND, Packet_Parameter1, unit, decimal);
+    Packet_PutBatch(&ReplyBatch, VOLTAGE_COMMAND, Packet_Parameter1, unit, decimal);
 
     return true;
   }
@@ -353,7 +428,7 @@ double Spectral_Analysis(unsigned long k);
     uint8_t unit = (uint8_t)Frequency;
     uint8_t decimal = (uint8_t)((Frequency-unit)*100);
 
-    Packet_Put(FREQUENCY_COMMAND, unit, decimal, 0);
+    Packet_PutBatch(&ReplyBatch, FREQUENCY_COMMAND, unit, decimal, 0);
 
     return true;
   }
@@ -363,14 +438,184 @@ double Spectral_Analysis(unsigned long k);
      */
   bool HandleSpectrumPacket()
   {
-    if (Packet_Parameter1 < 0 || Packet_Parameter1 > 7 || Packet_Parameter2 != 0 || Packet_Parameter3 != 0) //Check that the values are correct
+    if (Packet_Parameter1 >= NbSamplesPerCycle / 2 || Packet_Parameter2 != 0 || Packet_Parameter3 != 0) //Check that the values are correct
       return false;
 
     double spectrum = Spectral_Analysis(Packet_Parameter1);
     uint8_t unit = (uint8_t)spectrum;
     uint8_t decimal = (uint8_t)((spectrum-unit)*100);
 
-    Packet_Put(SPECTRUM_COMMAND,Packet_Parameter1 ,unit , decimal);
+    Packet_PutBatch(&ReplyBatch, SPECTRUM_COMMAND,Packet_Parameter1 ,unit , decimal);
+
+    return true;
+  }
+
+  /*! @brief Handles a received event log packet: pages through the log, oldest event first.
+   *
+   *  Parameters 1 and 2 are the index of the first event (lo, hi), parameter 3 the number of events.
+   *  The reply is a packet with the number of events returned and the number of events logged (lo, hi),
+   *  then 4 packets per event: time in bus clocks (bits 0 to 31, 4 bytes), type << 4 | channel,
+   *  rms and deviation in mV (2 bytes each), then time bits 32 to 55 (3 bytes).
+   *  @return bool - TRUE if data is correct and corresponds to the packet.
+   */
+  bool HandleEventLogPacket()
+  {
+    if (Packet_Parameter3 < 1 || Packet_Parameter3 > EVENT_LOG_PAGE_SIZE) //Check that the values are correct
+      return false;
+
+    uint16union_t first;
+    first.s.Lo = Packet_Parameter1;
+    first.s.Hi = Packet_Parameter2;
+
+    uint16union_t count;
+    count.l = EventLog_Count();
+
+    uint8_t nbEvents = 0;
+    if (first.l < count.l)
+      nbEvents = (count.l - first.l < Packet_Parameter3) ? count.l - first.l : Packet_Parameter3;
+
+    Packet_PutBatch(&ReplyBatch, EVENT_LOG_COMMAND, nbEvents, count.s.Lo, count.s.Hi);
+
+    for (uint8_t i = 0; i < nbEvents; i++)
+    {
+      TEvent event;
+      if (!EventLog_Get(first.l + i, &event))
+        return false;
+
+      uint8_t bytes[12] =
+      {
+        event.time, event.time >> 8, event.time >> 16, event.time >> 24,
+        (event.type << 4) | (event.channel & 0x0F),
+        event.rms, event.rms >> 8,
+        event.deviation, event.deviation >> 8,
+        event.timeHi[0], event.timeHi[1], event.timeHi[2]
+      };
+
+      for (uint8_t j = 0; j < sizeof(bytes); j += 3)
+        Packet_PutBatch(&ReplyBatch, EVENT_LOG_COMMAND, bytes[j], bytes[j + 1], bytes[j + 2]);
+    }
+
+    return true;
+  }
+
+  /*! @brief Sends a packet of the jitter reply carrying a duration in us, saturated to 16 bits.
+   *
+   *  @param index The index of the packet, in parameter 1.
+   *  @param ticks The duration, in module clocks.
+   */
+  void PutJitterMicroseconds(const uint8_t index, const uint64_t ticks)
+  {
+    uint64_t us = Time_ToNs(ticks) / 1000;
+
+    uint16union_t value;
+    value.l = (us > UINT16_MAX) ? UINT16_MAX : us;
+
+    Packet_PutBatch(&ReplyBatch, JITTER_COMMAND, index, value.s.Lo, value.s.Hi);
+  }
+
+  /*! @brief Handles a received sample jitter packet.
+   *
+   *  Parameter 1 is 1 to clear the peak and the histogram once read, 0 to keep them.
+   *  The reply carries the largest deviation of a sample interval from the sampling period, in ns (lo, hi),
+   *  then a packet per bin of the histogram: the bin, and the number of intervals in it (lo, hi).
+   *  The bins are the deviations below 1, 2, 5, 10, 20, 50 and 100 us, and the rest.
+   *  Then packet JITTER_NB_BINS carries the time from this command being received to being handled, and
+   *  packet JITTER_NB_BINS + 1 the age of the last complete window, both in us (lo, hi).
+   *  Last, a packet per channel: JITTER_NB_BINS + 2 + the channel, and the windows it overran (lo, hi),
+   *  those whose processing outlasted the filling of the next one. They are cleared with the histogram.
+   *  @return bool - TRUE if data is correct and corresponds to the packet.
+   */
+  bool HandleJitterPacket()
+  {
+    if (Packet_Parameter1 > 1)              //Check that the values are correct
+      return false;
+
+    uint64_t peakNs = (uint64_t) SampleJitterPeak * 1000000000 / CPU_BUS_CLK_HZ;
+
+    uint16union_t peak;
+    peak.l = (peakNs > UINT16_MAX) ? UINT16_MAX : peakNs;
+
+    Packet_PutBatch(&ReplyBatch, JITTER_COMMAND, peak.s.Lo, peak.s.Hi, 0);
+
+    for (uint8_t bin = 0; bin < JITTER_NB_BINS; bin++)
+    {
+      uint16union_t count;
+      count.l = SampleJitterHistogram[bin];
+      Packet_PutBatch(&ReplyBatch, JITTER_COMMAND, bin, count.s.Lo, count.s.Hi);
+    }
+
+    uint64_t now = Time_Now64();
+    OS_DisableInterrupts();              //TakeSample may be completing a window
+    uint64_t windowTime = WindowTime[WindowNb & 1];
+    OS_EnableInterrupts();
+
+    PutJitterMicroseconds(JITTER_NB_BINS, now - Packet_Time);
+    PutJitterMicroseconds(JITTER_NB_BINS + 1, now - windowTime);
+
+    for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+    {
+      uint16union_t overruns;
+      overruns.l = ChannelData[analogNb].overruns;
+      Packet_PutBatch(&ReplyBatch, JITTER_COMMAND, JITTER_NB_BINS + 2 + analogNb, overruns.s.Lo, overruns.s.Hi);
+    }
+
+    if (Packet_Parameter1 == 1)
+    {
+      SampleJitterPeak = 0;
+      for (uint8_t bin = 0; bin < JITTER_NB_BINS; bin++)
+        SampleJitterHistogram[bin] = 0;
+      for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+        ChannelData[analogNb].overruns = 0;
+    }
+
+    return true;
+  }
+
+  /*! @brief Handles a received sampling mode packet.
+   *
+   *  Parameter 1 is 0 to get the mode, 1 to sample in PIT0Thread, 2 to sample in the PIT0 interrupt.
+   *  @return bool - TRUE if data is correct and corresponds to the packet.
+   */
+  bool HandleSamplingModePacket()
+  {
+    if (Packet_Parameter1 > 2 || Packet_Parameter2 != 0 || Packet_Parameter3 != 0) //Check that the values are correct
+      return false;
+    if (Packet_Parameter1 == 0)
+      Packet_PutBatch(&ReplyBatch, SAMPLING_MODE_COMMAND, SampleInISR ? 2 : 1, 0, 0);
+    else
+      SetSamplingMode(Packet_Parameter1 == 2);
+
+    return true;
+  }
+
+  /*! @brief Handles a received samples per cycle packet.
+   *
+   *  Parameters 1 and 2 are the samples per cycle to take (lo, hi), a power of two from 16 to SAMPLES_PER_CYCLE_MAX,
+   *  or 0 to get them. The samples per cycle set are kept in flash for the next reset. The reply carries the samples per cycle (lo, hi), then a packet per channel: the channel,
+   *  and the time its last window took to process, in us (lo, hi).
+   *  @return bool - TRUE if data is correct and corresponds to the packet.
+   */
+  bool HandleSamplesPerCyclePacket()
+  {
+    uint16union_t nbSamples;
+    nbSamples.s.Lo = Packet_Parameter1;
+    nbSamples.s.Hi = Packet_Parameter2;
+
+    if (Packet_Parameter3 != 0)        //Check that the values are correct
+      return false;
+    if (nbSamples.l != 0)
+      return SetSamplesPerCycle(nbSamples.l) && Flash_Write16(NvSamplesPerCycle, nbSamples.l);
+
+    nbSamples.l = NbSamplesPerCycle;
+    Packet_PutBatch(&ReplyBatch, SAMPLES_PER_CYCLE_COMMAND, nbSamples.s.Lo, nbSamples.s.Hi, 0);
+
+    for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+    {
+      uint64_t costUs = (uint64_t) ChannelData[analogNb].cost * 1000000 / CPU_BUS_CLK_HZ;
+      uint16union_t cost;
+      cost.l = (costUs > UINT16_MAX) ? UINT16_MAX : costUs;
+      Packet_PutBatch(&ReplyBatch, SAMPLES_PER_CYCLE_COMMAND, ChannelData[analogNb].channelNb, cost.s.Lo, cost.s.Hi);
+    }
 
     return true;
   }
@@ -383,17 +628,19 @@ double Spectral_Analysis(unsigned long k);
   {
     bool ErrorStatus = false;
 
+    Packet_BeginBatch(&ReplyBatch);      //Reply and ACK/NACK leave together
+
     switch(Packet_Command & ~PACKET_ACK_MASK){
       case STARTUP_COMMAND:
         ErrorStatus = HandleStartupPacket();
         break;
 
       case PROGRAM_BYTE_COMMAND:
-        ErrorStatus = HandleReadBytePacket();
+        ErrorStatus = HandleProgramBytePacket();
         break;
 
       case READ_BYTE_COMMAND:
-        ErrorStatus = HandleProgramBytePacket();
+        ErrorStatus = HandleReadBytePacket();
         break;
 
       case TIMING_MODE_COMMAND:
@@ -420,6 +667,22 @@ double Spectral_Analysis(unsigned long k);
         ErrorStatus = HandleSpectrumPacket();
         break;
 
+      case EVENT_LOG_COMMAND:
+        ErrorStatus = HandleEventLogPacket();
+        break;
+
+      case JITTER_COMMAND:
+        ErrorStatus = HandleJitterPacket();
+        break;
+
+      case SAMPLING_MODE_COMMAND:
+        ErrorStatus = HandleSamplingModePacket();
+        break;
+
+      case SAMPLES_PER_CYCLE_COMMAND:
+        ErrorStatus = HandleSamplesPerCyclePacket();
+        break;
+
       default:
         break;
     }
@@ -433,11 +696,14 @@ double Spectral_Analysis(unsigned long k);
 
     if (Packet_Command & PACKET_ACK_MASK) {  //Check if an ACK is required, and send it (or the NACK)
       if (ErrorStatus)
-        Packet_Put(Packet_Command, Packet_Parameter1, Packet_Parameter2, Packet_Parameter3);
+        Packet_PutBatch(&ReplyBatch, Packet_Command, Packet_Parameter1, Packet_Parameter2, Packet_Parameter3);
       else
-        Packet_Put(Packet_Command & ~PACKET_ACK_MASK, Packet_Parameter1, Packet_Parameter2, Packet_Parameter3);
+        Packet_PutBatch(&ReplyBatch, Packet_Command & ~PACKET_ACK_MASK, Packet_Parameter1, Packet_Parameter2, Packet_Parameter3);
     }
 
+    Packet_CommitBatch(&ReplyBatch);
+    Packet_SetCheck(NegotiatedCheck);  //Switch frame check only after the startup reply and its ACK have been sent
+
     return ErrorStatus;
   }
 //}
@@ -453,24 +719,30 @@ static void InitModulesThread(void* pData)
 
   Frequency = 50;
   PeriodNs = (1 / Frequency) * 1000000000;
-  SamplingRate = PeriodNs / 16;
+  SamplingRate = PeriodNs / NbSamplesPerCycle;
+  SetSagSwellLimits();
   // Analog
   (void)Analog_Init(CPU_BUS_CLK_HZ);
   LEDs_Init();
   if(Packet_Init(BAUD_RATE, CPU_BUS_CLK_HZ))
     LEDs_On(LED_ORANGE);
-  Flash_Init();
-  PIT_Init(CPU_BUS_CLK_HZ, PITCallback, NULL);
-
-  PIT_Set(0, (uint64_t)SamplingRate, true);
-  PIT_Set(1, PIT1_RATE, true);
-  PIT_Enable(1, false);               //Make sure its not on at start, only when needed
-
+  PIT_Init(CPU_BUS_CLK_HZ, NULL, NULL);
+  Time_Init(CPU_BUS_CLK_HZ);
+  Timer_Init(CPU_BUS_CLK_HZ);
 
   // Generate the global analog semaphores
+  PIT0_Semaphore = OS_SemaphoreCreate(0);
   for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
     ChannelData[analogNb].semaphore = OS_SemaphoreCreate(0);
 
+  // Every semaphore exists now: Flash_Init lets the other threads run while it erases or programs
+  EventLog_Init();
+  Flash_Init();
+
+  SetSamplingMode(SampleInISR);
+  PIT_Set(0, (uint64_t)SamplingRate, true);
+  SamplingRate = PIT_GetPeriod(0) / 1000.0f;                   //What PIT0 achieves, in ns
+
   // We only do this once - therefore delete this thread
   OS_ThreadDelete(OS_PRIORITY_SELF);
 }
@@ -482,134 +754,325 @@ void SamplingThread(void* pData){
   uint8_t nbSamples = 0;
   for (;;){
     OS_SemaphoreWait(threadData->semaphore,0);
-                                      //Resets the amount of samples taken
-    threadData->rms = rmsCalc(threadData->samples);      //Calculates the RMS value
+    uint64_t start = Time_Now64();
+    uint32_t windowNb = WindowNb;                       //The window to process, acquisition fills the other one meanwhile
+    uint16_t length = WindowLength[windowNb & 1];
+    threadData->rms = squaresToRMS(threadData->windowSquares[windowNb & 1], length);      //The RMS value, slid up to the window as it was taken
+    uint8_t previousAlarm = threadData->alarm;
 
     if(threadData->rms > HI_TRESHHOLD){                                      //Checks if the voltage is above the accepted terms
       threadData->deviation = threadData->rms - HI_TRESHHOLD ;               //stores the deviation
       threadData->alarm = 1;                                                 //marks the alarm as active
-      PIT_Enable(1, true);
+      StartAlarmTick();
     }
     else if(threadData->rms < LO_TRESHHOLD){                                //Checks if the voltage is below the accepted terms
       threadData->deviation = LO_TRESHHOLD - threadData->rms;
       threadData->alarm = 2;
-      PIT_Enable(1, true);
+      StartAlarmTick();
     }
     else
     {
       threadData->alarm = 0;                                               //Lowers alarm
       threadData->trigCount = 0;                                           //resets the timing
     }
-    for(uint8_t i = 1; i < 16; i++){
-      FrequencyTracking(i);
+
+    if ((threadData->alarm != 0) != (previousAlarm != 0))                  //Log the alarm going on or off
+      EventLog_Put(threadData->alarm ? EVENT_ALARM_SET : EVENT_ALARM_CLEAR, threadData->channelNb, threadData->rms, threadData->deviation);
+    for(uint16_t i = 1; i < length; i++){
+      FrequencyTracking(ChannelData[CHA].windows[windowNb & 1], length, i);
 
     }
+
+    if (WindowNb != windowNb && threadData->overruns < UINT16_MAX)  //The next window was completed meanwhile, so acquisition has been refilling this one
+      threadData->overruns++;
+    threadData->cost = Time_Now64() - start;
+  }
+}
+
+/*! @brief Slides the sums of squares of a channel on by one sample, and checks its half cycle RMS for a sag or swell.
+ *
+ *  The sample leaving the cycle is at the same place in the other window, the one leaving the half cycle
+ *  half a window back. The sums are of squared codes, so they are exact and nothing drifts.
+ *  @param data The channel.
+ *  @param filling The window the sample is stored in, at NbSamples.
+ *  @param value The sample.
+ *  @note Called from TakeSample, before NbSamples is incremented.
+ */
+static void Slide(TAnalogThreadData* const data, const uint8_t filling, const int16_t value)
+{
+  const int16_t* window = data->windows[filling];
+  const int16_t* previous = data->windows[filling ^ 1];
+  uint16_t half = NbSamplesPerCycle / 2;
+
+  data->cycleSquares += (int32_t) value * value;
+  data->halfSquares += (int32_t) value * value;
+  if (data->nbSlid >= NbSamplesPerCycle)
+    data->cycleSquares -= (int32_t) previous[NbSamples] * previous[NbSamples];
+  if (data->nbSlid >= half)
+  {
+    int16_t leaving = (NbSamples >= half) ? window[NbSamples - half] : previous[NbSamples + half];
+    data->halfSquares -= (int32_t) leaving * leaving;
+  }
+  if (data->nbSlid < NbSamplesPerCycle)
+    data->nbSlid++;
+
+  if (data->nbSlid < half)           //Not yet a half cycle
+    return;
+
+  uint8_t halfCycle = data->halfCycle;
+  if (data->halfSquares > SwellStart)
+    halfCycle = 1;
+  else if (data->halfSquares < SagStart)
+    halfCycle = 2;
+  else if ((halfCycle == 1 && data->halfSquares < SwellEnd) || (halfCycle == 2 && data->halfSquares > SagEnd))
+    halfCycle = 0;
+
+  if (halfCycle != data->halfCycle)
+  {
+    double rms = squaresToRMS(data->halfSquares, half);
+
+    if (halfCycle == 1)
+      EventLog_Put(EVENT_SWELL, data->channelNb, rms, rms - HI_TRESHHOLD);
+    else if (halfCycle == 2)
+      EventLog_Put(EVENT_SAG, data->channelNb, rms, LO_TRESHHOLD - rms);
+    else
+      EventLog_Put(EVENT_SAG_SWELL_END, data->channelNb, rms, 0.0);
+    data->halfCycle = halfCycle;
   }
 }
 
-//Thread to signal when channels should sample
+/*! @brief Takes a sample of every channel and, once a window is full, wakes the channel threads.
+ *
+ *  @param arg Unused.
+ *  @note Called from the PIT0 interrupt or from PIT0Thread, never both: see SetSamplingMode.
+ */
+static void TakeSample(void* arg)
+{
+  uint8_t channelNb[NB_ANALOG_CHANNELS];
+  int16_t values[NB_ANALOG_CHANNELS];
+  uint8_t filling = (WindowNb + 1) & 1;
+
+  //The reloads of PIT0 are a fixed grid, so a change in the offset from it is a change in the sample interval
+  uint32_t offset = PIT_Elapsed(0);
+  if (SampleOffsetValid)
+  {
+    uint32_t jitter = (offset > LastSampleOffset) ? offset - LastSampleOffset : LastSampleOffset - offset;
+    uint64_t jitterNs = (uint64_t) jitter * 1000000000 / CPU_BUS_CLK_HZ;
+    uint8_t bin = 0;
+
+    if (jitter > SampleJitterPeak)
+      SampleJitterPeak = jitter;
+    while (bin < JITTER_NB_BINS - 1 && jitterNs >= JITTER_BIN_LIMITS[bin])
+      bin++;
+    if (SampleJitterHistogram[bin] < UINT16_MAX)
+      SampleJitterHistogram[bin]++;
+  }
+  LastSampleOffset = offset;
+  SampleOffsetValid = true;
+
+  for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+    channelNb[analogNb] = ChannelData[analogNb].channelNb;
+  Analog_GetMany(channelNb, values, NB_ANALOG_CHANNELS);                          //sample all the channels in one burst
+  for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+  {
+    ChannelData[analogNb].windows[filling][NbSamples] = values[analogNb];         //store the sample
+    Slide(&ChannelData[analogNb], filling, values[analogNb]);
+  }
+  NbSamples++;
+  // Signal the analog channels to take a sample
+  if(NbSamples == NbSamplesPerCycle){
+    for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+      ChannelData[analogNb].windowSquares[filling] = ChannelData[analogNb].cycleSquares;  //The cycle slid up to now is the window
+    WindowTime[filling] = Time_Now64();
+    WindowLength[filling] = NbSamples;
+    WindowNb++;                        //One store hands the window over to processing and starts filling the other one
+    for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)         //if all the samples are ready, signal the next thread
+      OS_SemaphoreSignal(ChannelData[analogNb].semaphore);
+    NbSamples = 0;
+  }
+}
+
+/*! @brief Selects where the samples are taken.
+ *
+ *  @param inISR TRUE to take them in the PIT0 interrupt, so their timing does not depend on the scheduler,
+ *               FALSE to take them in PIT0Thread.
+ *  @note Called while PIT0Thread waits on PIT0_Semaphore, from a thread of lower priority.
+ */
+static void SetSamplingMode(const bool inISR)
+{
+  SampleInISR = inISR;
+  SampleOffsetValid = false;           //The interval across the switch is not the path's own
+  if (inISR)
+    PIT_SetHandler(0, TakeSample, NULL, NULL);
+  else
+    PIT_SetHandler(0, NULL, NULL, PIT0_Semaphore);
+}
+
+/*! @brief Changes the samples taken per cycle, starting a new window.
+ *
+ *  @param nbSamples The samples per cycle, a power of two from SAMPLES_PER_CYCLE_MIN to SAMPLES_PER_CYCLE_MAX.
+ *  @return bool - TRUE if nbSamples is valid.
+ *  @note Called from a thread of lower priority than PIT0Thread. The window being filled is dropped;
+ *        complete windows keep their length in WindowLength.
+ */
+static bool SetSamplesPerCycle(const uint16_t nbSamples)
+{
+  if (nbSamples < SAMPLES_PER_CYCLE_MIN || nbSamples > SAMPLES_PER_CYCLE_MAX || (nbSamples & (nbSamples - 1)))
+    return false;
+
+  PIT_Enable(0, false);                //No sample is taken, not even one already due, until the new period is set
+  NbSamples = 0;                       //The window being filled starts again, WindowNb still tells which it is
+  NbSamplesPerCycle = nbSamples;
+  for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+  {
+    ChannelData[analogNb].cycleSquares = 0;  //The sums slide over windows of the new length
+    ChannelData[analogNb].halfSquares = 0;
+    ChannelData[analogNb].nbSlid = 0;
+  }
+  SetSagSwellLimits();
+  SampleOffsetValid = false;           //The interval across the restart is not a sample interval
+  SamplingRate = PeriodNs / NbSamplesPerCycle;
+  PIT_Set(0, (uint64_t)SamplingRate, true);
+  SamplingRate = PIT_GetPeriod(0) / 1000.0f;                   //What PIT0 achieves, in ns
+
+  return true;
+}
+
+/*! @brief Works out the half cycle sums of squares of the sag and swell thresholds, for the samples per cycle.
+ *
+ */
+static void SetSagSwellLimits(void)
+{
+  uint16_t half = NbSamplesPerCycle / 2;
+
+  SwellStart = rmsToSquares(HI_TRESHHOLD, half);
+  SwellEnd = rmsToSquares(HI_TRESHHOLD - SAG_SWELL_HYSTERESIS, half);
+  SagStart = rmsToSquares(LO_TRESHHOLD, half);
+  SagEnd = rmsToSquares(LO_TRESHHOLD + SAG_SWELL_HYSTERESIS, half);
+}
+
+/*! @brief Gets the RMS of a channel over the last cycle, up to the last sample taken.
+ *
+ *  @param data The channel.
+ *  @return double - The RMS in V, over the samples taken so far if they are not yet a cycle.
+ */
+static double SlidingRMS(TAnalogThreadData* const data)
+{
+  OS_DisableInterrupts();              //TakeSample never changes half of the sum
+  uint64_t squares = data->cycleSquares;
+  uint16_t nbSlid = data->nbSlid;
+  OS_EnableInterrupts();
+
+  return (nbSlid == 0) ? 0.0 : squaresToRMS(squares, nbSlid);
+}
+
+//Thread to take the samples when they are not taken in the PIT0 interrupt
 void PIT0Thread(void* data)
 {
-  uint8_t nbSamples = 0;
   for (;;)
   {
     OS_SemaphoreWait(PIT0_Semaphore, 0);                                             //Wait on PIT Semaphore
-    int16_t inputValue;
-    for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++){          //run through all the channels
-      Analog_Get(ChannelData[analogNb].channelNb, &inputValue);                     //sample the channel
-      ChannelData[analogNb].samples[nbSamples] = inputValue;                        //store the sample
-    }
-    nbSamples++;
-    // Signal the analog channels to take a sample
-    if(nbSamples == 16){
-      for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)         //if all 16 samples are ready, signal the next thread
-        OS_SemaphoreSignal(ChannelData[analogNb].semaphore);
-      nbSamples = 0;
-    }
+    if (!SampleInISR)                  //A signal from before a switch to the interrupt
+      TakeSample(NULL);
   }
 }
 
-void PIT1Thread(void* data)
+/*! @brief Starts the alarm tick, unless it is already running.
+ *
+ */
+static void StartAlarmTick(void)
 {
-  for (;;)
-  {
-    OS_SemaphoreWait(PIT1_Semaphore, 0);       //Wait on PIT Semaphore
+  if (!Timer_Running(&AlarmTimer))
+    Timer_Start(&AlarmTimer, ALARM_TICK_PERIOD, ALARM_TICK_PERIOD, AlarmTick, NULL);
+}
 
-    bool alarm = false;
-    // Signal the analog channels to take a sample
-    for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+/*! @brief Advances the alarm timing of every channel, from Timer_Thread at 100Hz.
+ *
+ */
+static void AlarmTick(void* arg)
+{
+  bool alarm = false;
+  // Signal the analog channels to take a sample
+  for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+  {
+    if(ChannelData[analogNb].alarm != 0)
     {
-      if(ChannelData[analogNb].alarm != 0)
+      if(*Timing_Mode == 2)                                                      //If mode is in inverse, do calculation, else add 5 to counter to make it trigger in 5 seconds
       {
-        if(*Timing_Mode == 2)                                                      //If mode is in inverse, do calculation, else add 5 to counter to make it trigger in 5 seconds
-        {
-          double tempCount = 25.0 / (0.5 / ChannelData[analogNb].deviation * 5);   //Calculation to see how much to increment in timer considerering a 100Hz interrupt
+        double tempCount = 25.0 / (0.5 / ChannelData[analogNb].deviation * 5);   //Calculation to see how much to increment in timer considerering a 100Hz interrupt
 
-          if(tempCount > 25.0)                                                     //Adjust if delay is going to be less than 1 second
-            tempCount = 25.0;
+        if(tempCount > 25.0)                                                     //Adjust if delay is going to be less than 1 second
+          tempCount = 25.0;
 
-          if(tempCount < 1)                                                        //Adjust if deviation is so small no increment will be given, max delay is 25 seconds
-            tempCount = 1.0;
+        if(tempCount < 1)                                                        //Adjust if deviation is so small no increment will be given, max delay is 25 seconds
+          tempCount = 1.0;
 
-          ChannelData[analogNb].trigCount += (uint16_t)(tempCount);                //Increment the trigcount by the nessecary value
-        }
-        else
-          ChannelData[analogNb].trigCount += 5;                                   //if direct timing, invrement 5 2500 / 5 / 100Hz = 5 sec
+        ChannelData[analogNb].trigCount += (uint16_t)(tempCount);                //Increment the trigcount by the nessecary value
+      }
+      else
+        ChannelData[analogNb].trigCount += 5;                                   //if direct timing, invrement 5 2500 / 5 / 100Hz = 5 sec
 
-        //If elapsed time has occured
-        if(ChannelData[analogNb].trigCount >= 2500)                               //Check if the time has run out, and the triggers need to be set
+      //If elapsed time has occured
+      if(ChannelData[analogNb].trigCount >= 2500)                               //Check if the time has run out, and the triggers need to be set
+      {
+        //If signal was above threshold, trigger a lower
+        if(ChannelData[analogNb].alarm == 1)
         {
-          //If signal was above threshold, trigger a lower
-          if(ChannelData[analogNb].alarm == 1)
-          {
-            Lower = true;
+          Lower = true;
 
-            LowerTimer = 0;
-            Analog_Put(LOWER, voltageToRaw(5));
-            if(!Triggered)
-              Flash_Write8(NbLowers, *NbLowers+1);
-          }
-          //If signal was below threshold, trigger a raise
-          if(ChannelData[analogNb].alarm == 2)
+          LowerTimer = 0;
+          Analog_Put(LOWER, voltageToRaw(5));
+          if(!Triggered)
           {
-            Raise = true;
+            Flash_Write8(NbLowers, *NbLowers+1);
+            EventLog_Put(EVENT_LOWER, ChannelData[analogNb].channelNb, ChannelData[analogNb].rms, ChannelData[analogNb].deviation);
+          }
+        }
+        //If signal was below threshold, trigger a raise
+        if(ChannelData[analogNb].alarm == 2)
+        {
+          Raise = true;
 
-            RaiseTimer = 0;
-            Analog_Put(RAISE, voltageToRaw(5));
-            if(!Triggered)
-              Flash_Write8(NbRaises, *NbRaises+1);
+          RaiseTimer = 0;
+          Analog_Put(RAISE, voltageToRaw(5));
+          if(!Triggered)
+          {
+            Flash_Write8(NbRaises, *NbRaises+1);
+            EventLog_Put(EVENT_RAISE, ChannelData[analogNb].channelNb, ChannelData[analogNb].rms, ChannelData[analogNb].deviation);
           }
-          //ChannelData[analogNb].alarm = 0;           //Reset counter
-          Triggered = true;
         }
-        else
-          ChannelData[analogNb].trigCount++;
+        //ChannelData[analogNb].alarm = 0;           //Reset counter
+        Triggered = true;
       }
-
-      alarm += ChannelData[analogNb].alarm;            //result should be 0 (false) if all alarm are off
-
-    }
-    Alarm = alarm;
-    //If the alarm is triggered, set it on. Else turn it off
-    if (alarm)
-      Analog_Put(ALARM, 16000);
-    else {
-      Analog_Put(ALARM, voltageToRaw(0.0));
-      Analog_Put(RAISE, voltageToRaw(0.0));
-      Analog_Put(LOWER, voltageToRaw(0.0));
-      PIT_Enable(1, false);
-      Triggered = false;
+      else
+        ChannelData[analogNb].trigCount++;
     }
 
-    //If no alarm, raise of lower is going on, turn of the PIT1 timer
-    if (!(alarm || Lower || Raise))
-      PIT_Enable(1, false);
+    alarm += ChannelData[analogNb].alarm;            //result should be 0 (false) if all alarm are off
+
+  }
+  Alarm = alarm;
+  //If the alarm is triggered, set it on. Else turn it off
+  if (alarm)
+    Analog_Put(ALARM, 16000);
+  else {
+    Analog_Put(ALARM, voltageToRaw(0.0));
+    Analog_Put(RAISE, voltageToRaw(0.0));
+    Analog_Put(LOWER, voltageToRaw(0.0));
+    Timer_Stop(&AlarmTimer);
+    Triggered = false;
   }
+
+  //If no alarm, raise of lower is going on, stop the alarm tick
+  if (!(alarm || Lower || Raise))
+    Timer_Stop(&AlarmTimer);
 }
 
 void PacketThread(void* data)
 {
-  SendStartupPacket();
+  Packet_BeginBatch(&ReplyBatch);
+  SendStartupPacket(PACKET_CHECK_XOR);
+  Packet_CommitBatch(&ReplyBatch);
   SetDefaultFlashValues();
   for (;;)
   {
@@ -662,9 +1125,9 @@ int main(void)
                           &PIT0ThreadStack[THREAD_STACK_SIZE-1],
                           6);
 
-  error = OS_ThreadCreate(PIT1Thread,
+  error = OS_ThreadCreate(Timer_Thread,
                           NULL,
-                          &PIT1ThreadStack[THREAD_STACK_SIZE-1],
+                          &TimerThreadStack[THREAD_STACK_SIZE-1],
                           7);
 
   error = OS_ThreadCreate(PacketThread,
@@ -672,23 +1135,21 @@ int main(void)
                           &PacketThreadStack[THREAD_STACK_SIZE-1],
                           8);
 
+  error = OS_ThreadCreate(Flash_CommitThread,
+                          NULL,
+                          &FlashCommitThreadStack[THREAD_STACK_SIZE-1],
+                          9);
+
+  error = OS_ThreadCreate(EventLog_Thread,
+                          NULL,
+                          &EventLogThreadStack[THREAD_STACK_SIZE-1],
+                          10);
+
   // Start multithreading - never returns!
   OS_Start();
 }
 
 
-void PITCallback(void* arg)
-{
-  /*
-  Analog_Get(analogData->0, &SamplesChA[NbSamplesChA]);
-  NbSamplesChA = (NbSamplesChA + 1) % 16;
-  Analog_Get(analogData->1, &SamplesChB[NbSamplesChB]);
-  NbSamplesChB = (NbSamplesChB + 1) % 16;
-  Analog_Get(analogData->2, &SamplesChC[NbSamplesChC]);
-  NbSamplesChB = (NbSamplesChB + 1) % 16;
-  */
-}
-
 /*!
  * @brief Converts analogue input into voltage in Volts
  *
@@ -710,35 +1171,51 @@ int16_t voltageToRaw(double voltage)
 }
 
 /*!
- * @brief Converts 16 analog samples into RMS voltage
+ * @brief Converts a sum of squared analog samples into RMS voltage
  * @return double - voltage value
  */
-double rmsCalc(int16_t samples[16])
+double squaresToRMS(uint64_t squares, uint16_t nbSamples)
+{
+  return sqrt((double) squares / nbSamples) * 20 / pow(2,16);
+}
+
+/*!
+ * @brief Converts an RMS voltage into the sum of squared analog samples it comes to
+ * @return uint64_t - sum of squares
+ */
+uint64_t rmsToSquares(double rms, uint16_t nbSamples)
 {
-  double sum = 0;
-  for(uint8_t i = 0; i < 16; i++)
-    sum += rawToVoltage(samples[i]) * rawToVoltage(samples[i]);
-  return (double)sqrt(sum/16);
+  double raw = rms * pow(2,16) / 20;
+  return (uint64_t) (raw * raw * nbSamples);
 }
 
 /*!
  * @brief Gets a frequency by interpolating the places where the wave crosses 0, and calculating the error to the current sampling rate
  */
-void FrequencyTracking(uint8_t index)
+void FrequencyTracking(const int16_t samples[], uint16_t length, uint16_t index)
 {
   static float offset1 = 0;
   static float offset2 = 0;
   static float spaceBetweenOffsets = 0;
+  static uint16_t trackedLength = 0;
 
   float sample1, sample2;
 
-  //Check that index -1 will be valid, if not get the previous sample (sample 16)
+  if (length != NbSamplesPerCycle)                   //A window from before the samples per cycle changed
+    return;
+  if (length != trackedLength)                       //Crossings from before the change are at another sample rate
+  {
+    offset1 = offset2 = spaceBetweenOffsets = 0;
+    trackedLength = length;
+  }
+
+  //Check that index -1 will be valid, if not get the previous sample (the last of the window)
   if (index == 0)
-    sample1 = rawToVoltage(ChannelData[CHA].samples[15]);
+    sample1 = rawToVoltage(samples[length - 1]);
   else
-    sample1 = rawToVoltage(ChannelData[CHA].samples[index - 1]);
+    sample1 = rawToVoltage(samples[index - 1]);
 
-  sample2 = rawToVoltage(ChannelData[CHA].samples[index]);
+  sample2 = rawToVoltage(samples[index]);
 
   //If there is a  positive crossing through 0V
   if (sample1 < 0 && sample2 > 0)
@@ -750,15 +1227,16 @@ void FrequencyTracking(uint8_t index)
   else if (sample1 > 0 && sample2 < 0)
   {
     offset2 = (-sample1) / (sample2 - sample1);      //calculate the offset in fractions between samples
-    double newPeriodNs = ((spaceBetweenOffsets - offset1 + offset2) * PeriodNs / 8); // Period of wave in s
+    double newPeriodNs = ((spaceBetweenOffsets - offset1 + offset2) * SamplingRate * 2); // Period of wave in ns, from the achieved sample period
     double newFreq = 1.0  / (newPeriodNs / 1000000000);
     if (newFreq >= 47.5 && newFreq <= 52.5)
     {
       uint8_t temp = 9;
       Frequency = newFreq;                           //Update global frequency
       PeriodNs = (1 / Frequency) * 1000000000;
-      SamplingRate = PeriodNs / 16;
-      PIT_Set(0, SamplingRate, true);                //Redefine PIT period and restart
+      SamplingRate = PeriodNs / length;
+      PIT_Set(0, SamplingRate, false);               //Redefine PIT period from the next reload, so no interval is cut short
+      SamplingRate = PIT_GetPeriod(0) / 1000.0f;     //Rounded to bus clocks
     }
   }
   spaceBetweenOffsets++;
@@ -767,19 +1245,30 @@ void FrequencyTracking(uint8_t index)
 //Calculates the Spectrum of the samples in Channel A
 //k is the harmonic number
 double Spectral_Analysis(unsigned long k){
-  double data[32];
-  //format the data so that it fits with the library requierements
-  for(uint8_t i = 0; i < 32; i+=2){
-    data[i] = rawToVoltage(ChannelData[CHA].samples[i]);
-    data[i+1] = 0; //Make real part 0
+  static double data[2 * SAMPLES_PER_CYCLE_MAX];          //Too big for the stack of PacketThread
+  uint32_t windowNb;
+  uint16_t length;
+  //format the data so that it fits with the library requierements, again if a window was completed meanwhile
+  do
+  {
+    windowNb = WindowNb;
+    length = WindowLength[windowNb & 1];
+    for(uint16_t i = 0; i < 2 * length; i+=2){
+      data[i] = rawToVoltage(ChannelData[CHA].windows[windowNb & 1][i / 2]);
+      data[i+1] = 0; //Make real part 0
+    }
   }
+  while (windowNb != WindowNb);
+
+  if (length == 0)                                         //No window taken yet
+    return 0;
 
-  fft(data, 16);                                           //calculate the fft
+  fft(data, length);                                       //calculate the fft
 
-  double v = fftMagnitude(data,16,k);
-  //double dB = fftMagdB(data,16,k,2.0); // largest component is 2V
-  double phase = fftPhase(data,16,k);
-  double freq = fftFrequency(16,k,Frequency * 16);
+  double v = fftMagnitude(data,length,k);
+  //double dB = fftMagdB(data,length,k,2.0); // largest component is 2V
+  double phase = fftPhase(data,length,k);
+  double freq = fftFrequency(length,k,Frequency * length);
 
   return v;
 }
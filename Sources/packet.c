@@ -17,31 +17,144 @@
 #include "types.h"
 #include "LEDs.h"
 #include "Flash.h"
+#include "CRC.h"
+#include "Time.h"
 #include "PE_Types.h"
 #include "Cpu.h"
 
 /****************************************GLOBAL VARS*****************************************************/
 
 TPacket Packet;
-
-uint8_t packet_position = 0;  //Used to mark the position of incoming bytes
+uint64_t Packet_Time;
 
 const uint8_t PACKET_ACK_MASK = 0x80u; //Used to mask out the Acknowledgment bit
 
+static volatile TPacketCheck Check = PACKET_CHECK_XOR; //Frame check in use, read by RxThread
+
+#define PACKET_QUEUE_SIZE 4           //Number of validated frames that can wait for PacketThread
+
+static TPacket RxFrame;               //Frame being assembled by RxThread
+static uint8_t RxPosition = 0;        //Used to mark the position of incoming bytes
+
+static TPacket FrameQueue[PACKET_QUEUE_SIZE]; //Validated frames waiting to be handled
+static uint64_t FrameTimes[PACKET_QUEUE_SIZE]; //Time_Now64 when each queued frame was validated
+static uint8_t FrameQueueStart = 0;   //Index of the oldest frame, only modified by Packet_Get
+static uint8_t FrameQueueEnd = 0;     //Index of the next free slot, only modified by RxThread
+static OS_ECB *FramesAvailable;       //Counts the frames in FrameQueue
+static OS_ECB *FrameSpaceAvailable;   //Counts the free slots in FrameQueue
+
 /****************************************PRIVATE FUNCTION DECLARATION***********************************/
 
-bool PacketTest(void);
+static uint8_t PacketCheckXOR(const uint8_t bytes[]);
+static uint8_t PacketCheckCRC8(const uint8_t bytes[]);
+static bool PacketTest(const TPacket * const packet);
+static void PacketRxByte(const uint8_t data);
+static void PacketEncode(uint8_t frame[], const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3);
+static void PacketFlushBatch(TPacketBatch * const batch);
 
 /****************************************PRIVATE FUNCTION DEFINITION***************************************/
 
-/*! @brief Handles the stored packet
+/*! @brief Calculates the legacy XOR checksum of a frame
+ *
+ *  @param bytes The command and the three parameters.
+ *  @return uint8_t - The XOR of the four bytes.
+ */
+static uint8_t PacketCheckXOR(const uint8_t bytes[])
+{
+  return bytes[0] ^ bytes[1] ^ bytes[2] ^ bytes[3];
+}
+
+/*! @brief Calculates the CRC-8 of a frame
  *
+ *  @param bytes The command and the three parameters.
+ *  @return uint8_t - The CRC-8 of the four bytes, always four table lookups.
+ */
+static uint8_t PacketCheckCRC8(const uint8_t bytes[])
+{
+  return CRC_8(0, bytes, 4);
+}
+
+/*! @brief Checks the checksum of a packet
+ *
+ *  @param packet A pointer to the packet to check.
  *  @return bool - True if the calculated checksum is equal to the packet checksum
+ *  @note In CRC-8 mode a legacy XOR startup packet is still accepted, so old PC software can reconnect.
  */
-bool PacketTest(void)
+static bool PacketTest(const TPacket * const packet)
 {
-  uint8_t calculated_checksum = Packet_Command ^ Packet_Parameter1 ^ Packet_Parameter2 ^ Packet_Parameter3;
-  return (calculated_checksum == Packet_Checksum);
+  bool xorOK = (PacketCheckXOR(packet->bytes) == packet->packetStruct.checksum);
+
+  if (Check == PACKET_CHECK_XOR)
+    return xorOK;
+
+  if (PacketCheckCRC8(packet->bytes) == packet->packetStruct.checksum)
+    return true;
+
+  return (xorOK && (packet->packetStruct.command & ~PACKET_ACK_MASK) == PACKET_STARTUP_COMMAND
+          && packet->packetStruct.parameters.separate.parameter1 == 0
+          && packet->packetStruct.parameters.separate.parameter2 == 0
+          && packet->packetStruct.parameters.separate.parameter3 == 0);
+}
+
+/*! @brief Assembles received bytes into frames and queues the valid ones for Packet_Get.
+ *
+ *  @param data The byte received by the UART.
+ *  @note Called from RxThread, so PacketThread is only woken once a whole frame has been validated.
+ */
+static void PacketRxByte(const uint8_t data)
+{
+  RxFrame.bytes[RxPosition++] = data;
+
+  if (RxPosition < PACKET_NB_BYTES)
+    return; //Incomplete packet
+
+  if (!PacketTest(&RxFrame))
+  {
+    //The Checksum doesn't match: drop only the oldest byte and test again on the next one,
+    //so a corrupted or spurious byte costs the frames that contain it and no more
+    for (uint8_t i = 1; i < PACKET_NB_BYTES; i++)
+      RxFrame.bytes[i - 1] = RxFrame.bytes[i];
+    RxPosition = PACKET_NB_BYTES - 1;
+    return;
+  }
+
+  RxPosition = 0;
+  uint64_t time = Time_Now64();                         //Before waiting for a slot, so the wait counts as latency
+
+  OS_SemaphoreWait(FrameSpaceAvailable, 0);             //Wait until there is a free slot
+  FrameQueue[FrameQueueEnd] = RxFrame;
+  FrameTimes[FrameQueueEnd] = time;
+  FrameQueueEnd = (FrameQueueEnd + 1) % PACKET_QUEUE_SIZE;
+  OS_SemaphoreSignal(FramesAvailable);                  //Wake PacketThread once for the whole frame
+}
+
+/*! @brief Encodes a frame, with the check currently in use, at the given location.
+ *
+ *  @param frame Where to place the PACKET_NB_BYTES bytes of the frame.
+ */
+static void PacketEncode(uint8_t frame[], const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3)
+{
+  frame[0] = command;
+  frame[1] = parameter1;
+  frame[2] = parameter2;
+  frame[3] = parameter3;
+  frame[4] = (Check == PACKET_CHECK_CRC8 ? PacketCheckCRC8(frame) : PacketCheckXOR(frame));
+}
+
+/*! @brief Sends the staged frames to the transmit FIFO as one block.
+ *
+ *  @param batch The batch.
+ */
+static void PacketFlushBatch(TPacketBatch * const batch)
+{
+  if (batch->nbFrames == 0)
+    return;
+
+  OS_SemaphoreWait(PacketPutSemaphore, 0); //Wait on Packet Put Semaphore
+  UART_OutBlock(batch->frames, batch->nbFrames * PACKET_NB_BYTES);
+  OS_SemaphoreSignal(PacketPutSemaphore); //Signal Packet Put Semaphore
+
+  batch->nbFrames = 0;
 }
 
 /****************************************PUBLIC FUNCTION DEFINITION***************************************/
@@ -55,99 +168,84 @@ bool PacketTest(void)
 bool Packet_Init(const uint32_t baudRate, const uint32_t moduleClk)
 {
   PacketPutSemaphore = OS_SemaphoreCreate(1); //Create Packet Semaphore
+  FramesAvailable = OS_SemaphoreCreate(0);
+  FrameSpaceAvailable = OS_SemaphoreCreate(PACKET_QUEUE_SIZE);
+
+  if (!UART_Init(baudRate, moduleClk))
+    return false;
 
-  return (UART_Init(baudRate, moduleClk));
+  UART_SetRxCallback(PacketRxByte);           //Frames are assembled in RxThread from now on
+
+  return true;
 }
 
-/*! @brief Attempts to get a packet from the received data.
+/*! @brief Waits for a validated packet from the frame queue and places it in Packet.
  *
  *  @return bool - TRUE if a valid packet was received.
  */
-bool Packet_Get(void) {
-  //EnterCritical();
-  uint8_t uartData;
+bool Packet_Get(void)
+{
+  OS_SemaphoreWait(FramesAvailable, 0);        //Blocks until RxThread has queued a whole frame
 
-  //Checks whether there is data in the RxFIFO and stores it the address pointed by uartData
-  UART_InChar(&uartData);
-  switch (packet_position)
-  {
-    //Command byte
-    case 0:
-      Packet_Command = uartData;
-      packet_position++;
-      //ExitCritical();
-      return false; //Return false, incomplete packet
-      break;
-
-      //Parameter1 byte
-    case 1:
-      Packet_Parameter1 = uartData;
-      packet_position++;
-      //ExitCritical();
-      return false; //Return false, incomplete packet
-      break;
-
-      //Parameter2 byte
-    case 2:
-      Packet_Parameter2 = uartData;
-      packet_position++;
-      ExitCritical();
-      return false; //Return false, incomplete packet
-      break;
-
-      //Parameter3 byte
-    case 3:
-      Packet_Parameter3 = uartData;
-      packet_position++;
-      //ExitCritical();
-      return false; //Return false, incomplete packet
-      break;
-
-      //Checksum byte
-    case 4:
-      Packet_Checksum = uartData;
-
-      if (PacketTest())
-      {
-        packet_position = 0;
-        //ExitCritical();
-        return true; //Return true, complete packet
-      }
-      //The Checksum doesn't match
-      //Shift the packets down
-      Packet_Command = Packet_Parameter1;
-      Packet_Parameter1 = Packet_Parameter2;
-      Packet_Parameter2 = Packet_Parameter3;
-      Packet_Parameter3 = Packet_Checksum;
-      packet_position = 0;
-      //ExitCritical();
-      return false;
-      break;
-
-    default: //reset
-      packet_position = 0;
-      //ExitCritical();
-      break;
-  }
+  Packet = FrameQueue[FrameQueueStart];
+  Packet_Time = FrameTimes[FrameQueueStart];
+  FrameQueueStart = (FrameQueueStart + 1) % PACKET_QUEUE_SIZE;
+
+  OS_SemaphoreSignal(FrameSpaceAvailable);
 
-  // ExitCritical();
-  return false;
+  return true;
 }
 
-/*! @brief Builds a packet and places it in the transmit FIFO buffer.
+/*! @brief Selects the frame check used for received and transmitted packets.
  *
- *  @return bool - TRUE if a valid packet was sent.
+ *  @param check The frame check negotiated with the PC.
  */
-void Packet_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3)
+void Packet_SetCheck(const TPacketCheck check)
 {
-  OS_SemaphoreWait(PacketPutSemaphore, 0); //Wait on Packet Put Semaphore
+  Check = check;
+}
+
+/*! @brief Starts staging the packets of one command, so they are sent together by Packet_CommitBatch.
+ *
+ *  @param batch The batch of the calling thread.
+ */
+void Packet_BeginBatch(TPacketBatch * const batch)
+{
+  batch->nbFrames = 0;
+}
+
+/*! @brief Builds a packet and stages it in a batch. A full batch is sent first.
+ *
+ *  @param batch The batch of the calling thread.
+ */
+void Packet_PutBatch(TPacketBatch * const batch, const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3)
+{
+  if (batch->nbFrames == PACKET_BATCH_SIZE)
+    PacketFlushBatch(batch);    //Batch full, send what we have so far
+
+  PacketEncode(&batch->frames[batch->nbFrames * PACKET_NB_BYTES], command, parameter1, parameter2, parameter3);
+  batch->nbFrames++;
+}
+
+/*! @brief Sends the staged packets as one contiguous block.
+ *
+ *  @param batch The batch of the calling thread.
+ */
+void Packet_CommitBatch(TPacketBatch * const batch)
+{
+  PacketFlushBatch(batch);
+}
 
-  UART_OutChar(command); //Place Command byte in TxFIFO
-  UART_OutChar(parameter1); //Place Parameter1 byte in TxFIFO
-  UART_OutChar(parameter2); //Place Parameter2 byte in TxFIFO
-  UART_OutChar(parameter3); //Place Parameter3 byte in TxFIFO
-  UART_OutChar(command ^ parameter1 ^ parameter2 ^ parameter3); //Place Checksum byte in TxFIFO
+/*! @brief Builds a packet and places it in the transmit FIFO buffer at once, whatever batches are open.
+ *
+ */
+void Packet_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3)
+{
+  uint8_t frame[PACKET_NB_BYTES];
+  PacketEncode(frame, command, parameter1, parameter2, parameter3);
 
+  OS_SemaphoreWait(PacketPutSemaphore, 0); //Wait on Packet Put Semaphore
+  UART_OutBlock(frame, PACKET_NB_BYTES);   //Place the whole frame in TxFIFO
   OS_SemaphoreSignal(PacketPutSemaphore); //Signal Packet Put Semaphore
 }
 
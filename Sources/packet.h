@@ -58,6 +58,18 @@ typedef union
 
 #pragma pack(pop)
 
+#define PACKET_BATCH_SIZE 4           //Number of frames a batch stages before they are sent
+
+/*!
+ * @struct TPacketBatch
+ * @brief Frames staged by one thread, sent together by Packet_CommitBatch. Each thread uses its own.
+ */
+typedef struct
+{
+  uint8_t frames[PACKET_BATCH_SIZE * PACKET_NB_BYTES]; /*!< The staged frames, encoded */
+  uint8_t nbFrames;                   /*!< The number of staged frames */
+} TPacketBatch;
+
 #define Packet_Command     Packet.packetStruct.command
 #define Packet_Parameter1  Packet.packetStruct.parameters.separate.parameter1
 #define Packet_Parameter2  Packet.packetStruct.parameters.separate.parameter2
@@ -68,10 +80,23 @@ typedef union
 
 
 extern TPacket Packet;
+extern uint64_t Packet_Time;          //Time_Now64 when the frame in Packet was received
 
 // Acknowledgment bit mask
 extern const uint8_t PACKET_ACK_MASK;
 
+// Startup command, also used to negotiate the frame check
+#define PACKET_STARTUP_COMMAND 0x04
+
+/*! @brief Frame checks that can be negotiated with the PC
+ *
+ */
+typedef enum
+{
+  PACKET_CHECK_XOR = 0,   /*!< Legacy XOR of the command and parameters */
+  PACKET_CHECK_CRC8 = 1   /*!< CRC-8, polynomial 0x07, of the command and parameters */
+} TPacketCheck;
+
 //extern uint16union_t volatile *TowerNumber, *TowerMode;
 //extern uint8_t volatile *Characteristic;
 
@@ -85,13 +110,38 @@ extern const uint8_t PACKET_ACK_MASK;
  */
 bool Packet_Init(const uint32_t baudRate, const uint32_t moduleClk);
 
-/*! @brief Attempts to get a packet from the received data.
+/*! @brief Waits for a validated packet from the frame queue and places it in Packet.
  *
  *  @return bool - TRUE if a valid packet was received.
+ *  @note Frames are assembled and checked in RxThread, so the caller only wakes once per frame.
  */
 bool Packet_Get(void);
 
-/*! @brief Builds a packet and places it in the transmit FIFO buffer.
+/*! @brief Selects the frame check used for received and transmitted packets.
+ *
+ *  @param check The frame check negotiated with the PC.
+ */
+void Packet_SetCheck(const TPacketCheck check);
+
+/*! @brief Starts staging the packets of one command, so they are sent together by Packet_CommitBatch.
+ *
+ *  @param batch The batch of the calling thread.
+ */
+void Packet_BeginBatch(TPacketBatch * const batch);
+
+/*! @brief Builds a packet and stages it in a batch. A full batch is sent first.
+ *
+ *  @param batch The batch of the calling thread.
+ */
+void Packet_PutBatch(TPacketBatch * const batch, const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3);
+
+/*! @brief Sends the staged packets as one contiguous block.
+ *
+ *  @param batch The batch of the calling thread.
+ */
+void Packet_CommitBatch(TPacketBatch * const batch);
+
+/*! @brief Builds a packet and places it in the transmit FIFO buffer at once, whatever batches are open.
  *
  */
 void Packet_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3);
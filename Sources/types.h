@@ -84,4 +84,9 @@ typedef union
   } s;
 } uint32_8union_t;
 
+// Places a function in RAM (the .ramcode section of ProcessorExpert.ld), so it does not fetch from flash.
+// The functions it calls, the RTOS among them, still may: they keep running while the flash is busy only
+// because the flash written to is in the other block
+#define RAMFUNC __attribute__ ((section (".ramcode"), long_call, noinline))
+
 #endif